@@ -21,10 +21,12 @@ DEFINES += QT_DEPRECATED_WARNINGS
 HEADERS += src/addrdb.h \
            src/addrman.h \
            src/amount.h \
+           src/arenamap.h \
            src/arith_uint256.h \
            src/base58.h \
            src/bech32.h \
            src/blockencodings.h \
+           src/blockfilemap.h \
            src/bloom.h \
            src/bmmcache.h \
            src/chain.h \
@@ -361,6 +363,7 @@ SOURCES += src/addrdb.cpp \
            src/base58.cpp \
            src/bech32.cpp \
            src/blockencodings.cpp \
+           src/blockfilemap.cpp \
            src/bloom.cpp \
            src/bmmcache.cpp \
            src/chain.cpp \
@@ -422,12 +425,15 @@ SOURCES += src/addrdb.cpp \
            src/bench/checkqueue.cpp \
            src/bench/coin_selection.cpp \
            src/bench/crypto_hash.cpp \
+           src/bench/dbwrapper.cpp \
            src/bench/Examples.cpp \
            src/bench/lockedpool.cpp \
            src/bench/mempool_eviction.cpp \
+           src/bench/merkle_root.cpp \
            src/bench/perf.cpp \
            src/bench/prevector_destructor.cpp \
            src/bench/rollingbloom.cpp \
+           src/bench/verify_deposits.cpp \
            src/bench/verify_script.cpp \
            src/compat/glibc_compat.cpp \
            src/compat/glibc_sanity.cpp \
@@ -442,7 +448,10 @@ SOURCES += src/addrdb.cpp \
            src/crypto/ripemd160.cpp \
            src/crypto/sha1.cpp \
            src/crypto/sha256.cpp \
+           src/crypto/sha256_avx2.cpp \
+           src/crypto/sha256_shani.cpp \
            src/crypto/sha256_sse4.cpp \
+           src/crypto/sha256_sse41.cpp \
            src/crypto/sha512.cpp \
            src/policy/corepolicy.cpp \
            src/policy/feerate.cpp \
@@ -532,6 +541,7 @@ SOURCES += src/addrdb.cpp \
            src/test/addrman_tests.cpp \
            src/test/allocator_tests.cpp \
            src/test/amount_tests.cpp \
+           src/test/arenamap_tests.cpp \
            src/test/arith_uint256_tests.cpp \
            src/test/base32_tests.cpp \
            src/test/base58_tests.cpp \
@@ -540,6 +550,7 @@ SOURCES += src/addrdb.cpp \
            src/test/bip32_tests.cpp \
            src/test/blockchain_tests.cpp \
            src/test/blockencodings_tests.cpp \
+           src/test/blockfilemap_tests.cpp \
            src/test/bloom_tests.cpp \
            src/test/bmmcache_tests.cpp \
            src/test/bswap_tests.cpp \
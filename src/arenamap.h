@@ -0,0 +1,361 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ARENAMAP_H
+#define BITCOIN_ARENAMAP_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Hash map for many small entries, meant for the coins cache.
+ *
+ * The entries are stored in nodes carved out of large chunks of memory (an
+ * arena) instead of being allocated one by one, and are found through a flat
+ * open addressing table with linear probing. A slot of the table holds 32
+ * bits of the key's hash and the index of the node, so a lookup scans a few
+ * contiguous slots and only looks at the node of a slot whose hash matches.
+ * Erased nodes are reused by later inserts and clear() frees all memory at
+ * once.
+ *
+ * The API is the subset of std::unordered_map's that CCoinsViewCache and its
+ * users need, with the same guarantees: pointers and references to entries
+ * stay valid until the entry is erased, iterators are invalidated by inserts
+ * (which may grow the table) but not by erasing other entries.
+ */
+template <typename K, typename V, typename Hash>
+class arenamap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef size_t size_type;
+
+private:
+    //! Chunks hold at most 2^CHUNK_BITS nodes, starting at MIN_CHUNK_NODES and doubling
+    static const int CHUNK_BITS = 12;
+    static const uint32_t MIN_CHUNK_NODES = 16;
+    static const uint32_t MIN_SLOTS = 16;
+
+    static const uint32_t NODE_NONE = 0xffffffff;
+    static const uint32_t NODE_DELETED = 0xfffffffe;
+    static const size_t POS_END = (size_t)-1;
+
+    struct Slot
+    {
+        uint32_t hash;
+        uint32_t node;
+    };
+
+    typedef typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type Node;
+    static_assert(sizeof(Node) >= sizeof(uint32_t), "free nodes hold the index of the next free node");
+
+    struct Chunk
+    {
+        std::unique_ptr<Node[]> nodes;
+        uint32_t nCapacity;
+    };
+
+    std::vector<Chunk> vChunk;
+    //! Nodes handed out from the last chunk
+    uint32_t nChunkUsed;
+    //! First of the list of erased nodes
+    uint32_t nFreeNode;
+
+    std::unique_ptr<Slot[]> slots;
+    //! Number of slots, 0 or a power of 2
+    size_t nSlots;
+    size_t nSize;
+    //! Slots of erased entries that are still part of a probe sequence
+    size_t nDeleted;
+
+    Hash hasher;
+
+    Node* NodeStorage(uint32_t node) const
+    {
+        return &vChunk[node >> CHUNK_BITS].nodes[node & ((1 << CHUNK_BITS) - 1)];
+    }
+
+    value_type* NodePtr(uint32_t node) const
+    {
+        return reinterpret_cast<value_type*>(NodeStorage(node));
+    }
+
+    uint32_t AllocNode()
+    {
+        if (nFreeNode != NODE_NONE) {
+            uint32_t node = nFreeNode;
+            memcpy(&nFreeNode, NodeStorage(node), sizeof(nFreeNode));
+            return node;
+        }
+        if (vChunk.empty() || nChunkUsed == vChunk.back().nCapacity) {
+            assert(vChunk.size() < (NODE_DELETED >> CHUNK_BITS));
+            uint32_t nCapacity = vChunk.empty() ? MIN_CHUNK_NODES : std::min<uint32_t>(vChunk.back().nCapacity * 2, 1 << CHUNK_BITS);
+            vChunk.push_back(Chunk{std::unique_ptr<Node[]>(new Node[nCapacity]), nCapacity});
+            nChunkUsed = 0;
+        }
+        return ((uint32_t)(vChunk.size() - 1) << CHUNK_BITS) | nChunkUsed++;
+    }
+
+    //! Put a node that doesn't hold a value (anymore) on the free list
+    void FreeNode(uint32_t node)
+    {
+        memcpy(NodeStorage(node), &nFreeNode, sizeof(nFreeNode));
+        nFreeNode = node;
+    }
+
+    static uint32_t SlotHash(size_t hash)
+    {
+        return (uint32_t)((uint64_t)hash ^ ((uint64_t)hash >> 32));
+    }
+
+    //! Position of the slot of key, or POS_END if it isn't in the map
+    size_t FindSlot(const K& key, uint32_t hash) const
+    {
+        if (nSize == 0)
+            return POS_END;
+        const size_t mask = nSlots - 1;
+        for (size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+            const Slot& slot = slots[pos];
+            if (slot.node == NODE_NONE)
+                return POS_END;
+            if (slot.node != NODE_DELETED && slot.hash == hash && NodePtr(slot.node)->first == key)
+                return pos;
+        }
+    }
+
+    //! Position of the first slot holding an entry at or after pos
+    size_t NextSlot(size_t pos) const
+    {
+        for (; pos < nSlots; pos++) {
+            if (slots[pos].node < NODE_DELETED)
+                return pos;
+        }
+        return POS_END;
+    }
+
+    //! Put a node in the first free slot of its probe sequence, the table must have room
+    static size_t PlaceSlot(Slot* table, size_t mask, uint32_t hash, uint32_t node)
+    {
+        size_t pos = hash & mask;
+        while (table[pos].node < NODE_DELETED)
+            pos = (pos + 1) & mask;
+        table[pos].hash = hash;
+        table[pos].node = node;
+        return pos;
+    }
+
+    //! Make sure one more entry can be added while keeping the table at most 3/4 full
+    void Reserve()
+    {
+        if ((nSize + nDeleted + 1) * 4 <= nSlots * 3)
+            return;
+
+        // Rebuild the table at most half full, dropping the deleted slots
+        size_t nNewSlots = MIN_SLOTS;
+        while ((nSize + 1) * 2 > nNewSlots)
+            nNewSlots *= 2;
+        std::unique_ptr<Slot[]> newSlots(new Slot[nNewSlots]);
+        for (size_t i = 0; i < nNewSlots; i++)
+            newSlots[i].node = NODE_NONE;
+        for (size_t pos = 0; pos < nSlots; pos++) {
+            if (slots[pos].node < NODE_DELETED)
+                PlaceSlot(newSlots.get(), nNewSlots - 1, slots[pos].hash, slots[pos].node);
+        }
+        slots = std::move(newSlots);
+        nSlots = nNewSlots;
+        nDeleted = 0;
+    }
+
+public:
+    template <typename M, typename T>
+    class iterator_base
+    {
+        template <typename, typename> friend class iterator_base;
+        friend class arenamap;
+
+        M* map;
+        size_t pos;
+
+        iterator_base(M* mapIn, size_t posIn) : map(mapIn), pos(posIn) {}
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T* pointer;
+        typedef T& reference;
+
+        iterator_base() : map(nullptr), pos(POS_END) {}
+
+        //! Allows converting an iterator into a const_iterator
+        template <typename M2, typename T2>
+        iterator_base(const iterator_base<M2, T2>& it) : map(it.map), pos(it.pos) {}
+
+        T& operator*() const { return *map->NodePtr(map->slots[pos].node); }
+        T* operator->() const { return map->NodePtr(map->slots[pos].node); }
+
+        iterator_base& operator++()
+        {
+            pos = map->NextSlot(pos + 1);
+            return *this;
+        }
+
+        iterator_base operator++(int)
+        {
+            iterator_base ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        template <typename M2, typename T2>
+        bool operator==(const iterator_base<M2, T2>& it) const { return pos == it.pos; }
+        template <typename M2, typename T2>
+        bool operator!=(const iterator_base<M2, T2>& it) const { return pos != it.pos; }
+    };
+
+    typedef iterator_base<arenamap, value_type> iterator;
+    typedef iterator_base<const arenamap, const value_type> const_iterator;
+
+    arenamap() : nChunkUsed(0), nFreeNode(NODE_NONE), nSlots(0), nSize(0), nDeleted(0) {}
+    ~arenamap() { clear(); }
+
+    arenamap(const arenamap&) = delete;
+    arenamap& operator=(const arenamap&) = delete;
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator begin() { return iterator(this, NextSlot(0)); }
+    iterator end() { return iterator(this, POS_END); }
+    const_iterator begin() const { return const_iterator(this, NextSlot(0)); }
+    const_iterator end() const { return const_iterator(this, POS_END); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    iterator find(const K& key) { return iterator(this, FindSlot(key, SlotHash(hasher(key)))); }
+    const_iterator find(const K& key) const { return const_iterator(this, FindSlot(key, SlotHash(hasher(key)))); }
+    size_t count(const K& key) const { return FindSlot(key, SlotHash(hasher(key))) != POS_END; }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        // Build the entry in a node first, we need its key
+        uint32_t node = AllocNode();
+        value_type* value = NodePtr(node);
+        try {
+            new (value) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            FreeNode(node);
+            throw;
+        }
+
+        const uint32_t hash = SlotHash(hasher(value->first));
+        size_t pos = FindSlot(value->first, hash);
+        if (pos != POS_END) {
+            value->~value_type();
+            FreeNode(node);
+            return std::make_pair(iterator(this, pos), false);
+        }
+
+        Reserve();
+        pos = hash & (nSlots - 1);
+        while (slots[pos].node < NODE_DELETED)
+            pos = (pos + 1) & (nSlots - 1);
+        if (slots[pos].node == NODE_DELETED)
+            nDeleted--;
+        slots[pos].hash = hash;
+        slots[pos].node = node;
+        nSize++;
+        return std::make_pair(iterator(this, pos), true);
+    }
+
+    V& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it != end())
+            return it->second;
+        return emplace(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first->second;
+    }
+
+    iterator erase(const_iterator it)
+    {
+        const size_t pos = it.pos;
+        value_type* value = NodePtr(slots[pos].node);
+        value->~value_type();
+        FreeNode(slots[pos].node);
+
+        // A slot followed by an empty one isn't in the middle of any probe sequence
+        if (slots[(pos + 1) & (nSlots - 1)].node == NODE_NONE) {
+            slots[pos].node = NODE_NONE;
+        } else {
+            slots[pos].node = NODE_DELETED;
+            nDeleted++;
+        }
+        nSize--;
+        return iterator(this, NextSlot(pos + 1));
+    }
+
+    size_t erase(const K& key)
+    {
+        const_iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    void swap(arenamap& other)
+    {
+        std::swap(vChunk, other.vChunk);
+        std::swap(nChunkUsed, other.nChunkUsed);
+        std::swap(nFreeNode, other.nFreeNode);
+        std::swap(slots, other.slots);
+        std::swap(nSlots, other.nSlots);
+        std::swap(nSize, other.nSize);
+        std::swap(nDeleted, other.nDeleted);
+        std::swap(hasher, other.hasher);
+    }
+
+    //! Remove all entries and free all of the memory
+    void clear()
+    {
+        if (!std::is_trivially_destructible<value_type>::value) {
+            for (size_t pos = 0; pos < nSlots; pos++) {
+                if (slots[pos].node < NODE_DELETED)
+                    NodePtr(slots[pos].node)->~value_type();
+            }
+        }
+        std::vector<Chunk>().swap(vChunk);
+        nChunkUsed = 0;
+        nFreeNode = NODE_NONE;
+        slots.reset();
+        nSlots = 0;
+        nSize = 0;
+        nDeleted = 0;
+    }
+
+    //! Sum of usage(n) over the sizes n of all of the map's allocations
+    template <typename F>
+    size_t allocated_usage(F usage) const
+    {
+        size_t ret = usage(sizeof(Chunk) * vChunk.capacity()) + usage(sizeof(Slot) * nSlots);
+        for (const Chunk& chunk : vChunk)
+            ret += usage(sizeof(Node) * chunk.nCapacity);
+        return ret;
+    }
+};
+
+#endif // BITCOIN_ARENAMAP_H
@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <wallet/crypter.h>
 
 #include <vector>
@@ -84,4 +85,32 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// Add many coins to a cache layered on top of another one, look them up,
+// flush them into the lower cache and look them up there, which exercises
+// CCoinsMap inserts, lookups, BatchWrite and clearing.
+static void CCoinsCacheFlush(benchmark::State& state)
+{
+    const int nCoins = 50000;
+
+    FastRandomContext rng(true);
+    std::vector<COutPoint> vOutPoint;
+    for (int i = 0; i < nCoins; i++)
+        vOutPoint.emplace_back(rng.rand256(), i % 4);
+    const CTxOut out(CENT, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0) << OP_EQUALVERIFY << OP_CHECKSIG);
+
+    CCoinsView coinsDummy;
+    while (state.KeepRunning()) {
+        CCoinsViewCache base(&coinsDummy);
+        CCoinsViewCache cache(&base);
+        for (const COutPoint& outpoint : vOutPoint)
+            cache.AddCoin(outpoint, Coin(out, 1, false), false);
+        for (const COutPoint& outpoint : vOutPoint)
+            assert(cache.HaveCoin(outpoint));
+        cache.Flush();
+        for (const COutPoint& outpoint : vOutPoint)
+            assert(!base.AccessCoin(outpoint).IsSpent());
+    }
+}
+
 BENCHMARK(CCoinsCaching, 170 * 1000);
+BENCHMARK(CCoinsCacheFlush, 20);
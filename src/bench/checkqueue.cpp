@@ -17,6 +17,7 @@ static const size_t BATCHES = 101;
 static const size_t BATCH_SIZE = 30;
 static const int PREVECTOR_SIZE = 28;
 static const unsigned int QUEUE_BATCH_SIZE = 128;
+static const int MANY_WORKERS = 16;
 
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
@@ -60,3 +61,33 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// This Benchmark tests the CheckQueue with many workers and cheap checks,
+// where the time is dominated by how the workers get their batches rather
+// than by the checks themselves.
+static void CCheckQueueSpeedManyWorkers(benchmark::State& state)
+{
+    struct CheapJob {
+        bool operator()()
+        {
+            return true;
+        }
+        void swap(CheapJob& x){};
+    };
+    CCheckQueue<CheapJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < MANY_WORKERS; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CheapJob> control(&queue);
+        for (size_t i = 0; i < BATCHES; ++i) {
+            std::vector<CheapJob> vChecks(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+BENCHMARK(CCheckQueueSpeedManyWorkers, 1400);
@@ -42,6 +42,14 @@ static void SHA256(benchmark::State& state)
         CSHA256().Write(in.data(), in.size()).Finalize(hash);
 }
 
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
 static void SHA256_32b(benchmark::State& state)
 {
     std::vector<uint8_t> in(32,0);
@@ -69,6 +77,18 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+static void SipHash_32b_x4(benchmark::State& state)
+{
+    uint256 x[4];
+    const uint256* px[4] = {&x[0], &x[1], &x[2], &x[3]};
+    uint64_t out[4];
+    uint64_t k1 = 0;
+    while (state.KeepRunning()) {
+        SipHashUint256x4(0, ++k1, px, out);
+        *((uint64_t*)x[0].begin()) = out[0];
+    }
+}
+
 static void FastRandom_32bit(benchmark::State& state)
 {
     FastRandomContext rng(true);
@@ -93,6 +113,8 @@ BENCHMARK(SHA256, 340);
 BENCHMARK(SHA512, 330);
 
 BENCHMARK(SHA256_32b, 4700 * 1000);
+BENCHMARK(SHA256D64_1024, 7400);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
+BENCHMARK(SipHash_32b_x4, 10 * 1000 * 1000);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
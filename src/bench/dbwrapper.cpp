@@ -0,0 +1,144 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <dbwrapper.h>
+#include <fs.h>
+#include <random.h>
+#include <uint256.h>
+
+#include <assert.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Number of objects in the databases that are read from
+static const int BENCH_DB_ENTRIES = 10000;
+// Number of objects written or looked up per iteration
+static const int BENCH_DB_BATCH = 100;
+
+static const char DB_BENCH_OBJ = 'o';
+
+/** Object of about the size of a sidechain deposit, which like a serialized transaction is mostly structure and zeros */
+static std::vector<unsigned char> BenchObject(FastRandomContext& rng)
+{
+    std::vector<unsigned char> vch(400);
+    uint256 hash = rng.rand256();
+    std::copy(hash.begin(), hash.end(), vch.begin());
+    for (size_t i = 32; i < vch.size(); i += 40)
+        vch[i] = (unsigned char)rng.randbits(8);
+    return vch;
+}
+
+/** Database in a temporary directory, removed again when done */
+class BenchDB
+{
+public:
+    fs::path path;
+    std::unique_ptr<CDBWrapper> db;
+    std::vector<uint256> vKey;
+
+    BenchDB(const CDBOptions& dbOptions, int nEntries)
+    {
+        path = fs::temp_directory_path() / fs::unique_path("bench_dbwrapper_%%%%-%%%%-%%%%");
+        db.reset(new CDBWrapper(path, 8 << 20, false, true, false, dbOptions));
+
+        FastRandomContext rng(true);
+        CDBBatch batch(*db);
+        for (int i = 0; i < nEntries; i++) {
+            vKey.push_back(rng.rand256());
+            batch.Write(std::make_pair(DB_BENCH_OBJ, vKey.back()), BenchObject(rng));
+            if (batch.SizeEstimate() > (1 << 20)) {
+                db->WriteBatch(batch);
+                batch.Clear();
+            }
+        }
+        db->WriteBatch(batch);
+    }
+
+    ~BenchDB()
+    {
+        db.reset();
+        fs::remove_all(path);
+    }
+};
+
+static void DBWrapperWrite(benchmark::State& state, const CDBOptions& dbOptions)
+{
+    BenchDB bench(dbOptions, 0);
+    FastRandomContext rng(true);
+    while (state.KeepRunning()) {
+        CDBBatch batch(*bench.db);
+        for (int i = 0; i < BENCH_DB_BATCH; i++)
+            batch.Write(std::make_pair(DB_BENCH_OBJ, rng.rand256()), BenchObject(rng));
+        bench.db->WriteBatch(batch);
+    }
+}
+
+// Look up objects which are in the database and as many which aren't
+static void DBWrapperRead(benchmark::State& state, const CDBOptions& dbOptions)
+{
+    BenchDB bench(dbOptions, BENCH_DB_ENTRIES);
+    // Not the seed the database was filled with, so the missing objects are missing
+    FastRandomContext rng;
+    std::vector<unsigned char> vch;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < BENCH_DB_BATCH; i++) {
+            assert(bench.db->Read(std::make_pair(DB_BENCH_OBJ, bench.vKey[rng.randrange(bench.vKey.size())]), vch));
+            assert(!bench.db->Read(std::make_pair(DB_BENCH_OBJ, rng.rand256()), vch));
+        }
+    }
+}
+
+// Iterate over all of the objects, like the sidechain database does to list deposits and withdrawals
+static void DBWrapperScan(benchmark::State& state, const CDBOptions& dbOptions)
+{
+    BenchDB bench(dbOptions, BENCH_DB_ENTRIES);
+    std::vector<unsigned char> vch;
+    while (state.KeepRunning()) {
+        std::unique_ptr<CDBIterator> it(bench.db->NewIterator());
+        int nCount = 0;
+        for (it->Seek(std::make_pair(DB_BENCH_OBJ, uint256())); it->Valid(); it->Next()) {
+            std::pair<char, uint256> key;
+            if (!it->GetKey(key) || key.first != DB_BENCH_OBJ)
+                break;
+            assert(it->GetValue(vch));
+            nCount++;
+        }
+        assert(nCount == BENCH_DB_ENTRIES);
+    }
+}
+
+// The profile every database used before they could be tuned one by one
+static const CDBOptions PROFILE_DEFAULT;
+// Larger table files, like the chainstate
+static const CDBOptions PROFILE_LARGE_FILES(false, 10, 32 << 20, 64);
+// Snappy compression, like the sidechain database
+static const CDBOptions PROFILE_COMPRESSED(true, 10, 2 << 20, 64);
+// No bloom filters
+static const CDBOptions PROFILE_NO_BLOOM(false, 0, 2 << 20, 64);
+
+static void DBWrapperWriteDefault(benchmark::State& state) { DBWrapperWrite(state, PROFILE_DEFAULT); }
+static void DBWrapperWriteLargeFiles(benchmark::State& state) { DBWrapperWrite(state, PROFILE_LARGE_FILES); }
+static void DBWrapperWriteCompressed(benchmark::State& state) { DBWrapperWrite(state, PROFILE_COMPRESSED); }
+static void DBWrapperReadDefault(benchmark::State& state) { DBWrapperRead(state, PROFILE_DEFAULT); }
+static void DBWrapperReadLargeFiles(benchmark::State& state) { DBWrapperRead(state, PROFILE_LARGE_FILES); }
+static void DBWrapperReadCompressed(benchmark::State& state) { DBWrapperRead(state, PROFILE_COMPRESSED); }
+static void DBWrapperReadNoBloom(benchmark::State& state) { DBWrapperRead(state, PROFILE_NO_BLOOM); }
+static void DBWrapperScanDefault(benchmark::State& state) { DBWrapperScan(state, PROFILE_DEFAULT); }
+static void DBWrapperScanLargeFiles(benchmark::State& state) { DBWrapperScan(state, PROFILE_LARGE_FILES); }
+static void DBWrapperScanCompressed(benchmark::State& state) { DBWrapperScan(state, PROFILE_COMPRESSED); }
+
+BENCHMARK(DBWrapperWriteDefault, 100);
+BENCHMARK(DBWrapperWriteLargeFiles, 100);
+BENCHMARK(DBWrapperWriteCompressed, 100);
+BENCHMARK(DBWrapperReadDefault, 100);
+BENCHMARK(DBWrapperReadLargeFiles, 100);
+BENCHMARK(DBWrapperReadCompressed, 100);
+BENCHMARK(DBWrapperReadNoBloom, 100);
+BENCHMARK(DBWrapperScanDefault, 10);
+BENCHMARK(DBWrapperScanLargeFiles, 10);
+BENCHMARK(DBWrapperScanCompressed, 10);
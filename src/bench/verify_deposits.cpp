@@ -0,0 +1,186 @@
+// Copyright (c) 2020 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <random.h>
+#include <sidechainclient.h>
+#include <uint256.h>
+#include <univalue.h>
+#include <util.h>
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+using boost::asio::ip::tcp;
+
+// Number of deposits in each benchmarked block
+static const int BENCH_DEPOSITS_PER_BLOCK = 500;
+
+/**
+ * Minimal local stand-in for the mainchain node which answers 'verifydeposit'
+ * requests (single or batched) by echoing the txid back, which is what the
+ * mainchain does for a deposit it knows about.
+ */
+class MockMainchain
+{
+public:
+    MockMainchain() : acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), fStop(false)
+    {
+        thread = std::thread(&MockMainchain::Serve, this);
+    }
+
+    ~MockMainchain()
+    {
+        fStop = true;
+        // Wake up the accept call with one last connection
+        try {
+            boost::asio::io_service io;
+            tcp::socket socket(io);
+            socket.connect(acceptor.local_endpoint());
+        } catch (const std::exception&) {
+        }
+        thread.join();
+    }
+
+    unsigned short GetPort() const
+    {
+        return acceptor.local_endpoint().port();
+    }
+
+private:
+    void Serve()
+    {
+        while (!fStop) {
+            tcp::socket socket(io_service);
+            boost::system::error_code error;
+            acceptor.accept(socket, error);
+            if (error || fStop)
+                continue;
+
+            try {
+                HandleRequest(socket);
+            } catch (const std::exception&) {
+            }
+        }
+    }
+
+    void HandleRequest(tcp::socket& socket)
+    {
+        // Read the header, SidechainClient ends it with an empty line
+        boost::asio::streambuf buf;
+        size_t nHeader = boost::asio::read_until(socket, buf, "\n\n");
+
+        std::string strHeader(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_begin(buf.data()) + nHeader);
+        buf.consume(nHeader);
+
+        size_t nContentLength = 0;
+        size_t nPos = strHeader.find("Content-Length: ");
+        if (nPos != std::string::npos)
+            nContentLength = std::stoul(strHeader.substr(nPos + 16));
+
+        if (buf.size() < nContentLength)
+            boost::asio::read(socket, buf, boost::asio::transfer_exactly(nContentLength - buf.size()));
+
+        std::string strBody(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_end(buf.data()));
+
+        UniValue request;
+        if (!request.read(strBody))
+            return;
+
+        UniValue reply;
+        if (request.isArray()) {
+            reply = UniValue(UniValue::VARR);
+            for (size_t i = 0; i < request.size(); i++)
+                reply.push_back(Reply(request[i]));
+        } else {
+            reply = Reply(request);
+        }
+
+        std::string strReply = reply.write();
+        std::ostringstream os;
+        os << "HTTP/1.1 200 OK\r\n";
+        os << "Content-Type: application/json\r\n";
+        os << "Date: Thu, 01 Jan 2020 00:00:00 GMT\r\n";
+        os << "Content-Length: " << strReply.size() << "\r\n";
+        os << "\r\n";
+        os << strReply;
+
+        boost::asio::write(socket, boost::asio::buffer(os.str()));
+        socket.shutdown(tcp::socket::shutdown_both);
+    }
+
+    UniValue Reply(const UniValue& request)
+    {
+        UniValue reply(UniValue::VOBJ);
+        reply.pushKV("result", find_value(request, "params")[1].get_str());
+        reply.pushKV("error", NullUniValue);
+        reply.pushKV("id", find_value(request, "id"));
+        return reply;
+    }
+
+    boost::asio::io_service io_service;
+    tcp::acceptor acceptor;
+    std::atomic<bool> fStop;
+    std::thread thread;
+};
+
+static std::vector<DepositVerifyRequest> GetDepositRequests()
+{
+    std::vector<DepositVerifyRequest> vRequest;
+    const uint256 hashMainBlock = GetRandHash();
+    for (int i = 0; i < BENCH_DEPOSITS_PER_BLOCK; i++) {
+        DepositVerifyRequest request;
+        request.hashMainBlock = hashMainBlock;
+        request.txid = GetRandHash();
+        request.nTx = i + 1;
+        request.nBurnIndex = 0;
+        vRequest.push_back(request);
+    }
+    return vRequest;
+}
+
+static void SetupMockMainchain(const MockMainchain& mainchain)
+{
+    gArgs.ForceSetArg("-mainchainrpcuser", "bench");
+    gArgs.ForceSetArg("-mainchainrpcpassword", "bench");
+    gArgs.ForceSetArg("-mainchainrpchost", "127.0.0.1");
+    gArgs.ForceSetArg("-mainchainrpcport", std::to_string(mainchain.GetPort()));
+}
+
+// Verify every deposit of a block with its own 'verifydeposit' round trip
+static void VerifyDepositsSequential(benchmark::State& state)
+{
+    MockMainchain mainchain;
+    SetupMockMainchain(mainchain);
+
+    const std::vector<DepositVerifyRequest> vRequest = GetDepositRequests();
+    SidechainClient client;
+
+    while (state.KeepRunning()) {
+        for (const DepositVerifyRequest& r : vRequest)
+            assert(client.VerifyDeposit(r.hashMainBlock, r.txid, r.nTx));
+    }
+}
+
+// Verify all of the deposits of a block with batched requests
+static void VerifyDepositsBatched(benchmark::State& state)
+{
+    MockMainchain mainchain;
+    SetupMockMainchain(mainchain);
+
+    const std::vector<DepositVerifyRequest> vRequest = GetDepositRequests();
+    SidechainClient client;
+
+    while (state.KeepRunning()) {
+        assert(client.VerifyDeposits(vRequest));
+    }
+}
+
+BENCHMARK(VerifyDepositsSequential, 2);
+BENCHMARK(VerifyDepositsBatched, 2);
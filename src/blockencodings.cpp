@@ -3,11 +3,14 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <blockencodings.h>
+#include <bmmcache.h>
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
 #include <chainparams.h>
+#include <clientversion.h>
 #include <hash.h>
 #include <random.h>
+#include <sidechain.h>
 #include <streams.h>
 #include <txmempool.h>
 #include <validation.h>
@@ -15,12 +18,90 @@
 
 #include <unordered_map>
 
-CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
+//! Bits in the filter on the low bits of a compact block's short IDs
+static const size_t SHORTID_FILTER_SIZE = 1 << 16;
+
+// A deposit reference is a sidechain object script with this op, the
+// deposit's ID and its payout. ParseSidechainObj doesn't know the op, so a
+// reference can't be mistaken for a script of a valid block.
+static const char DEPOSIT_REF_OP = 'R';
+static const size_t DEPOSIT_REF_SIZE = 1 + 32 + 8;
+
+// Replace the deposit scripts of tx by references
+static CTransactionRef CompactDeposits(const CTransactionRef& tx)
+{
+    CMutableTransaction mtx(*tx);
+    bool fCompacted = false;
+    for (CTxOut& out : mtx.vout) {
+        std::vector<unsigned char> vch;
+        if (!out.scriptPubKey.IsSidechainObj(vch) || vch.empty() || vch[0] != DB_SIDECHAIN_DEPOSIT_OP)
+            continue;
+
+        std::unique_ptr<SidechainObj> obj(ParseSidechainObj(vch));
+        if (!obj)
+            continue;
+        const SidechainDeposit* deposit = (const SidechainDeposit*) obj.get();
+
+        // The receiver rebuilds the script with GetScript
+        if (deposit->GetScript() != out.scriptPubKey)
+            continue;
+
+        CDataStream ds(SER_DISK, CLIENT_VERSION);
+        ds << DEPOSIT_REF_OP << deposit->GetID() << deposit->amtUserPayout;
+
+        CScript scriptRef(out.scriptPubKey.begin(), out.scriptPubKey.begin() + 5);
+        scriptRef.insert(scriptRef.end(), ds.begin(), ds.end());
+        out.scriptPubKey = scriptRef;
+        fCompacted = true;
+    }
+    return fCompacted ? MakeTransactionRef(std::move(mtx)) : tx;
+}
+
+// Replace the deposit references in tx by the deposits we queued from the
+// mainchain. Returns false if we don't know one of them.
+static bool ExpandDeposits(CTransactionRef& tx, size_t& nDeposits)
+{
+    std::vector<unsigned char> vch;
+    bool fHaveRefs = false;
+    for (const CTxOut& out : tx->vout) {
+        if (out.scriptPubKey.IsSidechainObj(vch) && vch.size() == DEPOSIT_REF_SIZE && vch[0] == DEPOSIT_REF_OP) {
+            fHaveRefs = true;
+            break;
+        }
+    }
+    if (!fHaveRefs)
+        return true;
+
+    CMutableTransaction mtx(*tx);
+    size_t nExpanded = 0;
+    for (CTxOut& out : mtx.vout) {
+        if (!out.scriptPubKey.IsSidechainObj(vch) || vch.size() != DEPOSIT_REF_SIZE || vch[0] != DEPOSIT_REF_OP)
+            continue;
+
+        CDataStream ds(vch, SER_DISK, CLIENT_VERSION);
+        char op;
+        uint256 id;
+        CAmount amtUserPayout;
+        ds >> op >> id >> amtUserPayout;
+
+        SidechainDeposit deposit;
+        if (!bmmCache.GetQueuedDeposit(id, deposit))
+            return false;
+        deposit.amtUserPayout = amtUserPayout;
+        out.scriptPubKey = deposit.GetScript();
+        nExpanded++;
+    }
+    tx = MakeTransactionRef(std::move(mtx));
+    nDeposits += nExpanded;
+    return true;
+}
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, bool fUseDepositRefs) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
         shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
     FillShortTxIDSelector();
     //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
-    prefilledtxn[0] = {0, block.vtx[0]};
+    prefilledtxn[0] = {0, fUseDepositRefs ? CompactDeposits(block.vtx[0]) : block.vtx[0]};
     for (size_t i = 1; i < block.vtx.size(); i++) {
         const CTransaction& tx = *block.vtx[i];
         shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
@@ -43,6 +124,12 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+void CBlockHeaderAndShortTxIDs::GetShortIDs(const uint256* const txhashes[4], uint64_t shortids[4]) const {
+    SipHashUint256x4(shorttxidk0, shorttxidk1, txhashes, shortids);
+    for (int i = 0; i < 4; i++)
+        shortids[i] &= 0xffffffffffffL;
+}
+
 
 
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
@@ -56,6 +143,7 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     txn_available.resize(cmpctblock.BlockTxCount());
 
     int32_t lastprefilledindex = -1;
+    std::vector<uint16_t> missing_deposits;
     for (size_t i = 0; i < cmpctblock.prefilledtxn.size(); i++) {
         if (cmpctblock.prefilledtxn[i].tx->IsNull())
             return READ_STATUS_INVALID;
@@ -70,6 +158,8 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
             return READ_STATUS_INVALID;
         }
         txn_available[lastprefilledindex] = cmpctblock.prefilledtxn[i].tx;
+        if (!ExpandDeposits(txn_available[lastprefilledindex], deposit_count))
+            missing_deposits.push_back(lastprefilledindex);
     }
     prefilled_count = cmpctblock.prefilledtxn.size();
 
@@ -78,11 +168,15 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     // of short IDs, any highly-uneven distribution of elements can be safely treated as a
     // READ_STATUS_FAILED.
     std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    // Most of the mempool isn't in the block, the low bits of the short IDs
+    // rule out most of those transactions without a lookup in the map
+    std::vector<bool> shortid_filter(SHORTID_FILTER_SIZE);
     uint16_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
         shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
+        shortid_filter[cmpctblock.shorttxids[i] % SHORTID_FILTER_SIZE] = true;
         // To determine the chance that the number of entries in a bucket exceeds N,
         // we use the fact that the number of elements in a single bucket is
         // binomially distributed (with n = the number of shorttxids S, and p =
@@ -105,8 +199,21 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
+    uint64_t shortids[4];
     for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
+        // Compute the short IDs of the mempool four at a time
+        if (i % 4 == 0) {
+            if (i + 4 <= vTxHashes.size()) {
+                const uint256* txhashes[4] = {&vTxHashes[i].first, &vTxHashes[i + 1].first, &vTxHashes[i + 2].first, &vTxHashes[i + 3].first};
+                cmpctblock.GetShortIDs(txhashes, shortids);
+            } else {
+                for (size_t j = i; j < vTxHashes.size(); j++)
+                    shortids[j - i] = cmpctblock.GetShortID(vTxHashes[j].first);
+            }
+        }
+        uint64_t shortid = shortids[i % 4];
+        if (!shortid_filter[shortid % SHORTID_FILTER_SIZE])
+            continue;
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
@@ -162,6 +269,13 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
             break;
     }
 
+    // Request the transactions with deposits we don't know in full. Not
+    // before now, the short ID positions above skip the prefilled slots.
+    for (uint16_t index : missing_deposits) {
+        txn_available[index].reset();
+        prefilled_count--;
+    }
+
     LogPrint(BCLog::CMPCTBLOCK, "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n", cmpctblock.header.GetHash().ToString(), GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
 
     return READ_STATUS_OK;
@@ -207,7 +321,7 @@ ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<
         return READ_STATUS_CHECKBLOCK_FAILED;
     }
 
-    LogPrint(BCLog::CMPCTBLOCK, "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool (incl at least %lu from extra pool) and %lu txn requested\n", hash.ToString(), prefilled_count, mempool_count, extra_count, vtx_missing.size());
+    LogPrint(BCLog::CMPCTBLOCK, "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool (incl at least %lu from extra pool), %lu deposits from the mainchain and %lu txn requested\n", hash.ToString(), prefilled_count, mempool_count, extra_count, deposit_count, vtx_missing.size());
     if (vtx_missing.size() < 5) {
         for (const auto& tx : vtx_missing) {
             LogPrint(BCLog::CMPCTBLOCK, "Reconstructed block %s required tx %s\n", hash.ToString(), tx->GetHash().ToString());
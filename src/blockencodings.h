@@ -148,9 +148,16 @@ public:
     // Dummy for deserialization
     CBlockHeaderAndShortTxIDs() {}
 
-    CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID);
+    /**
+     * With fUseDepositRefs the deposits in the prefilled coinbase are only
+     * referenced by their SidechainDeposit::GetID, the receiver gets them
+     * from the mainchain itself.
+     */
+    CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, bool fUseDepositRefs = false);
 
     uint64_t GetShortID(const uint256& txhash) const;
+    //! GetShortID of four hashes at once
+    void GetShortIDs(const uint256* const txhashes[4], uint64_t shortids[4]) const;
 
     size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
 
@@ -194,7 +201,7 @@ public:
 class PartiallyDownloadedBlock {
 protected:
     std::vector<CTransactionRef> txn_available;
-    size_t prefilled_count = 0, mempool_count = 0, extra_count = 0;
+    size_t prefilled_count = 0, mempool_count = 0, extra_count = 0, deposit_count = 0;
     CTxMemPool* pool;
 public:
     CBlockHeader header;
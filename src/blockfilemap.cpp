@@ -0,0 +1,88 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+
+#include <chain.h>
+#include <compat.h>
+#include <util.h>
+#include <validation.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+std::shared_ptr<const CMappedFile> CMappedFile::Open(const fs::path& path)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    // The mapping keeps its own reference to the file
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LogPrintf("Unable to map %s\n", path.string());
+        return nullptr;
+    }
+    return std::shared_ptr<const CMappedFile>(new CMappedFile(static_cast<const char*>(addr), st.st_size));
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<char*>(pdata), nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CBlockFileMap::Get(int nFile, const std::string& prefix, size_t nMinSize)
+{
+    if (nMaxFiles == 0)
+        return nullptr;
+
+    const fs::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), prefix.c_str());
+
+    std::lock_guard<std::mutex> lock(cs);
+    for (std::list<Entry>::iterator it = lru.begin(); it != lru.end(); ++it) {
+        if (it->nFile != nFile || it->path != path)
+            continue;
+        if (it->file->size() >= nMinSize) {
+            lru.splice(lru.begin(), lru, it);
+            return it->file;
+        }
+        // The file has grown since it was mapped
+        lru.erase(it);
+        break;
+    }
+
+    std::shared_ptr<const CMappedFile> file = CMappedFile::Open(path);
+    if (!file)
+        return nullptr;
+    lru.push_front(Entry{nFile, path, file});
+    if (lru.size() > nMaxFiles)
+        lru.pop_back();
+    return file->size() >= nMinSize ? file : nullptr;
+}
+
+void CBlockFileMap::Invalidate(int nFile)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    for (std::list<Entry>::iterator it = lru.begin(); it != lru.end(); ) {
+        if (it->nFile == nFile)
+            it = lru.erase(it);
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include <fs.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/** Read-only memory mapping of a whole file, unmapped when the last reference is gone */
+class CMappedFile
+{
+public:
+    //! Map the file at path, returns nullptr if it is empty or can't be mapped
+    static std::shared_ptr<const CMappedFile> Open(const fs::path& path);
+
+    ~CMappedFile();
+
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+
+private:
+    CMappedFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+
+    const char* pdata;
+    size_t nSize;
+};
+
+/**
+ * Keeps the most recently read block and undo files mapped into memory, so
+ * blocks can be deserialized right from the mapping instead of through
+ * fopen/fseek/fread on every read.
+ *
+ * Block files are only ever appended to, so a mapping stays valid for the
+ * data it covers; a file that has grown past its mapping is mapped again.
+ * Files that are about to be truncated or deleted have to be invalidated
+ * first. Readers holding on to an old mapping can keep using it.
+ */
+class CBlockFileMap
+{
+public:
+    explicit CBlockFileMap(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) {}
+
+    /**
+     * Mapping of file nFile with the given prefix ("blk" or "rev") which is
+     * at least nMinSize bytes long. Returns nullptr if the file can't be
+     * mapped or is shorter.
+     */
+    std::shared_ptr<const CMappedFile> Get(int nFile, const std::string& prefix, size_t nMinSize);
+
+    //! Drop the mappings of the block and undo files nFile
+    void Invalidate(int nFile);
+
+private:
+    struct Entry
+    {
+        int nFile;
+        //! Compared too, the data directory changes between unit tests
+        fs::path path;
+        std::shared_ptr<const CMappedFile> file;
+    };
+
+    std::mutex cs;
+    const size_t nMaxFiles;
+    //! Most recently used first
+    std::list<Entry> lru;
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
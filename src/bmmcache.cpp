@@ -54,11 +54,15 @@ std::vector<uint256> BMMCache::GetBroadcastedWithdrawalBundleCache() const
 
 std::vector<uint256> BMMCache::GetMainBlockHashCache() const
 {
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     return vMainBlockHash;
 }
 
 std::vector<uint256> BMMCache::GetRecentMainBlockHashes() const
 {
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     // Return up to three of the most recent mainchain block hashes
     std::vector<uint256> vHash;
     std::vector<uint256>::const_reverse_iterator rit = vMainBlockHash.rbegin();
@@ -102,6 +106,8 @@ bool BMMCache::HaveVerifiedBMM(const uint256& hashBlock) const
     if (hashBlock.IsNull())
         return false;
 
+    std::lock_guard<std::mutex> lock(mtxVerified);
+
     return (setBMMVerified.count(hashBlock));
 }
 
@@ -110,6 +116,8 @@ void BMMCache::CacheVerifiedBMM(const uint256& hashBlock)
     if (hashBlock.IsNull())
         return;
 
+    std::lock_guard<std::mutex> lock(mtxVerified);
+
     setBMMVerified.insert(hashBlock);
 }
 
@@ -118,6 +126,8 @@ bool BMMCache::HaveVerifiedDeposit(const uint256& txid) const
     if (txid.IsNull())
         return false;
 
+    std::lock_guard<std::mutex> lock(mtxVerified);
+
     return (setDepositVerified.count(txid));
 }
 
@@ -126,11 +136,15 @@ void BMMCache::CacheVerifiedDeposit(const uint256& txid)
     if (txid.IsNull())
         return;
 
+    std::lock_guard<std::mutex> lock(mtxVerified);
+
     setDepositVerified.insert(txid);
 }
 
 std::vector<uint256> BMMCache::GetVerifiedBMMCache() const
 {
+    std::lock_guard<std::mutex> lock(mtxVerified);
+
     std::vector<uint256> vHash;
     for (const auto& u : setBMMVerified) {
         vHash.push_back(u);
@@ -140,6 +154,8 @@ std::vector<uint256> BMMCache::GetVerifiedBMMCache() const
 
 std::vector<uint256> BMMCache::GetVerifiedDepositCache() const
 {
+    std::lock_guard<std::mutex> lock(mtxVerified);
+
     std::vector<uint256> vHash;
     for (const auto& u : setDepositVerified) {
         vHash.push_back(u);
@@ -148,6 +164,13 @@ std::vector<uint256> BMMCache::GetVerifiedDepositCache() const
 }
 
 void BMMCache::CacheMainBlockHash(const uint256& hash)
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
+    AppendMainBlockHash(hash);
+}
+
+void BMMCache::AppendMainBlockHash(const uint256& hash)
 {
     // Don't re-cache the genesis block
     if (vMainBlockHash.size() == 1 && hash == vMainBlockHash.front())
@@ -171,9 +194,11 @@ bool BMMCache::UpdateMainBlockCache(std::deque<uint256>& deqHashNew, bool& fReor
         return false;
     }
 
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     // If the main block cache doesn't have the genesis block yet, add it first
     if (vMainBlockHash.empty())
-        CacheMainBlockHash(deqHashNew.front());
+        AppendMainBlockHash(deqHashNew.front());
 
     // Figure out the block in our cache that we will append the new blocks to
     MainBlockIndex index;
@@ -192,6 +217,10 @@ bool BMMCache::UpdateMainBlockCache(std::deque<uint256>& deqHashNew, bool& fReor
         fReorg = true;
     }
 
+    // Deposits in the pending queue may have been in a disconnected block
+    if (fReorg)
+        ClearDepositQueue();
+
     for (size_t i = vMainBlockHash.size() - 1; i > index.index; i--) {
         vOrphan.push_back(vMainBlockHash[i]);
         vMainBlockHash.pop_back();
@@ -209,12 +238,15 @@ bool BMMCache::UpdateMainBlockCache(std::deque<uint256>& deqHashNew, bool& fReor
     //
     // Check if we already know the first block in the deque and remove it if
     // we do.
-    if (HaveMainBlock(deqHashNew.front()))
+    if (mapMainBlock.count(deqHashNew.front()))
         deqHashNew.pop_front();
 
     // Append new blocks
     for (const uint256& u : deqHashNew)
-        CacheMainBlockHash(u);
+        AppendMainBlockHash(u);
+
+    // The mainchain tip changed, withdrawal bundle status may have changed too
+    ClearWithdrawalBundleStatusCache();
 
     LogPrintf("%s: Updated cached mainchain tip to: %s.\n", __func__, deqHashNew.back().ToString());
 
@@ -223,6 +255,8 @@ bool BMMCache::UpdateMainBlockCache(std::deque<uint256>& deqHashNew, bool& fReor
 
 uint256 BMMCache::GetLastMainBlockHash() const
 {
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     if (vMainBlockHash.empty())
         return uint256();
 
@@ -231,6 +265,8 @@ uint256 BMMCache::GetLastMainBlockHash() const
 
 uint256 BMMCache::GetMainPrevBlockHash(const uint256& hashBlock) const
 {
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     if (vMainBlockHash.size() < 2)
         return uint256();
 
@@ -252,11 +288,15 @@ uint256 BMMCache::GetMainPrevBlockHash(const uint256& hashBlock) const
 
 int BMMCache::GetCachedBlockCount() const
 {
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     return vMainBlockHash.size();
 }
 
 int BMMCache::GetMainchainBlockHeight(const uint256& hash) const
 {
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     if (!mapMainBlock.count(hash))
         return -1;
 
@@ -267,9 +307,23 @@ int BMMCache::GetMainchainBlockHeight(const uint256& hash) const
 
 bool BMMCache::HaveMainBlock(const uint256& hash) const
 {
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     return mapMainBlock.count(hash);
 }
 
+size_t BMMCache::CountMissingMainBlocks(const std::vector<uint256>& vHash) const
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
+    size_t nMissing = 0;
+    for (const uint256& hash : vHash) {
+        if (!mapMainBlock.count(hash))
+            nMissing++;
+    }
+    return nMissing;
+}
+
 bool BMMCache::HaveBMMRequestForPrevBlock(const uint256& hashPrevBlock) const
 {
     return setPrevBlockBMMCreated.count(hashPrevBlock);
@@ -287,8 +341,13 @@ bool BMMCache::MainBlockChecked(const uint256& hashBlock) const
 
 void BMMCache::ResetMainBlockCache()
 {
+    std::lock_guard<std::mutex> lock(mtxMainBlockCache);
+
     vMainBlockHash.clear();
     mapMainBlock.clear();
+
+    ClearWithdrawalBundleStatusCache();
+    ClearDepositQueue();
 }
 
 void BMMCache::CacheWithdrawalID(const uint256& wtid)
@@ -305,3 +364,388 @@ bool BMMCache::IsMyWT(const uint256& wtid)
 {
     return setWITHDRAWALIDCache.count(wtid);
 }
+
+bool BMMCache::GetCachedWithdrawalBundleStatus(const uint256& hashWithdrawalBundle, bool fFailed, bool& fStatus) const
+{
+    // Read the tip before taking the status lock, UpdateMainBlockCache takes
+    // them in the opposite order
+    const uint256 hashTip = GetLastMainBlockHash();
+
+    std::lock_guard<std::mutex> lock(mtxStatusCache);
+
+    if (hashStatusCacheTip.IsNull() || hashStatusCacheTip != hashTip)
+        return false;
+
+    const std::map<uint256, bool>& mapStatus = fFailed ? mapWithdrawalBundleFailed : mapWithdrawalBundleSpent;
+
+    std::map<uint256, bool>::const_iterator it = mapStatus.find(hashWithdrawalBundle);
+    if (it == mapStatus.end())
+        return false;
+
+    fStatus = it->second;
+
+    return true;
+}
+
+void BMMCache::CacheWithdrawalBundleStatus(const uint256& hashWithdrawalBundle, bool fFailed, bool fStatus)
+{
+    // We can't tell when the result goes stale without a mainchain tip
+    const uint256 hashTip = GetLastMainBlockHash();
+    if (hashTip.IsNull())
+        return;
+
+    std::lock_guard<std::mutex> lock(mtxStatusCache);
+
+    if (hashStatusCacheTip != hashTip) {
+        mapWithdrawalBundleFailed.clear();
+        mapWithdrawalBundleSpent.clear();
+        vWithdrawalBundleListCached.clear();
+        fWithdrawalBundleListCached = false;
+        hashStatusCacheTip = hashTip;
+    }
+
+    if (fFailed)
+        mapWithdrawalBundleFailed[hashWithdrawalBundle] = fStatus;
+    else
+        mapWithdrawalBundleSpent[hashWithdrawalBundle] = fStatus;
+}
+
+bool BMMCache::GetCachedWithdrawalBundleList(std::vector<uint256>& vHashWithdrawalBundle) const
+{
+    const uint256 hashTip = GetLastMainBlockHash();
+
+    std::lock_guard<std::mutex> lock(mtxStatusCache);
+
+    if (hashStatusCacheTip.IsNull() || hashStatusCacheTip != hashTip)
+        return false;
+
+    if (!fWithdrawalBundleListCached)
+        return false;
+
+    vHashWithdrawalBundle = vWithdrawalBundleListCached;
+
+    return true;
+}
+
+void BMMCache::CacheWithdrawalBundleList(const std::vector<uint256>& vHashWithdrawalBundle)
+{
+    const uint256 hashTip = GetLastMainBlockHash();
+    if (hashTip.IsNull())
+        return;
+
+    std::lock_guard<std::mutex> lock(mtxStatusCache);
+
+    if (hashStatusCacheTip != hashTip) {
+        mapWithdrawalBundleFailed.clear();
+        mapWithdrawalBundleSpent.clear();
+        hashStatusCacheTip = hashTip;
+    }
+
+    vWithdrawalBundleListCached = vHashWithdrawalBundle;
+    fWithdrawalBundleListCached = true;
+}
+
+void BMMCache::ClearWithdrawalBundleStatusCache()
+{
+    std::lock_guard<std::mutex> lock(mtxStatusCache);
+
+    mapWithdrawalBundleFailed.clear();
+    mapWithdrawalBundleSpent.clear();
+    vWithdrawalBundleListCached.clear();
+    fWithdrawalBundleListCached = false;
+    hashStatusCacheTip.SetNull();
+}
+
+void BMMCache::ResetDepositQueue(const uint256& hashAnchor, uint32_t nAnchor, const uint256& idAnchor)
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    vDepositPending.clear();
+    setDepositPendingID.clear();
+    hashDepositQueueMainTip.SetNull();
+
+    hashDepositAnchor = hashAnchor;
+    nDepositAnchor = nAnchor;
+    idDepositAnchor = idAnchor;
+    if (!idAnchor.IsNull())
+        setDepositPendingID.insert(idAnchor);
+
+    fDepositQueueStarted = true;
+}
+
+void BMMCache::ClearDepositQueue()
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    vDepositPending.clear();
+    setDepositPendingID.clear();
+    hashDepositQueueMainTip.SetNull();
+
+    hashDepositAnchor.SetNull();
+    nDepositAnchor = 0;
+    idDepositAnchor.SetNull();
+    fDepositQueueStarted = false;
+}
+
+bool BMMCache::GetDepositQueueTip(uint256& hashTip, uint32_t& nTip) const
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    if (!fDepositQueueStarted)
+        return false;
+
+    if (vDepositPending.empty()) {
+        hashTip = hashDepositAnchor;
+        nTip = nDepositAnchor;
+    } else {
+        hashTip = vDepositPending.back().dtx.GetHash();
+        nTip = vDepositPending.back().nBurnIndex;
+    }
+
+    return true;
+}
+
+uint256 BMMCache::GetDepositQueueMainTip() const
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    return hashDepositQueueMainTip;
+}
+
+void BMMCache::SetDepositQueueMainTip(const uint256& hashMainTip)
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    if (fDepositQueueStarted)
+        hashDepositQueueMainTip = hashMainTip;
+}
+
+bool BMMCache::HaveQueuedDeposit(const uint256& id) const
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    return setDepositPendingID.count(id);
+}
+
+bool BMMCache::GetQueuedDeposit(const uint256& id, SidechainDeposit& deposit) const
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    if (!setDepositPendingID.count(id))
+        return false;
+
+    for (const SidechainDeposit& d : vDepositPending) {
+        if (d.GetID() == id) {
+            deposit = d;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BMMCache::AppendPendingDeposits(const std::vector<SidechainDeposit>& vDeposit)
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    if (!fDepositQueueStarted)
+        return false;
+
+    // Check that the new deposits continue the CTIP chain from the queue tip
+    uint256 hashPrev = hashDepositAnchor;
+    uint32_t nPrev = nDepositAnchor;
+    if (!vDepositPending.empty()) {
+        hashPrev = vDepositPending.back().dtx.GetHash();
+        nPrev = vDepositPending.back().nBurnIndex;
+    }
+
+    for (const SidechainDeposit& d : vDeposit) {
+        if (d.nBurnIndex >= d.dtx.vout.size())
+            return false;
+
+        if (setDepositPendingID.count(d.GetID()))
+            return false;
+
+        // The very first deposit to the sidechain doesn't spend a CTIP
+        if (!hashPrev.IsNull()) {
+            bool fFound = false;
+            for (const CTxIn& in : d.dtx.vin) {
+                if (in.prevout.hash == hashPrev && in.prevout.n == nPrev) {
+                    fFound = true;
+                    break;
+                }
+            }
+            if (!fFound)
+                return false;
+        }
+
+        hashPrev = d.dtx.GetHash();
+        nPrev = d.nBurnIndex;
+    }
+
+    for (const SidechainDeposit& d : vDeposit) {
+        vDepositPending.push_back(d);
+        setDepositPendingID.insert(d.GetID());
+    }
+
+    return true;
+}
+
+bool BMMCache::HaveDepositQueueBase(const uint256& hashLastDeposit, uint32_t nBurnIndex) const
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    if (!fDepositQueueStarted)
+        return false;
+
+    if (hashLastDeposit == hashDepositAnchor && nBurnIndex == nDepositAnchor)
+        return true;
+
+    for (const SidechainDeposit& d : vDepositPending) {
+        if (d.nBurnIndex == nBurnIndex && d.dtx.GetHash() == hashLastDeposit)
+            return true;
+    }
+    return false;
+}
+
+bool BMMCache::GetPendingDeposits(const uint256& hashMainTip, const uint256& hashLastDeposit, uint32_t nBurnIndex, std::vector<SidechainDeposit>& vDeposit)
+{
+    std::lock_guard<std::mutex> lock(mtxDepositQueue);
+
+    if (!fDepositQueueStarted || hashMainTip.IsNull())
+        return false;
+
+    // New deposits may be in mainchain blocks the queue hasn't seen yet
+    if (hashDepositQueueMainTip != hashMainTip)
+        return false;
+
+    if (hashLastDeposit == hashDepositAnchor && nBurnIndex == nDepositAnchor) {
+        vDeposit = vDepositPending;
+        return true;
+    }
+
+    // Blocks have been connected since the queue was started. Find the
+    // sidechain's last deposit in the queue and drop everything up to it.
+    size_t i = 0;
+    for (; i < vDepositPending.size(); i++) {
+        if (vDepositPending[i].nBurnIndex == nBurnIndex
+                && vDepositPending[i].dtx.GetHash() == hashLastDeposit)
+            break;
+    }
+    if (i == vDepositPending.size())
+        return false;
+
+    setDepositPendingID.erase(idDepositAnchor);
+    for (size_t j = 0; j < i; j++)
+        setDepositPendingID.erase(vDepositPending[j].GetID());
+
+    hashDepositAnchor = hashLastDeposit;
+    nDepositAnchor = nBurnIndex;
+    idDepositAnchor = vDepositPending[i].GetID();
+
+    vDepositPending.erase(vDepositPending.begin(), vDepositPending.begin() + i + 1);
+
+    vDeposit = vDepositPending;
+
+    return true;
+}
+
+bool BMMCache::GetMainBlockCommits(const uint256& hashMainBlock, MainBlockCommits& commits) const
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCommits);
+
+    std::map<uint256, MainBlockCommits>::const_iterator it = mapMainBlockCommits.find(hashMainBlock);
+    if (it == mapMainBlockCommits.end())
+        return false;
+
+    commits = it->second;
+
+    return true;
+}
+
+void BMMCache::CacheMainBlockBMM(const uint256& hashMainBlock, const CMainchainBlockHeader& header, const std::set<uint256>& setBMM)
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCommits);
+
+    MainBlockCommits& commits = mapMainBlockCommits[hashMainBlock];
+    commits.header = header;
+    commits.setBMM = setBMM;
+    commits.fHaveCoinbase = true;
+}
+
+void BMMCache::CacheMainBlockDeposit(const uint256& hashMainBlock, const CMainchainBlockHeader& header, const uint256& txid, uint32_t nTx)
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCommits);
+
+    MainBlockCommits& commits = mapMainBlockCommits[hashMainBlock];
+    commits.header = header;
+    commits.mapDeposit[txid] = nTx;
+}
+
+bool BMMCache::HaveMainBlockBMM(const uint256& hashMainBlock, const uint256& hashBMM, bool& fBMM) const
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCommits);
+
+    std::map<uint256, MainBlockCommits>::const_iterator it = mapMainBlockCommits.find(hashMainBlock);
+    if (it == mapMainBlockCommits.end() || !it->second.fHaveCoinbase)
+        return false;
+
+    fBMM = it->second.setBMM.count(hashBMM);
+
+    return true;
+}
+
+bool BMMCache::HaveMainBlockDeposit(const uint256& hashMainBlock, const uint256& txid, uint32_t nTx) const
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCommits);
+
+    std::map<uint256, MainBlockCommits>::const_iterator it = mapMainBlockCommits.find(hashMainBlock);
+    if (it == mapMainBlockCommits.end())
+        return false;
+
+    std::map<uint256, uint32_t>::const_iterator itDeposit = it->second.mapDeposit.find(txid);
+    if (itDeposit == it->second.mapDeposit.end())
+        return false;
+
+    return itDeposit->second == nTx;
+}
+
+std::map<uint256, MainBlockCommits> BMMCache::GetMainBlockCommitIndex() const
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCommits);
+
+    return mapMainBlockCommits;
+}
+
+void BMMCache::CacheMainBlockCommits(const uint256& hashMainBlock, const MainBlockCommits& commits)
+{
+    std::lock_guard<std::mutex> lock(mtxMainBlockCommits);
+
+    mapMainBlockCommits[hashMainBlock] = commits;
+}
+
+void BMMCache::CacheBlockVerifyRecord(const BlockVerifyRecord& record)
+{
+    std::lock_guard<std::mutex> lock(mtxBlockVerifyRecord);
+
+    mapBlockVerifyRecord[record.hashBlock] = record;
+}
+
+bool BMMCache::GetBlockVerifyRecord(const uint256& hashBlock, BlockVerifyRecord& record) const
+{
+    std::lock_guard<std::mutex> lock(mtxBlockVerifyRecord);
+
+    std::map<uint256, BlockVerifyRecord>::const_iterator it = mapBlockVerifyRecord.find(hashBlock);
+    if (it == mapBlockVerifyRecord.end())
+        return false;
+
+    record = it->second;
+
+    return true;
+}
+
+bool BMMCache::HaveBlockVerifyRecord(const uint256& hashBlock) const
+{
+    std::lock_guard<std::mutex> lock(mtxBlockVerifyRecord);
+
+    return mapBlockVerifyRecord.count(hashBlock);
+}
@@ -1,10 +1,14 @@
 #ifndef BITCOIN_BMMCACHE_H
 #define BITCOIN_BMMCACHE_H
 
+#include "primitives/block.h"
+#include "serialize.h"
+#include "sidechain.h"
 #include "uint256.h"
 
 #include <deque>
 #include <map>
+#include <mutex>
 #include <set>
 #include <vector>
 
@@ -16,6 +20,65 @@ struct MainBlockIndex
     uint256 hash;
 };
 
+/**
+ * Compact record of what a mainchain block commits to for this sidechain.
+ * Used to verify BMM and deposits locally instead of asking the mainchain
+ * node about every sidechain block (-verifybmmlocal).
+ */
+struct MainBlockCommits
+{
+    CMainchainBlockHeader header;
+
+    // Set if the coinbase has been checked for BMM commitments
+    bool fHaveCoinbase = false;
+
+    // BMM h* committed to in the coinbase for this sidechain
+    std::set<uint256> setBMM;
+
+    // Deposit txid -> position in block, proven by partial merkle tree
+    std::map<uint256, uint32_t> mapDeposit;
+
+    ADD_SERIALIZE_METHODS
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(header);
+        READWRITE(fHaveCoinbase);
+        READWRITE(setBMM);
+        READWRITE(mapDeposit);
+    }
+};
+
+/**
+ * Record of the mainchain verification results for a sidechain block, kept
+ * in an append-only journal so that a reindex can skip asking the mainchain.
+ */
+struct BlockVerifyRecord
+{
+    uint256 hashBlock;
+    uint256 hashMainchainBlock;
+
+    // BMM h* (sidechain block merkle root) verified in hashMainchainBlock
+    uint256 hashBMM;
+
+    // Mainchain txid of deposits verified for this block
+    std::vector<uint256> vDepositTxid;
+
+    // Withdrawal bundle status updates verified for this block
+    std::vector<std::pair<uint256 /* hashWithdrawalBundle */, bool /* fFailed */>> vBundleStatus;
+
+    ADD_SERIALIZE_METHODS
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(hashMainchainBlock);
+        READWRITE(hashBMM);
+        READWRITE(vDepositTxid);
+        READWRITE(vBundleStatus);
+    }
+};
+
 class BMMCache
 {
 public:
@@ -73,6 +136,9 @@ public:
 
     bool HaveMainBlock(const uint256& hash) const;
 
+    //! Number of the hashes that aren't in the cache
+    size_t CountMissingMainBlocks(const std::vector<uint256>& vHash) const;
+
     bool HaveBMMRequestForPrevBlock(const uint256& hashPrevBlock) const;
 
     void AddCheckedMainBlock(const uint256& hashBlock);
@@ -87,6 +153,94 @@ public:
 
     bool IsMyWT(const uint256& wtid);
 
+    // Check if we already asked the mainchain about the status of a withdrawal
+    // bundle since the mainchain tip was last updated. fFailed selects
+    // between the failed and spent status.
+    bool GetCachedWithdrawalBundleStatus(const uint256& hashWithdrawalBundle, bool fFailed, bool& fStatus) const;
+
+    // Cache a withdrawal bundle status result for the current mainchain tip
+    void CacheWithdrawalBundleStatus(const uint256& hashWithdrawalBundle, bool fFailed, bool fStatus);
+
+    // Check if we have the mainchain's list of tracked withdrawal bundles for
+    // the current mainchain tip
+    bool GetCachedWithdrawalBundleList(std::vector<uint256>& vHashWithdrawalBundle) const;
+
+    // Cache the mainchain's list of tracked withdrawal bundles
+    void CacheWithdrawalBundleList(const std::vector<uint256>& vHashWithdrawalBundle);
+
+    // Forget all withdrawal bundle status results, called when the mainchain
+    // tip changes
+    void ClearWithdrawalBundleStatusCache();
+
+    // Start a new pending deposit queue after the deposit (CTIP) with txid
+    // hashAnchor and burn output nAnchor. Null if the sidechain has no
+    // deposits yet.
+    void ResetDepositQueue(const uint256& hashAnchor, uint32_t nAnchor, const uint256& idAnchor);
+
+    // Forget all pending deposits, called on mainchain reorg
+    void ClearDepositQueue();
+
+    // Get the latest CTIP in the pending deposit queue. Returns false if the
+    // queue has not been started.
+    bool GetDepositQueueTip(uint256& hashTip, uint32_t& nTip) const;
+
+    // Get / set the mainchain tip that the pending deposit queue is up to date
+    // with.
+    uint256 GetDepositQueueMainTip() const;
+    void SetDepositQueueMainTip(const uint256& hashMainTip);
+
+    // Check if a deposit (by SidechainDeposit::GetID) is in the queue
+    bool HaveQueuedDeposit(const uint256& id) const;
+
+    // Get a deposit from the queue by SidechainDeposit::GetID
+    bool GetQueuedDeposit(const uint256& id, SidechainDeposit& deposit) const;
+
+    // Append sorted deposits to the queue. Each deposit must spend the CTIP of
+    // the deposit before it, the first must spend the current queue tip.
+    // Returns false and appends nothing if the CTIP chain is broken.
+    bool AppendPendingDeposits(const std::vector<SidechainDeposit>& vDeposit);
+
+    // Check if the sidechain's last deposit (txid hashLastDeposit, burn output
+    // nBurnIndex) is the queue anchor or in the queue. If it isn't, the
+    // sidechain has reorganized away from the queue and it must be rebuilt.
+    bool HaveDepositQueueBase(const uint256& hashLastDeposit, uint32_t nBurnIndex) const;
+
+    // Get the pending deposits which come after the sidechain's last deposit
+    // (txid hashLastDeposit, burn output nBurnIndex) in CTIP order. Deposits
+    // before it have been connected and are dropped from the queue. Returns
+    // false if the queue can't answer and the caller must ask the mainchain,
+    // including when the queue isn't up to date with mainchain tip
+    // hashMainTip.
+    bool GetPendingDeposits(const uint256& hashMainTip, const uint256& hashLastDeposit, uint32_t nBurnIndex, std::vector<SidechainDeposit>& vDeposit);
+
+    // Get the local commitment record for a mainchain block
+    bool GetMainBlockCommits(const uint256& hashMainBlock, MainBlockCommits& commits) const;
+
+    // Record the BMM h* commitments from a mainchain block's coinbase
+    void CacheMainBlockBMM(const uint256& hashMainBlock, const CMainchainBlockHeader& header, const std::set<uint256>& setBMM);
+
+    // Record a deposit which has been proven to be in a mainchain block
+    void CacheMainBlockDeposit(const uint256& hashMainBlock, const CMainchainBlockHeader& header, const uint256& txid, uint32_t nTx);
+
+    // Check if we have the coinbase commitments of a mainchain block. If we
+    // do, fBMM is set to whether hashBMM was committed to.
+    bool HaveMainBlockBMM(const uint256& hashMainBlock, const uint256& hashBMM, bool& fBMM) const;
+
+    // Check if a deposit has been proven to be in a mainchain block at nTx
+    bool HaveMainBlockDeposit(const uint256& hashMainBlock, const uint256& txid, uint32_t nTx) const;
+
+    std::map<uint256, MainBlockCommits> GetMainBlockCommitIndex() const;
+
+    // Restore a mainchain block commitment record loaded from disk
+    void CacheMainBlockCommits(const uint256& hashMainBlock, const MainBlockCommits& commits);
+
+    // Cache a record from the verification journal
+    void CacheBlockVerifyRecord(const BlockVerifyRecord& record);
+
+    bool GetBlockVerifyRecord(const uint256& hashBlock, BlockVerifyRecord& record) const;
+
+    bool HaveBlockVerifyRecord(const uint256& hashBlock) const;
+
 private:
     // BMM blocks that we have created with the intention of connecting to the
     // side blockchain once the BMM h* hash is included on the mainchain
@@ -99,6 +253,10 @@ private:
     // Cache of deposit txid which we have already verified with the mainchain
     std::set<uint256 /* txid */> setDepositVerified;
 
+    // Protects setBMMVerified and setDepositVerified, which are written while
+    // blocks are checked on several threads
+    mutable std::mutex mtxVerified;
+
     // WithdrawalBundle(s) that we have already broadcasted to the mainchain.
     std::set<uint256> setWithdrawalBundleBroadcasted;
 
@@ -108,6 +266,15 @@ private:
     // List of all known mainchain block hashes in order
     std::vector<uint256> vMainBlockHash;
 
+    // Protects mapMainBlock and vMainBlockHash, which are updated from the
+    // mainchain while validation and the status cache read them. Taken before
+    // mtxStatusCache and mtxDepositQueue.
+    mutable std::mutex mtxMainBlockCache;
+
+    // Append a block hash to the main block cache, mtxMainBlockCache must be
+    // held
+    void AppendMainBlockHash(const uint256& hash);
+
     // TODO we could also cache a map of mainchain block hashes that we created
     // BMM requests for. That way, to check for BMM commitments we can just
     // check recent blocks that we created a commitment for instead of scanning
@@ -123,6 +290,52 @@ private:
 
     // WithdrawalIDs for WT(s) created by the user
     std::set<uint256> setWITHDRAWALIDCache;
+
+    // Withdrawal bundle status results from the mainchain. Bundle status can
+    // only change when a new mainchain block is connected, so these are only
+    // valid for the mainchain tip they were cached at (hashStatusCacheTip).
+    std::map<uint256 /* hashWithdrawalBundle */, bool> mapWithdrawalBundleFailed;
+    std::map<uint256 /* hashWithdrawalBundle */, bool> mapWithdrawalBundleSpent;
+
+    // Mainchain list of withdrawal bundles being tracked for this sidechain
+    std::vector<uint256> vWithdrawalBundleListCached;
+    bool fWithdrawalBundleListCached = false;
+
+    // Mainchain tip that the status results above were cached at
+    uint256 hashStatusCacheTip;
+
+    // Protects the withdrawal bundle status cache which is used by both the
+    // miner and validation while the mainchain tip is updated by other threads
+    mutable std::mutex mtxStatusCache;
+
+    // Deposits from the mainchain that have not been paid out yet, in CTIP
+    // spend order. Filled in the background by UpdateDepositCache so that
+    // block templates don't have to wait on the mainchain or the sidechain db.
+    std::vector<SidechainDeposit> vDepositPending;
+
+    // IDs (SidechainDeposit::GetID) of the pending deposits and the anchor
+    std::set<uint256> setDepositPendingID;
+
+    // The deposit (CTIP) that the pending queue starts after
+    uint256 hashDepositAnchor;
+    uint32_t nDepositAnchor = 0;
+    uint256 idDepositAnchor;
+    bool fDepositQueueStarted = false;
+
+    // Mainchain tip that the pending deposit queue was last updated at
+    uint256 hashDepositQueueMainTip;
+
+    mutable std::mutex mtxDepositQueue;
+
+    // Local index of mainchain block commitments for this sidechain
+    std::map<uint256 /* hashMainchainBlock */, MainBlockCommits> mapMainBlockCommits;
+
+    mutable std::mutex mtxMainBlockCommits;
+
+    // Verification journal records by sidechain block hash
+    std::map<uint256 /* hashBlock */, BlockVerifyRecord> mapBlockVerifyRecord;
+
+    mutable std::mutex mtxBlockVerifyRecord;
 };
 
 #endif // BITCOIN_BMMCACHE_H
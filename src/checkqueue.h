@@ -8,6 +8,10 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -16,6 +20,9 @@
 template <typename T>
 class CCheckQueueControl;
 
+//! Maximum number of threads (including the master) with their own queue
+static const int MAX_CHECKQUEUE_WORKERS = 256;
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
@@ -25,12 +32,27 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has its own queue and batches of new verifications are
+  * handed to the queues in turn. A worker takes from the back of its own
+  * queue and steals from the front of the others' when it runs out. Completion is tracked with
+  * atomic counters, the shared mutex is only taken to add work and by
+  * workers that go idle.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! The verifications owned by one worker
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<T> checks;
+        //! Keep the queues of different workers on different cache lines
+        char padding[64];
+    };
+
+    //! Mutex for idle workers and the master to wait on new work
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,87 +61,131 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The queue of each worker, the master always uses the first one
+    std::unique_ptr<WorkerQueue[]> queues;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of queues in use (the master's and one per worker)
+    std::atomic<int> nQueues;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The queue that the next batch of verifications goes to
+    unsigned int nNextQueue;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    /**
+     * Number of verifications in the queues. Only increased with the mutex
+     * held, so that waiting on the mutex can't miss new work.
+     */
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! The number of workers waiting for new work.
+    std::atomic<int> nIdle;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Claim a queue for a new worker thread
+    int RegisterWorker()
+    {
+        int n = nQueues.load();
+        while (n < MAX_CHECKQUEUE_WORKERS) {
+            if (nQueues.compare_exchange_weak(n, n + 1))
+                return n;
+        }
+        // Out of queues, share the master's
+        return 0;
+    }
+
+    /**
+     * Take a batch of work, from the back of our own queue or else from the
+     * front of another worker's queue. Steal at most half of a queue so that
+     * its owner and other thieves still have work.
+     */
+    bool TakeWork(int nQueue, std::vector<T>& vChecks)
+    {
+        const int n = nQueues.load();
+        for (int i = 0; i < n; i++) {
+            WorkerQueue& queue = queues[(nQueue + i) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.checks.empty())
+                continue;
+
+            const unsigned int nSize = queue.checks.size();
+            const unsigned int nNow = std::min(nBatchSize, i == 0 ? nSize : std::max(1U, nSize / 2));
+            vChecks.resize(nNow);
+            for (unsigned int j = 0; j < nNow; j++) {
+                // Swap jobs from the queue to the local batch vector instead of copying
+                if (i == 0) {
+                    vChecks[j].swap(queue.checks.back());
+                    queue.checks.pop_back();
+                } else {
+                    vChecks[j].swap(queue.checks.front());
+                    queue.checks.pop_front();
+                }
+            }
+            nQueued -= nNow;
+            return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(int nQueue, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+            if (TakeWork(nQueue, vChecks)) {
+                // Get help with the rest of the work
+                if (nQueued > 0 && nIdle > 0)
+                    condWorker.notify_one();
+
+                // Check whether we need to do work at all
+                bool fOk = fAllOk;
+                // execute work
+                for (T& check : vChecks)
+                    if (fOk)
+                        fOk = check();
+                if (!fOk)
+                    fAllOk = false;
+
+                // Only count the work as done once the checks are destroyed
+                const unsigned int nNow = vChecks.size();
+                vChecks.clear();
+                if (nTodo.fetch_sub(nNow) == nNow) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    { boost::unique_lock<boost::mutex> lock(mutex); }
+                    condMaster.notify_one();
+                }
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                while (nQueued == 0 && nTodo != 0)
+                    condMaster.wait(lock);
+                if (nQueued == 0) {
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    fAllOk = true;
+                    // return the current status
+                    return fRet;
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
+            } else {
+                while (nQueued == 0) {
                     nIdle++;
-                    cond.wait(lock); // wait
+                    condWorker.wait(lock);
                     nIdle--;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
@@ -128,33 +194,44 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : queues(new WorkerQueue[MAX_CHECKQUEUE_WORKERS]), nQueues(1), nNextQueue(0), nQueued(0), nTodo(0), nIdle(0), fAllOk(true), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        Loop(RegisterWorker());
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
+        if (vChecks.empty())
+            return;
+
         boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        nQueued += vChecks.size();
+
+        // Hand each batch to the next queue round-robin, idle workers
+        // steal from it if its owner is busy
+        WorkerQueue& queue = queues[nNextQueue++ % nQueues.load()];
+        {
+            std::lock_guard<std::mutex> queueLock(queue.mutex);
+            for (T& check : vChecks) {
+                queue.checks.push_back(T());
+                check.swap(queue.checks.back());
+            }
+        }
+        lock.unlock();
+
+        // Wake up one worker, it wakes up more if there is enough work left
+        condWorker.notify_one();
     }
 
     ~CCheckQueue()
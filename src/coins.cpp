@@ -7,6 +7,8 @@
 #include <consensus/consensus.h>
 #include <random.h>
 
+#include <algorithm>
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
@@ -19,6 +21,15 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
     return GetCoin(outpoint, coin);
 }
 
+void CCoinsView::GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const
+{
+    vCoin.resize(vOutPoint.size());
+    for (size_t i = 0; i < vOutPoint.size(); i++) {
+        if (!GetCoin(vOutPoint[i], vCoin[i]))
+            vCoin[i].Clear();
+    }
+}
+
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
@@ -63,6 +74,63 @@ bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return false;
 }
 
+void CCoinsViewCache::GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const {
+    vCoin.resize(vOutPoint.size());
+
+    // Answer what we can from the cache and ask the base for the rest
+    std::vector<COutPoint> vMissing;
+    std::vector<size_t> vMissingPos;
+    for (size_t i = 0; i < vOutPoint.size(); i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(vOutPoint[i]);
+        if (it != cacheCoins.end()) {
+            vCoin[i] = it->second.coin;
+        } else {
+            vMissing.push_back(vOutPoint[i]);
+            vMissingPos.push_back(i);
+        }
+    }
+    if (vMissing.empty())
+        return;
+
+    std::vector<Coin> vFetched;
+    base->GetCoins(vMissing, vFetched);
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        Coin& coin = vCoin[vMissingPos[i]];
+        coin = std::move(vFetched[i]);
+        if (coin.IsSpent())
+            continue;
+        CCoinsMap::iterator it;
+        bool inserted;
+        std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(vMissing[i]), std::forward_as_tuple(Coin(coin)));
+        if (inserted)
+            cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    }
+}
+
+void CCoinsViewCache::PrefetchCoins(const std::vector<COutPoint>& vOutPoint) const {
+    std::vector<COutPoint> vMissing;
+    vMissing.reserve(vOutPoint.size());
+    for (const COutPoint& outpoint : vOutPoint) {
+        if (!cacheCoins.count(outpoint))
+            vMissing.push_back(outpoint);
+    }
+    if (vMissing.empty())
+        return;
+
+    // Sorted outpoints are close together in the database
+    std::sort(vMissing.begin(), vMissing.end());
+    vMissing.erase(std::unique(vMissing.begin(), vMissing.end()), vMissing.end());
+
+    std::vector<Coin> vCoin;
+    base->GetCoins(vMissing, vCoin);
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        if (vCoin[i].IsSpent())
+            continue;
+        CCoinsMap::iterator it = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(vMissing[i]), std::forward_as_tuple(std::move(vCoin[i]))).first;
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    }
+}
+
 void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
     assert(!coin.IsSpent());
     if (coin.out.scriptPubKey.IsUnspendable()) return;
@@ -143,7 +211,7 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
 }
 
 bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         // Ignore non-dirty entries (optimization).
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
             continue;
@@ -196,6 +264,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
             }
         }
     }
+    // Free the child's entries all at once
+    mapCoins.clear();
     hashBlock = hashBlockIn;
     return true;
 }
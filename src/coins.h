@@ -7,6 +7,7 @@
 #define BITCOIN_COINS_H
 
 #include <primitives/transaction.h>
+#include <arenamap.h>
 #include <compressor.h>
 #include <core_memusage.h>
 #include <hash.h>
@@ -17,8 +18,6 @@
 #include <assert.h>
 #include <stdint.h>
 
-#include <unordered_map>
-
 /**
  * A UTXO entry.
  *
@@ -85,7 +84,7 @@ class SaltedOutpointHasher
 {
 private:
     /** Salt */
-    const uint64_t k0, k1;
+    uint64_t k0, k1;
 
 public:
     SaltedOutpointHasher();
@@ -119,7 +118,7 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+typedef arenamap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -154,6 +153,12 @@ public:
     //! Just check whether a given outpoint is unspent.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
+    //! Retrieve the Coins for several outpoints at once. vCoin is resized to
+    //! the size of vOutPoint, entries without an unspent coin are left spent.
+    //! Views that are backed by another one only forward this to their base
+    //! when they override it.
+    virtual void GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const;
+
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
@@ -222,6 +227,7 @@ public:
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    void GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
@@ -236,6 +242,13 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Load the coins for the given outpoints into the cache with a single
+     * bulk request to the backing view, which may read them in parallel.
+     * Outpoints that are already cached or not unspent are skipped.
+     */
+    void PrefetchCoins(const std::vector<COutPoint>& vOutPoint) const;
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
@@ -86,6 +86,12 @@ typedef int32_t ssize_t;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+// Linux can wait for socket events with epoll, which isn't limited to FD_SETSIZE
+// sockets and doesn't have to be told about every socket on every wait
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(const SOCKET& s) {
 #ifdef WIN32
     return true;
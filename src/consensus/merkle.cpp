@@ -3,9 +3,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <consensus/merkle.h>
+#include <crypto/sha256.h>
 #include <hash.h>
 #include <utilstrencodings.h>
 
+#include <algorithm>
+#include <thread>
+
 /*     WARNING! If you're reading this because you're learning about crypto
        and/or designing a new system that will use merkle trees, keep in mind
        that the following merkle tree algorithm has a serious flaw related to
@@ -130,10 +134,115 @@ static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot
     if (proot) *proot = h;
 }
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, nullptr);
-    return hash;
+/* Compute the root one level at a time, hashing each level in place with the
+ * multi-way double-SHA256 kernels. */
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
+    bool mutation = false;
+    while (hashes.size() > 1) {
+        if (mutated) {
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutation = true;
+            }
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        SHA256D64(hashes[0].begin(), hashes[0].begin(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
+    }
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
+}
+
+namespace {
+/*
+ * Hash level[begin, end) into the matching positions of the next level,
+ * pairing the last hash with itself if the count is odd. Returns whether a
+ * pair other than the first one of the level has two identical hashes.
+ */
+bool HashMerkleLevel(const std::vector<uint256>& level, std::vector<uint256>& next, size_t begin, size_t end)
+{
+    bool mutated = false;
+    for (size_t pos = std::max<size_t>(begin, 2); pos + 1 < end; pos += 2) {
+        if (level[pos] == level[pos + 1]) mutated = true;
+    }
+    SHA256D64(next[begin / 2].begin(), level[begin].begin(), (end - begin) / 2);
+    if ((end - begin) & 1) {
+        CHash256().Write(level[end - 1].begin(), 32).Write(level[end - 1].begin(), 32).Finalize(next[end / 2].begin());
+    }
+    return mutated;
+}
+} // namespace
+
+CBlockMerkleTree::CBlockMerkleTree(std::vector<uint256> leaves, unsigned int nThreads) : fMutatedRest(false)
+{
+    vLevel.push_back(std::move(leaves));
+    while (vLevel.back().size() > 1) {
+        vLevel.emplace_back((vLevel.back().size() + 1) / 2);
+    }
+
+    const size_t nLeaves = vLevel[0].size();
+    if (nThreads == 0) nThreads = std::thread::hardware_concurrency();
+
+    // Split large trees into one subtree of 2^nHeight leaves per thread.
+    // Subtrees don't share any hashes below their roots so they can be
+    // hashed independently, only the last one may have odd levels.
+    size_t nHeight = 0;
+    if (nThreads > 1 && nLeaves >= MERKLE_PARALLEL_MIN_LEAVES) {
+        while (((nLeaves - 1) >> nHeight) + 1 > nThreads) nHeight++;
+
+        const size_t nSubtrees = ((nLeaves - 1) >> nHeight) + 1;
+        std::vector<char> vMutated(nSubtrees, false);
+        auto hashSubtree = [this, nHeight, &vMutated](size_t i) {
+            for (size_t l = 0; l < nHeight; l++) {
+                size_t begin = (i << nHeight) >> l;
+                size_t end = std::min(((i + 1) << nHeight) >> l, vLevel[l].size());
+                if (HashMerkleLevel(vLevel[l], vLevel[l + 1], begin, end)) vMutated[i] = true;
+            }
+        };
+
+        std::vector<std::thread> vThread;
+        for (size_t i = 1; i < nSubtrees; i++) {
+            vThread.emplace_back(hashSubtree, i);
+        }
+        hashSubtree(0);
+        for (std::thread& t : vThread) {
+            t.join();
+        }
+
+        for (char mutated : vMutated) {
+            if (mutated) fMutatedRest = true;
+        }
+    }
+
+    // Hash the remaining levels
+    for (size_t l = nHeight; l + 1 < vLevel.size(); l++) {
+        if (HashMerkleLevel(vLevel[l], vLevel[l + 1], 0, vLevel[l].size())) fMutatedRest = true;
+    }
+}
+
+void CBlockMerkleTree::UpdateFirstLeaf(const uint256& hash)
+{
+    assert(GetLeafCount() > 0);
+    vLevel[0][0] = hash;
+    for (size_t l = 0; l + 1 < vLevel.size(); l++) {
+        const uint256& left = vLevel[l][0];
+        const uint256& right = vLevel[l].size() > 1 ? vLevel[l][1] : left;
+        CHash256().Write(left.begin(), 32).Write(right.begin(), 32).Finalize(vLevel[l + 1][0].begin());
+    }
+}
+
+uint256 CBlockMerkleTree::GetRoot(bool* mutated) const
+{
+    if (mutated) {
+        *mutated = fMutatedRest;
+        for (const std::vector<uint256>& level : vLevel) {
+            if (level.size() > 1 && level[0] == level[1]) *mutated = true;
+        }
+    }
+    if (GetLeafCount() == 0) return uint256();
+    return vLevel.back()[0];
 }
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
@@ -155,6 +264,15 @@ uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint2
     return hash;
 }
 
+/* Compute a block merkle root, hashing large trees across threads. */
+static uint256 ComputeBlockMerkleRoot(std::vector<uint256> leaves, bool* mutated)
+{
+    if (leaves.size() >= MERKLE_PARALLEL_MIN_LEAVES) {
+        return CBlockMerkleTree(std::move(leaves)).GetRoot(mutated);
+    }
+    return ComputeMerkleRoot(std::move(leaves), mutated);
+}
+
 uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
 {
     std::vector<uint256> leaves;
@@ -162,7 +280,27 @@ uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
     for (size_t s = 0; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s]->GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeBlockMerkleRoot(std::move(leaves), mutated);
+}
+
+CBlockMerkleTree BlockMerkleTree(const CBlock& block)
+{
+    std::vector<uint256> leaves;
+    leaves.resize(block.vtx.size());
+    for (size_t s = 0; s < block.vtx.size(); s++) {
+        leaves[s] = block.vtx[s]->GetHash();
+    }
+    return CBlockMerkleTree(std::move(leaves));
+}
+
+uint256 MainchainBlockMerkleRoot(const CMainchainBlock& block, bool* mutated)
+{
+    std::vector<uint256> leaves;
+    leaves.resize(block.vtx.size());
+    for (size_t s = 0; s < block.vtx.size(); s++) {
+        leaves[s] = block.vtx[s]->GetHash();
+    }
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
@@ -173,7 +311,7 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
     for (size_t s = 1; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s]->GetWitnessHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeBlockMerkleRoot(std::move(leaves), mutated);
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
@@ -12,16 +12,65 @@
 #include <primitives/block.h>
 #include <uint256.h>
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated = nullptr);
+/** Trees with at least this many leaves are hashed in subtrees across threads */
+static const size_t MERKLE_PARALLEL_MIN_LEAVES = 4096;
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated = nullptr);
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position);
 uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint256>& branch, uint32_t position);
 
+/*
+ * Merkle tree which keeps every level, so that replacing the first leaf (the
+ * coinbase of a block) only rehashes the path from that leaf to the root.
+ * Large trees are hashed in independent subtrees across threads.
+ */
+class CBlockMerkleTree
+{
+public:
+    CBlockMerkleTree() : fMutatedRest(false) {}
+
+    /*
+     * Build the tree. Trees with at least MERKLE_PARALLEL_MIN_LEAVES leaves
+     * are split across nThreads threads, 0 to use one per core.
+     */
+    explicit CBlockMerkleTree(std::vector<uint256> leaves, unsigned int nThreads = 0);
+
+    /* Replace the first leaf and recompute its path to the root. */
+    void UpdateFirstLeaf(const uint256& hash);
+
+    /*
+     * Get the root of the tree.
+     * *mutated is set to true if a duplicated subtree was found.
+     */
+    uint256 GetRoot(bool* mutated = nullptr) const;
+
+    size_t GetLeafCount() const { return vLevel.empty() ? 0 : vLevel[0].size(); }
+
+private:
+    // Hashes of each level, level 0 being the leaves
+    std::vector<std::vector<uint256>> vLevel;
+
+    // Whether a duplicated pair was found outside of the first leaf's path
+    bool fMutatedRest;
+};
+
 /*
  * Compute the Merkle root of the transactions in a block.
  * *mutated is set to true if a duplicated subtree was found.
  */
 uint256 BlockMerkleRoot(const CBlock& block, bool* mutated = nullptr);
 
+/*
+ * Build the Merkle tree of the transactions in a block.
+ */
+CBlockMerkleTree BlockMerkleTree(const CBlock& block);
+
+/*
+ * Compute the Merkle root of the transactions in a mainchain block.
+ * *mutated is set to true if a duplicated subtree was found.
+ */
+uint256 MainchainBlockMerkleRoot(const CMainchainBlock& block, bool* mutated = nullptr);
+
 /*
  * Compute the Merkle root of the witness transactions in a block.
  * *mutated is set to true if a duplicated subtree was found.
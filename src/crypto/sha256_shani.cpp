@@ -0,0 +1,191 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Based on https://github.com/noloader/SHA-Intrinsics/blob/master/sha256-x86.c,
+// Written and placed in public domain by Jeffrey Walton.
+// Based on code from Intel, and by Sean Gulley for the miTLS project.
+
+#ifdef ENABLE_SHANI
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <crypto/common.h>
+
+namespace {
+
+alignas(__m128i) const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+/** Byte order mask turning 4 big-endian words into native ones (and back). */
+__m128i inline Mask() { return _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull); }
+
+__m128i inline Load(const unsigned char* in) { return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), Mask()); }
+void inline Save(unsigned char* out, __m128i s) { _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(s, Mask())); }
+
+/** Convert a state in word order (a,b,c,d / e,f,g,h) to the ABEF / CDGH order used by the SHA instructions. */
+void inline Shuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0xB1);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0x1B);
+    s0 = _mm_alignr_epi8(t1, t2, 0x08);
+    s1 = _mm_blend_epi16(t2, t1, 0xF0);
+}
+
+/** Inverse of Shuffle. */
+void inline Unshuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0x1B);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0xB1);
+    s0 = _mm_blend_epi16(t1, t2, 0xF0);
+    s1 = _mm_alignr_epi8(t2, t1, 0x08);
+}
+
+/** Four rounds of SHA-256, given 4 message words with the round constants added. */
+void inline __attribute__((always_inline)) QuadRound(__m128i& abef, __m128i& cdgh, __m128i wk)
+{
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0E));
+}
+
+/** Compute message words 4*i..4*i+3 from the previous 16, stored in m[(i - 4) % 4] .. m[(i - 1) % 4]. */
+__m128i inline __attribute__((always_inline)) Expand(const __m128i* m, int i)
+{
+    const __m128i m4 = m[i & 3], m3 = m[(i + 1) & 3], m2 = m[(i + 2) & 3], m1 = m[(i + 3) & 3];
+    return _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m4, m3), _mm_alignr_epi8(m1, m2, 4)), m1);
+}
+
+__m128i inline WK(__m128i m, int i) { return _mm_add_epi32(m, _mm_load_si128((const __m128i*)(K + 4 * i))); }
+
+/** Compress one block, given as 4 vectors of message words. */
+void inline __attribute__((always_inline)) Compress(__m128i& abef, __m128i& cdgh, __m128i* m)
+{
+    const __m128i abef_save = abef, cdgh_save = cdgh;
+    for (int i = 0; i < 16; i++) {
+        if (i >= 4) m[i & 3] = Expand(m, i);
+        QuadRound(abef, cdgh, WK(m[i & 3], i));
+    }
+    abef = _mm_add_epi32(abef, abef_save);
+    cdgh = _mm_add_epi32(cdgh, cdgh_save);
+}
+
+/** Compress two independent blocks, interleaving the instructions to hide their latency. */
+void inline __attribute__((always_inline)) Compress2(__m128i& abefa, __m128i& cdgha, __m128i* ma, __m128i& abefb, __m128i& cdghb, __m128i* mb)
+{
+    const __m128i abefa_save = abefa, cdgha_save = cdgha, abefb_save = abefb, cdghb_save = cdghb;
+    for (int i = 0; i < 16; i++) {
+        if (i >= 4) {
+            ma[i & 3] = Expand(ma, i);
+            mb[i & 3] = Expand(mb, i);
+        }
+        QuadRound(abefa, cdgha, WK(ma[i & 3], i));
+        QuadRound(abefb, cdghb, WK(mb[i & 3], i));
+    }
+    abefa = _mm_add_epi32(abefa, abefa_save);
+    cdgha = _mm_add_epi32(cdgha, cdgha_save);
+    abefb = _mm_add_epi32(abefb, abefb_save);
+    cdghb = _mm_add_epi32(cdghb, cdghb_save);
+}
+
+/** The initial state in ABEF / CDGH order. */
+void inline Initialize(__m128i& abef, __m128i& cdgh)
+{
+    abef = _mm_set_epi32(0x6a09e667ul, 0xbb67ae85ul, 0x510e527ful, 0x9b05688cul);
+    cdgh = _mm_set_epi32(0x3c6ef372ul, 0xa54ff53aul, 0x1f83d9abul, 0x5be0cd19ul);
+}
+
+/** Message schedule of the padding block that follows a 64-byte message, with the round constants added. */
+struct PaddingSchedule
+{
+    __m128i wk[16];
+
+    PaddingSchedule()
+    {
+        __m128i m[4] = {_mm_set_epi32(0, 0, 0, 0x80000000ul), _mm_setzero_si128(), _mm_setzero_si128(), _mm_set_epi32(0x200, 0, 0, 0)};
+        for (int i = 0; i < 16; i++) {
+            if (i >= 4) m[i & 3] = Expand(m, i);
+            wk[i] = WK(m[i & 3], i);
+        }
+    }
+};
+
+} // namespace
+
+namespace sha256_shani {
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i abef = _mm_loadu_si128((const __m128i*)s);
+    __m128i cdgh = _mm_loadu_si128((const __m128i*)(s + 4));
+    Shuffle(abef, cdgh);
+
+    while (blocks--) {
+        __m128i m[4] = {Load(chunk), Load(chunk + 16), Load(chunk + 32), Load(chunk + 48)};
+        Compress(abef, cdgh, m);
+        chunk += 64;
+    }
+
+    Unshuffle(abef, cdgh);
+    _mm_storeu_si128((__m128i*)s, abef);
+    _mm_storeu_si128((__m128i*)(s + 4), cdgh);
+}
+} // namespace sha256_shani
+
+namespace sha256d64_shani {
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    static const PaddingSchedule padding;
+
+    __m128i abefa, cdgha, abefb, cdghb;
+    __m128i ma[4] = {Load(in), Load(in + 16), Load(in + 32), Load(in + 48)};
+    __m128i mb[4] = {Load(in + 64), Load(in + 80), Load(in + 96), Load(in + 112)};
+
+    // Transform 1: the 64-byte messages
+    Initialize(abefa, cdgha);
+    Initialize(abefb, cdghb);
+    Compress2(abefa, cdgha, ma, abefb, cdghb, mb);
+
+    // Transform 2: the padding block
+    const __m128i abefa_save = abefa, cdgha_save = cdgha, abefb_save = abefb, cdghb_save = cdghb;
+    for (int i = 0; i < 16; i++) {
+        QuadRound(abefa, cdgha, padding.wk[i]);
+        QuadRound(abefb, cdghb, padding.wk[i]);
+    }
+    abefa = _mm_add_epi32(abefa, abefa_save);
+    cdgha = _mm_add_epi32(cdgha, cdgha_save);
+    abefb = _mm_add_epi32(abefb, abefb_save);
+    cdghb = _mm_add_epi32(cdghb, cdghb_save);
+
+    // Transform 3: the 32-byte hashes of the first SHA-256, padded
+    Unshuffle(abefa, cdgha);
+    Unshuffle(abefb, cdghb);
+    ma[0] = abefa;
+    ma[1] = cdgha;
+    ma[2] = _mm_set_epi32(0, 0, 0, 0x80000000ul);
+    ma[3] = _mm_set_epi32(0x100, 0, 0, 0);
+    mb[0] = abefb;
+    mb[1] = cdghb;
+    mb[2] = ma[2];
+    mb[3] = ma[3];
+    Initialize(abefa, cdgha);
+    Initialize(abefb, cdghb);
+    Compress2(abefa, cdgha, ma, abefb, cdghb, mb);
+
+    Unshuffle(abefa, cdgha);
+    Unshuffle(abefb, cdghb);
+    Save(out, abefa);
+    Save(out + 16, cdgha);
+    Save(out + 32, abefb);
+    Save(out + 48, cdghb);
+}
+} // namespace sha256d64_shani
+
+#endif
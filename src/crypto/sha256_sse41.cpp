@@ -0,0 +1,179 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_SSE41
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <crypto/common.h>
+
+namespace sha256d64_sse41 {
+namespace {
+
+__m128i inline K(uint32_t x) { return _mm_set1_epi32(x); }
+
+__m128i inline Add(__m128i x, __m128i y) { return _mm_add_epi32(x, y); }
+__m128i inline Add(__m128i x, __m128i y, __m128i z) { return Add(Add(x, y), z); }
+__m128i inline Add(__m128i x, __m128i y, __m128i z, __m128i w) { return Add(Add(x, y), Add(z, w)); }
+__m128i inline Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+__m128i inline Xor(__m128i x, __m128i y, __m128i z) { return Xor(Xor(x, y), z); }
+__m128i inline Or(__m128i x, __m128i y) { return _mm_or_si128(x, y); }
+__m128i inline And(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+__m128i inline ShR(__m128i x, int n) { return _mm_srli_epi32(x, n); }
+__m128i inline ShL(__m128i x, int n) { return _mm_slli_epi32(x, n); }
+
+__m128i inline Ch(__m128i x, __m128i y, __m128i z) { return Xor(z, And(x, Xor(y, z))); }
+__m128i inline Maj(__m128i x, __m128i y, __m128i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m128i inline Sigma0(__m128i x) { return Xor(Or(ShR(x, 2), ShL(x, 30)), Or(ShR(x, 13), ShL(x, 19)), Or(ShR(x, 22), ShL(x, 10))); }
+__m128i inline Sigma1(__m128i x) { return Xor(Or(ShR(x, 6), ShL(x, 26)), Or(ShR(x, 11), ShL(x, 21)), Or(ShR(x, 25), ShL(x, 7))); }
+__m128i inline sigma0(__m128i x) { return Xor(Or(ShR(x, 7), ShL(x, 25)), Or(ShR(x, 18), ShL(x, 14)), ShR(x, 3)); }
+__m128i inline sigma1(__m128i x) { return Xor(Or(ShR(x, 17), ShL(x, 15)), Or(ShR(x, 19), ShL(x, 13)), ShR(x, 10)); }
+
+const uint32_t k[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+/** One round of SHA-256, on 4 independent states at once. */
+void inline __attribute__((always_inline)) Round(__m128i a, __m128i b, __m128i c, __m128i& d, __m128i e, __m128i f, __m128i g, __m128i& h, __m128i wk)
+{
+    __m128i t1 = Add(h, Sigma1(e), Ch(e, f, g), wk);
+    __m128i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+/** Run the 64 rounds on s, given the message schedule with the round constants already added. */
+void inline __attribute__((always_inline)) Rounds(__m128i* s, const __m128i* wk)
+{
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+    for (int i = 0; i < 64; i += 8) {
+        Round(a, b, c, d, e, f, g, h, wk[i + 0]);
+        Round(h, a, b, c, d, e, f, g, wk[i + 1]);
+        Round(g, h, a, b, c, d, e, f, wk[i + 2]);
+        Round(f, g, h, a, b, c, d, e, wk[i + 3]);
+        Round(e, f, g, h, a, b, c, d, wk[i + 4]);
+        Round(d, e, f, g, h, a, b, c, wk[i + 5]);
+        Round(c, d, e, f, g, h, a, b, wk[i + 6]);
+        Round(b, c, d, e, f, g, h, a, wk[i + 7]);
+    }
+
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+/** Expand the first 16 words of w into the full message schedule, and add the round constants. */
+void inline __attribute__((always_inline)) Schedule(__m128i* w)
+{
+    for (int i = 16; i < 64; i++) {
+        w[i] = Add(sigma1(w[i - 2]), w[i - 7], sigma0(w[i - 15]), w[i - 16]);
+    }
+    for (int i = 0; i < 64; i++) {
+        w[i] = Add(w[i], K(k[i]));
+    }
+}
+
+/** Message schedule of the padding block that follows a 64-byte message, which is the same for every input. */
+struct PaddingSchedule
+{
+    uint32_t wk[64];
+
+    PaddingSchedule()
+    {
+        uint32_t w[64] = {0x80000000ul, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x200};
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = (w[i - 15] >> 7 | w[i - 15] << 25) ^ (w[i - 15] >> 18 | w[i - 15] << 14) ^ (w[i - 15] >> 3);
+            uint32_t s1 = (w[i - 2] >> 17 | w[i - 2] << 15) ^ (w[i - 2] >> 19 | w[i - 2] << 13) ^ (w[i - 2] >> 10);
+            w[i] = s1 + w[i - 7] + s0 + w[i - 16];
+        }
+        for (int i = 0; i < 64; i++) {
+            wk[i] = w[i] + k[i];
+        }
+    }
+};
+
+void inline Initialize(__m128i* s)
+{
+    s[0] = K(0x6a09e667ul);
+    s[1] = K(0xbb67ae85ul);
+    s[2] = K(0x3c6ef372ul);
+    s[3] = K(0xa54ff53aul);
+    s[4] = K(0x510e527ful);
+    s[5] = K(0x9b05688cul);
+    s[6] = K(0x1f83d9abul);
+    s[7] = K(0x5be0cd19ul);
+}
+
+/** Load word i of each of the 4 consecutive 64-byte inputs. */
+__m128i inline Read4(const unsigned char* in, int i)
+{
+    return _mm_setr_epi32(ReadBE32(in + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 192 + 4 * i));
+}
+
+/** Store word i of each of the 4 consecutive 32-byte outputs. */
+void inline Write4(unsigned char* out, int i, __m128i v)
+{
+    WriteBE32(out + 4 * i, _mm_extract_epi32(v, 0));
+    WriteBE32(out + 32 + 4 * i, _mm_extract_epi32(v, 1));
+    WriteBE32(out + 64 + 4 * i, _mm_extract_epi32(v, 2));
+    WriteBE32(out + 96 + 4 * i, _mm_extract_epi32(v, 3));
+}
+
+} // namespace
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    static const PaddingSchedule padding;
+
+    __m128i s[8], w[64];
+
+    // Transform 1: the 64-byte message
+    Initialize(s);
+    for (int i = 0; i < 16; i++) {
+        w[i] = Read4(in, i);
+    }
+    Schedule(w);
+    Rounds(s, w);
+
+    // Transform 2: the padding block
+    for (int i = 0; i < 64; i++) {
+        w[i] = K(padding.wk[i]);
+    }
+    Rounds(s, w);
+
+    // Transform 3: the 32-byte hash of the first SHA-256, padded
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+    }
+    w[8] = K(0x80000000ul);
+    for (int i = 9; i < 15; i++) {
+        w[i] = K(0);
+    }
+    w[15] = K(0x100);
+    Initialize(s);
+    Schedule(w);
+    Rounds(s, w);
+
+    for (int i = 0; i < 8; i++) {
+        Write4(out, i, s[i]);
+    }
+}
+
+} // namespace sha256d64_sse41
+
+#endif
@@ -185,6 +185,23 @@ public:
 
 };
 
+/** LevelDB settings of one database, so every database can be tuned for how it is used */
+struct CDBOptions
+{
+    //! Compress table blocks with Snappy (only if LevelDB is built with it, otherwise they are stored as is)
+    bool fCompression;
+    //! Bits per key of the bloom filters of the tables, 0 for no filters
+    int nBloomBits;
+    //! Size at which table files are split (bytes)
+    size_t nMaxFileSize;
+    //! Number of table files LevelDB keeps open
+    int nMaxOpenFiles;
+
+    CDBOptions() : fCompression(false), nBloomBits(10), nMaxFileSize(2 << 20), nMaxOpenFiles(64) {}
+    CDBOptions(bool fCompressionIn, int nBloomBitsIn, size_t nMaxFileSizeIn, int nMaxOpenFilesIn) :
+        fCompression(fCompressionIn), nBloomBits(nBloomBitsIn), nMaxFileSize(nMaxFileSizeIn), nMaxOpenFiles(nMaxOpenFilesIn) {}
+};
+
 class CDBWrapper
 {
     friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
@@ -229,8 +246,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] dbOptions   LevelDB settings for this database.
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBOptions& dbOptions = CDBOptions());
     ~CDBWrapper();
 
     template <typename K, typename V>
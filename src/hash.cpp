@@ -245,3 +245,54 @@ uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint3
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+#define SIPROUND_LANE(v0, v1, v2, v3) do { \
+    v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; \
+    v0 = ROTL(v0, 32); \
+    v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; \
+    v2 = ROTL(v2, 32); \
+} while (0)
+
+#define SIPROUND_X4 do { \
+    SIPROUND_LANE(a0, a1, a2, a3); \
+    SIPROUND_LANE(b0, b1, b2, b3); \
+    SIPROUND_LANE(c0, c1, c2, c3); \
+    SIPROUND_LANE(d0, d1, d2, d3); \
+} while (0)
+
+void SipHashUint256x4(uint64_t k0, uint64_t k1, const uint256* const val[4], uint64_t out[4])
+{
+    /* Same as SipHashUint256, with the rounds of the four hashes interleaved */
+    const uint64_t i0 = 0x736f6d6570736575ULL ^ k0;
+    const uint64_t i1 = 0x646f72616e646f6dULL ^ k1;
+    const uint64_t i2 = 0x6c7967656e657261ULL ^ k0;
+    const uint64_t i3 = 0x7465646279746573ULL ^ k1;
+    uint64_t a0 = i0, a1 = i1, a2 = i2, a3 = i3;
+    uint64_t b0 = i0, b1 = i1, b2 = i2, b3 = i3;
+    uint64_t c0 = i0, c1 = i1, c2 = i2, c3 = i3;
+    uint64_t d0 = i0, d1 = i1, d2 = i2, d3 = i3;
+
+    for (int i = 0; i < 4; i++) {
+        const uint64_t a = val[0]->GetUint64(i), b = val[1]->GetUint64(i), c = val[2]->GetUint64(i), d = val[3]->GetUint64(i);
+        a3 ^= a; b3 ^= b; c3 ^= c; d3 ^= d;
+        SIPROUND_X4;
+        SIPROUND_X4;
+        a0 ^= a; b0 ^= b; c0 ^= c; d0 ^= d;
+    }
+    const uint64_t len = ((uint64_t)4) << 59;
+    a3 ^= len; b3 ^= len; c3 ^= len; d3 ^= len;
+    SIPROUND_X4;
+    SIPROUND_X4;
+    a0 ^= len; b0 ^= len; c0 ^= len; d0 ^= len;
+    a2 ^= 0xFF; b2 ^= 0xFF; c2 ^= 0xFF; d2 ^= 0xFF;
+    SIPROUND_X4;
+    SIPROUND_X4;
+    SIPROUND_X4;
+    SIPROUND_X4;
+    out[0] = a0 ^ a1 ^ a2 ^ a3;
+    out[1] = b0 ^ b1 ^ b2 ^ b3;
+    out[2] = c0 ^ c1 ^ c2 ^ c3;
+    out[3] = d0 ^ d1 ^ d2 ^ d3;
+}
@@ -229,4 +229,8 @@ public:
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
+/** SipHashUint256 of four values with the same key. The rounds of the four
+ *  hashes are interleaved, so the CPU can work on them in parallel. */
+void SipHashUint256x4(uint64_t k0, uint64_t k1, const uint256* const val[4], uint64_t out[4]);
+
 #endif // BITCOIN_HASH_H
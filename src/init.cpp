@@ -149,10 +149,30 @@ public:
             abort();
         }
     }
+    void GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const override {
+        try {
+            base->GetCoins(vOutPoint, vCoin);
+        } catch(const std::runtime_error& e) {
+            uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+            LogPrintf("Error reading from database: %s\n", e.what());
+            abort();
+        }
+    }
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
 static std::unique_ptr<CCoinsViewErrorCatcher> pcoinscatcher;
+
+/** LevelDB settings of a database from its -<name>compression, -<name>bloombits, -<name>filesize and -<name>maxopenfiles options */
+static CDBOptions GetDBOptions(const std::string& strName, bool fDefaultCompression, int nDefaultBloomBits, int nDefaultFileSize, int nDefaultMaxOpenFiles)
+{
+    CDBOptions dbOptions;
+    dbOptions.fCompression = gArgs.GetBoolArg("-" + strName + "compression", fDefaultCompression);
+    dbOptions.nBloomBits = std::max<int64_t>(0, gArgs.GetArg("-" + strName + "bloombits", nDefaultBloomBits));
+    dbOptions.nMaxFileSize = (size_t)std::max<int64_t>(1, gArgs.GetArg("-" + strName + "filesize", nDefaultFileSize)) << 20;
+    dbOptions.nMaxOpenFiles = gArgs.GetArg("-" + strName + "maxopenfiles", nDefaultMaxOpenFiles);
+    return dbOptions;
+}
 static std::unique_ptr<ECCVerifyHandle> globalVerifyHandle;
 
 static boost::thread_group threadGroup;
@@ -221,6 +241,9 @@ void Shutdown()
     // Write the mainchain block hash cache to disk
     DumpMainBlockCache();
 
+    // Write the local index of mainchain block commitments to disk
+    DumpMainBlockCommitIndex();
+
     if (fFeeEstimatesInitialized)
     {
         ::feeEstimator.FlushUnconfirmed();
@@ -255,6 +278,7 @@ void Shutdown()
         }
         pcoinsTip.reset();
         pcoinscatcher.reset();
+        pcoinsflusher.reset();
         pcoinsdbview.reset();
         pblocktree.reset();
         psidechaintree.reset();
@@ -342,9 +366,21 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s)"), defaultChainParams->GetConsensus().defaultAssumeValid.GetHex()));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-blockindexdbbloombits=<n>", strprintf("Bits per key of the block index database bloom filters, 0 to disable them (default: %u)", DEFAULT_BLOCKINDEXDB_BLOOM_BITS));
+        strUsage += HelpMessageOpt("-blockindexdbcompression", strprintf("Compress the block index database with Snappy, if available (default: %u)", DEFAULT_BLOCKINDEXDB_COMPRESSION));
+        strUsage += HelpMessageOpt("-blockindexdbfilesize=<n>", strprintf("Size of the block index database table files in megabytes (default: %u)", DEFAULT_BLOCKINDEXDB_FILE_SIZE));
+        strUsage += HelpMessageOpt("-blockindexdbmaxopenfiles=<n>", strprintf("Number of block index database files to keep open (default: %u)", DEFAULT_BLOCKINDEXDB_MAX_OPEN_FILES));
+    }
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-coinsdbbloombits=<n>", strprintf("Bits per key of the chainstate database bloom filters, 0 to disable them (default: %u)", DEFAULT_COINSDB_BLOOM_BITS));
+        strUsage += HelpMessageOpt("-coinsdbcompression", strprintf("Compress the chainstate database with Snappy, if available (default: %u)", DEFAULT_COINSDB_COMPRESSION));
+        strUsage += HelpMessageOpt("-coinsdbfilesize=<n>", strprintf("Size of the chainstate database table files in megabytes (default: %u)", DEFAULT_COINSDB_FILE_SIZE));
+        strUsage += HelpMessageOpt("-coinsdbmaxopenfiles=<n>", strprintf("Number of chainstate database files to keep open (default: %u)", DEFAULT_COINSDB_MAX_OPEN_FILES));
+    }
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file. Relative paths will be prefixed by datadir location. (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -357,6 +393,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbreadthreads=<n>", strprintf(_("Set the number of threads reading coins from the database in parallel (0 to %d, default: %d)"), MAX_DB_READ_THREADS, DEFAULT_DB_READ_THREADS));
     strUsage += HelpMessageOpt("-debuglogfile=<file>", strprintf(_("Specify location of debug log file. Relative paths will be prefixed by a net-specific datadir location. (default: %s)"), DEFAULT_DEBUGLOGFILE));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
@@ -375,6 +412,14 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
+    strUsage += HelpMessageOpt("-reindexspotcheck=<n>", strprintf(_("When trusting the verification journal, re-verify one in <n> blocks with the mainchain, 0 to disable (default: %u)"), DEFAULT_REINDEX_SPOT_CHECK));
+    strUsage += HelpMessageOpt("-reindextrustjournal", strprintf(_("Use the journal of previous mainchain verification results during a reindex instead of asking the mainchain again (default: %u)"), DEFAULT_REINDEX_TRUST_JOURNAL));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-sidechaindbbloombits=<n>", strprintf("Bits per key of the sidechain database bloom filters, 0 to disable them (default: %u)", DEFAULT_SIDECHAINDB_BLOOM_BITS));
+        strUsage += HelpMessageOpt("-sidechaindbcompression", strprintf("Compress the sidechain database with Snappy, if available (default: %u)", DEFAULT_SIDECHAINDB_COMPRESSION));
+        strUsage += HelpMessageOpt("-sidechaindbfilesize=<n>", strprintf("Size of the sidechain database table files in megabytes (default: %u)", DEFAULT_SIDECHAINDB_FILE_SIZE));
+        strUsage += HelpMessageOpt("-sidechaindbmaxopenfiles=<n>", strprintf("Number of sidechain database files to keep open (default: %u)", DEFAULT_SIDECHAINDB_MAX_OPEN_FILES));
+    }
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -398,6 +443,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
+    strUsage += HelpMessageOpt("-msghandthreads=<n>", strprintf(_("Number of threads processing peer messages, besides the thread validating their blocks and transactions (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
@@ -406,6 +452,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("How to wait for network events, epoll (Linux only) or select. select limits the number of connections to %u (default: %s)"), FD_SETSIZE, DEFAULT_SOCKETEVENTS));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -507,6 +554,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mainchainrpchost=<host>", strprintf(_("Connect to mainchain on <host> (default: localhost)")));
     strUsage += HelpMessageOpt("-mainchainrpcuser=<user>", strprintf(_("Connect to mainchain with username <user> (default: value of -rpcuser)")));
     strUsage += HelpMessageOpt("-mainchainrpcpassword=<pw>", strprintf(_("Connect to mainchain with password <pw> (default: value of -rpcpassword)")));
+    strUsage += HelpMessageOpt("-verifybmmlocal", strprintf(_("Fetch each mainchain block once and verify BMM and deposits against a local index of mainchain commitments and merkle proofs (default: %u)"), DEFAULT_VERIFY_BMM_LOCAL));
+    strUsage += HelpMessageOpt("-depositprefetch", strprintf(_("Follow the mainchain in the background and queue new deposits for block creation (default: %u)"), DEFAULT_DEPOSIT_PREFETCH));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
@@ -695,6 +744,10 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
         return;
     }
 
+    // The reindexed blocks are connected, new blocks are verified with the
+    // mainchain again
+    fTrustVerifyJournal = false;
+
     if (gArgs.GetBoolArg("-stopafterblockimport", DEFAULT_STOPAFTERBLOCKIMPORT)) {
         LogPrintf("Stopping after block import\n");
         StartShutdown();
@@ -846,6 +899,7 @@ namespace { // Variables internal to initialization process only
 int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
+bool fSocketEventsEpoll = false;
 ServiceFlags nLocalServices = ServiceFlags(NODE_NETWORK | NODE_NETWORK_LIMITED);
 
 } // namespace
@@ -935,8 +989,23 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    const std::string strSocketEvents = gArgs.GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    if (strSocketEvents == "epoll") {
+#ifdef USE_EPOLL
+        fSocketEventsEpoll = true;
+#else
+        return InitError(_("-socketevents=epoll is not supported on this platform"));
+#endif
+    } else if (strSocketEvents == "select") {
+        fSocketEventsEpoll = false;
+    } else {
+        return InitError(strprintf(_("Unknown -socketevents mode '%s'"), strSocketEvents));
+    }
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+    // (select() can't wait for sockets past FD_SETSIZE)
+    if (!fSocketEventsEpoll)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1244,6 +1313,11 @@ bool AppInitMain()
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    nCoinsReadThreads = std::max(0, std::min(MAX_DB_READ_THREADS, (int)gArgs.GetArg("-dbreadthreads", DEFAULT_DB_READ_THREADS)));
+    LogPrintf("Using %u threads for reading coins from the database\n", nCoinsReadThreads);
+    for (int i = 0; i < nCoinsReadThreads; i++)
+        threadGroup.create_thread(&ThreadCoinsRead);
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1402,6 +1476,13 @@ bool AppInitMain()
     fReindex = gArgs.GetBoolArg("-reindex", false);
     bool fReindexChainState = gArgs.GetBoolArg("-reindex-chainstate", false);
 
+    // Load the journal of mainchain verification results, which a reindex
+    // can use instead of asking the mainchain about every block again
+    LoadVerifyJournal();
+    if (fReindex || fReindexChainState)
+        fTrustVerifyJournal = gArgs.GetBoolArg("-reindextrustjournal", DEFAULT_REINDEX_TRUST_JOURNAL);
+    nVerifyJournalSpotCheck = gArgs.GetArg("-reindexspotcheck", DEFAULT_REINDEX_SPOT_CHECK);
+
     // cache size calculations
     int64_t nTotalCache = (gArgs.GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
@@ -1435,13 +1516,16 @@ bool AppInitMain()
             try {
                 UnloadBlockIndex();
                 pcoinsTip.reset();
-                pcoinsdbview.reset();
                 pcoinscatcher.reset();
+                pcoinsflusher.reset();
+                pcoinsdbview.reset();
                 // new CBlockTreeDB tries to delete the existing file, which
                 // fails if it's still open from the previous loop. Close it first:
                 pblocktree.reset();
-                pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset));
-                psidechaintree.reset(new CSidechainTreeDB(nSidechainTreeDBCache, false, fReset));
+                pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset,
+                    GetDBOptions("blockindexdb", DEFAULT_BLOCKINDEXDB_COMPRESSION, DEFAULT_BLOCKINDEXDB_BLOOM_BITS, DEFAULT_BLOCKINDEXDB_FILE_SIZE, DEFAULT_BLOCKINDEXDB_MAX_OPEN_FILES)));
+                psidechaintree.reset(new CSidechainTreeDB(nSidechainTreeDBCache, false, fReset,
+                    GetDBOptions("sidechaindb", DEFAULT_SIDECHAINDB_COMPRESSION, DEFAULT_SIDECHAINDB_BLOOM_BITS, DEFAULT_SIDECHAINDB_FILE_SIZE, DEFAULT_SIDECHAINDB_MAX_OPEN_FILES)));
 
                 if (fReset) {
                     pblocktree->WriteReindexing(true);
@@ -1491,8 +1575,10 @@ bool AppInitMain()
                 // At this point we're either in reindex or we've loaded a useful
                 // block tree into mapBlockIndex!
 
-                pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState));
-                pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
+                pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState,
+                    GetDBOptions("coinsdb", DEFAULT_COINSDB_COMPRESSION, DEFAULT_COINSDB_BLOOM_BITS, DEFAULT_COINSDB_FILE_SIZE, DEFAULT_COINSDB_MAX_OPEN_FILES)));
+                pcoinsflusher.reset(new CCoinsViewFlusher(pcoinsdbview.get()));
+                pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsflusher.get()));
 
                 // If necessary, upgrade from older database format.
                 // This is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
@@ -1550,7 +1636,7 @@ bool AppInitMain()
                         }
                     }
 
-                    if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview.get(), gArgs.GetArg("-checklevel", DEFAULT_CHECKLEVEL),
+                    if (!CVerifyDB().VerifyDB(chainparams, pcoinsflusher.get(), gArgs.GetArg("-checklevel", DEFAULT_CHECKLEVEL),
                                   gArgs.GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
                         strLoadError = _("Corrupted block database detected.");
                         break;
@@ -1607,6 +1693,9 @@ bool AppInitMain()
     // Load the mainchain block hash cache from disk
     LoadMainBlockCache();
 
+    // Load the local index of mainchain block commitments from disk
+    LoadMainBlockCommitIndex();
+
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
     if (!OpenWallets())
@@ -1695,6 +1784,12 @@ bool AppInitMain()
         }
     }
 
+    // Follow the mainchain for the headers that were synced and keep the
+    // connection status up to date for block validation. Optionally keep a
+    // queue of new deposits from the mainchain ready for block creation.
+    const bool fDepositPrefetch = gArgs.GetBoolArg("-depositprefetch", DEFAULT_DEPOSIT_PREFETCH);
+    threadGroup.create_thread(boost::bind(&TraceThread<std::function<void()> >, "mainchain", std::function<void()>(std::bind(&ThreadMainchainSync, fDepositPrefetch))));
+
     // ********************************************************* Step 11: start node
 
     int chain_active_height;
@@ -1729,6 +1824,8 @@ bool AppInitMain()
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
     connOptions.m_added_nodes = gArgs.GetArgs("-addnode");
+    connOptions.m_use_epoll = fSocketEventsEpoll;
+    connOptions.nMessageHandlerThreads = std::max(1, std::min<int>(gArgs.GetArg("-msghandthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
@@ -5,7 +5,9 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include <arenamap.h>
 #include <indirectmap.h>
+#include <prevector.h>
 
 #include <stdlib.h>
 
@@ -130,6 +132,14 @@ static inline size_t IncrementalDynamicUsage(const indirectmap<X, Y>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X*, Y> >));
 }
 
+// arenamap keeps its entries in a few large allocations
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const arenamap<X, Y, Z>& m)
+{
+    return m.allocated_usage(MallocUsage);
+}
+
 template<typename X>
 static inline size_t DynamicUsage(const std::unique_ptr<X>& p)
 {
@@ -303,31 +303,37 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         hashLastDeposit = lastDeposit.dtx.GetHash();
         nBurnIndex = lastDeposit.nBurnIndex;
     }
-    vDeposit = client.UpdateDeposits(hashLastDeposit, nBurnIndex);
-
-    // Find new deposits
-    std::vector<SidechainDeposit> vDepositNew;
-    for (const SidechainDeposit& d: vDeposit) {
-        // We look up the deposit using the hash of the deposit without the
-        // payout amount set because we do not know the payout amount yet.
-        if (!psidechaintree->HaveDepositNonAmount(d.GetID())) {
-            vDepositNew.push_back(d);
+
+    // Take the deposits from the pending deposit queue if it is up to date
+    // with the mainchain tip. They have already been de-duplicated and sorted
+    // into CTIP UTXO spend order by UpdateDepositCache.
+    std::vector<SidechainDeposit> vDepositSorted;
+    if (!bmmCache.GetPendingDeposits(bmmCache.GetLastMainBlockHash(), hashLastDeposit, nBurnIndex, vDepositSorted)) {
+        vDeposit = client.UpdateDeposits(hashLastDeposit, nBurnIndex);
+
+        // Find new deposits
+        std::vector<SidechainDeposit> vDepositNew;
+        for (const SidechainDeposit& d: vDeposit) {
+            // We look up the deposit using the hash of the deposit without the
+            // payout amount set because we do not know the payout amount yet.
+            if (!psidechaintree->HaveDepositNonAmount(d.GetID())) {
+                vDepositNew.push_back(d);
+            }
         }
-    }
 
-    // Check deposit burn index
-    for (const SidechainDeposit& d : vDepositNew) {
-        if (d.nBurnIndex >= d.dtx.vout.size()) {
-            LogPrintf("%s: Error: new deposit has invalid burn index:\n%s\n", __func__, d.ToString());
-            return nullptr;
+        // Check deposit burn index
+        for (const SidechainDeposit& d : vDepositNew) {
+            if (d.nBurnIndex >= d.dtx.vout.size()) {
+                LogPrintf("%s: Error: new deposit has invalid burn index:\n%s\n", __func__, d.ToString());
+                return nullptr;
+            }
         }
-    }
 
-    // Sort the deposits into CTIP UTXO spend order
-    std::vector<SidechainDeposit> vDepositSorted;
-    if (!SortDeposits(vDepositNew, vDepositSorted)) {
-        LogPrintf("%s: Error: Failed to sort deposits!\n", __func__);
-        return nullptr;
+        // Sort the deposits into CTIP UTXO spend order
+        if (!SortDeposits(vDepositNew, vDepositSorted)) {
+            LogPrintf("%s: Error: Failed to sort deposits!\n", __func__);
+            return nullptr;
+        }
     }
 
     // Create deposit payout output(s)
@@ -499,6 +505,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
     pblocktemplate->vTxFees[0] = -nFees;
 
+    // Build the merkle tree once, changes to the coinbase from here on only
+    // need to rehash its path to the root
+    pblocktemplate->merkleTree = BlockMerkleTree(*pblock);
+    pblock->hashMerkleRoot = pblocktemplate->merkleTree.GetRoot();
+
     LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
 
     // Fill in header
@@ -828,7 +839,7 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
-void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce, CBlockMerkleTree* pmerkleTree)
 {
     // Update nExtraNonce
     static uint256 hashPrevBlock;
@@ -844,7 +855,12 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    if (pmerkleTree && pmerkleTree->GetLeafCount() == pblock->vtx.size()) {
+        pmerkleTree->UpdateFirstLeaf(pblock->vtx[0]->GetHash());
+        pblock->hashMerkleRoot = pmerkleTree->GetRoot();
+    } else {
+        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    }
 }
 
 bool BlockAssembler::GenerateBMMBlock(CBlock& block, std::string& strError, CAmount* nFeesOut, const std::vector<CMutableTransaction>& vtx, const uint256& hashPrevBlock, const CScript& scriptPubKey)
@@ -886,6 +902,8 @@ bool BlockAssembler::GenerateBMMBlock(CBlock& block, std::string& strError, CAmo
         return false;
     }
 
+    CBlock *pblock = &pblocktemplate->block;
+
     // If an optional vector of transactions was passed in, we replace all
     // but the coinbase with them.
     if (vtx.size()) {
@@ -893,14 +911,14 @@ bool BlockAssembler::GenerateBMMBlock(CBlock& block, std::string& strError, CAmo
         pblock->vtx.resize(1);
         for (const CMutableTransaction& m : vtx)
             pblock->vtx.push_back(MakeTransactionRef(m));
+        pblocktemplate->merkleTree = BlockMerkleTree(*pblock);
     }
 
     unsigned int nExtraNonce = 0;
-    CBlock *pblock = &pblocktemplate->block;
     CBlockIndex* prevBlock = mapBlockIndex[pblock->hashPrevBlock];
     {
         LOCK(cs_main);
-        IncrementExtraNonce(pblock, prevBlock, nExtraNonce);
+        IncrementExtraNonce(pblock, prevBlock, nExtraNonce, &pblocktemplate->merkleTree);
     }
 
     block = *pblock;
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include <consensus/merkle.h>
 #include <primitives/block.h>
 #include <txmempool.h>
 
@@ -28,6 +29,8 @@ struct CBlockTemplate
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOpsCost;
     std::vector<unsigned char> vchCoinbaseCommitment;
+    // Merkle tree of the block, to rehash only the coinbase path when it changes
+    CBlockMerkleTree merkleTree;
 };
 
 // Container for tracking updates to ancestor feerate as we include (parent)
@@ -209,7 +212,7 @@ private:
 };
 
 /** Modify the extranonce in a block */
-void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce, CBlockMerkleTree* pmerkleTree = nullptr);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
 bool CreateDepositTx(CMutableTransaction& depositTx);
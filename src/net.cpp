@@ -24,6 +24,12 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #endif
 
 #ifdef USE_UPNP
@@ -36,6 +42,9 @@
 
 #include <math.h>
 
+// Most buffers handed to the kernel in one send call, two per message
+static const int MAX_SEND_IOVECS = 64;
+
 // Dump addresses to peers.dat and banlist.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
 
@@ -737,6 +746,14 @@ void CNode::copyStats(CNodeStats &stats)
 }
 #undef X
 
+char* CNode::GetRecvBuffer(size_t nMinSize, size_t& nSize)
+{
+    LOCK(cs_vRecv);
+    if (vRecvMsg.empty() || vRecvMsg.back().complete())
+        return nullptr;
+    return vRecvMsg.back().GetDataBuffer(nMinSize, nSize);
+}
+
 bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete)
 {
     complete = false;
@@ -816,6 +833,51 @@ int CNode::GetSendVersion() const
 }
 
 
+void CNetMessageBuffer::Reserve(size_t nCapacityIn, size_t nKeep)
+{
+    if (nCapacityIn <= nCapacity)
+        return;
+    std::unique_ptr<char[]> pdataNew(new char[nCapacityIn]);
+    memcpy(pdataNew.get(), pdata.get(), nKeep);
+    pdata = std::move(pdataNew);
+    nCapacity = nCapacityIn;
+}
+
+std::shared_ptr<CNetMessageBuffer> CNetMessageBufferPool::Get(size_t nSize, size_t nMaxAlloc)
+{
+    std::unique_ptr<CNetMessageBuffer> buffer;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        auto itBest = vFree.end();
+        for (auto it = vFree.begin(); it != vFree.end(); ++it) {
+            if ((*it)->capacity() >= nSize && (itBest == vFree.end() || (*it)->capacity() < (*itBest)->capacity()))
+                itBest = it;
+        }
+        if (itBest != vFree.end()) {
+            buffer = std::move(*itBest);
+            *itBest = std::move(vFree.back());
+            vFree.pop_back();
+            nFreeBytes -= buffer->capacity();
+        }
+    }
+    if (!buffer)
+        buffer.reset(new CNetMessageBuffer(std::min(nSize, nMaxAlloc)));
+    return std::shared_ptr<CNetMessageBuffer>(buffer.release(), [this](CNetMessageBuffer* p) { Release(p); });
+}
+
+void CNetMessageBufferPool::Release(CNetMessageBuffer* buffer)
+{
+    std::unique_ptr<CNetMessageBuffer> owned(buffer);
+    std::lock_guard<std::mutex> lock(cs);
+    if (vFree.size() < MAX_POOLED_BUFFERS && nFreeBytes + buffer->capacity() <= MAX_POOLED_BYTES) {
+        nFreeBytes += buffer->capacity();
+        vFree.push_back(std::move(owned));
+    }
+}
+
+// Never destroyed, buffers may be released after the static destructors have run
+static CNetMessageBufferPool& recvBufferPool = *new CNetMessageBufferPool();
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -847,18 +909,43 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+void CNetMessage::ReservePayload(unsigned int nPos)
+{
+    // Allocate up to 256 KiB ahead, but never more than the total message
+    // size, so that a peer can't make us allocate memory it doesn't send.
+    // Grow geometrically from there, large messages are copied a constant
+    // number of times on average instead of once every 256 KiB.
+    size_t nAlloc = std::min<size_t>(hdr.nMessageSize, nPos + 256 * 1024);
+    if (!payload) {
+        payload = recvBufferPool.Get(hdr.nMessageSize, nAlloc);
+    } else if (payload->capacity() < nPos) {
+        nAlloc = std::min<size_t>(hdr.nMessageSize, std::max(nAlloc, 2 * payload->capacity()));
+        payload->Reserve(nAlloc, nDataPos);
+    }
+}
+
+char* CNetMessage::GetDataBuffer(size_t nMinSize, size_t& nSize)
+{
+    if (!in_data || hdr.nMessageSize - nDataPos < nMinSize)
+        return nullptr;
+    ReservePayload(nDataPos + nMinSize);
+    nSize = std::min<size_t>(payload->capacity(), hdr.nMessageSize) - nDataPos;
+    return payload->data() + nDataPos;
+}
+
 int CNetMessage::readData(const char *pch, unsigned int nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
+    if (nCopy == 0)
+        return 0;
+    ReservePayload(nDataPos + nCopy);
 
-    hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Skip the copy if the data was received in place
+    char* pchData = payload->data() + nDataPos;
+    if (pch != pchData)
+        memcpy(pchData, pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -867,8 +954,9 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
+    // Hashing the whole payload at once lets SHA256 run over it in one go
     if (data_hash.IsNull())
-        hasher.Finalize(data_hash.begin());
+        CHash256().Write((const unsigned char*)(payload ? payload->data() : nullptr), nDataPos).Finalize(data_hash.begin());
     return data_hash;
 }
 
@@ -880,6 +968,44 @@ const uint256& CNetMessage::GetMessageHash() const
 
 
 
+/**
+ * Send the messages in [it, end) with a single call, starting nOffset bytes
+ * into the first one. Sets nQueued to the number of bytes that were handed
+ * to the socket and returns what send() would.
+ */
+static int SendQueuedMessages(SOCKET hSocket, std::deque<CQueuedNetMsg>::const_iterator it, std::deque<CQueuedNetMsg>::const_iterator end, size_t nOffset, size_t& nQueued)
+{
+#ifdef WIN32
+    // Just the header or payload that is in progress
+    const unsigned char* pch = nOffset < sizeof(it->header) ? it->header + nOffset : it->data.data() + nOffset - sizeof(it->header);
+    nQueued = nOffset < sizeof(it->header) ? sizeof(it->header) - nOffset : it->size() - nOffset;
+    return send(hSocket, reinterpret_cast<const char*>(pch), nQueued, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    struct iovec iov[MAX_SEND_IOVECS];
+    int nIov = 0;
+    nQueued = 0;
+    for (; it != end && nIov + 2 <= MAX_SEND_IOVECS; ++it) {
+        if (nOffset < sizeof(it->header)) {
+            iov[nIov].iov_base = const_cast<unsigned char*>(it->header + nOffset);
+            iov[nIov].iov_len = sizeof(it->header) - nOffset;
+            nQueued += iov[nIov++].iov_len;
+            nOffset = sizeof(it->header);
+        }
+        if (nOffset < it->size()) {
+            iov[nIov].iov_base = const_cast<unsigned char*>(it->data.data() + nOffset - sizeof(it->header));
+            iov[nIov].iov_len = it->size() - nOffset;
+            nQueued += iov[nIov++].iov_len;
+        }
+        nOffset = 0;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nIov;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const
 {
@@ -887,27 +1013,36 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert(it->size() > pnode->nSendOffset);
         int nBytes = 0;
+        size_t nQueued = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            nBytes = SendQueuedMessages(pnode->hSocket, it, pnode->vSendMsg.end(), pnode->nSendOffset, nQueued);
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the messages that went out completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nMessageLeft = it->size() - pnode->nSendOffset;
+                if (nLeft < nMessageLeft) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nMessageLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= it->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nQueued) {
+                // could not send everything; stop sending more
+                pnode->fSocketSendReady = false;
                 break;
             }
         } else {
@@ -921,6 +1056,7 @@ size_t CConnman::SocketSendData(CNode *pnode) const
                 }
             }
             // couldn't send anything at all
+            pnode->fSocketSendReady = false;
             break;
         }
     }
@@ -1106,7 +1242,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!m_use_epoll && !IsSelectableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1151,6 +1287,268 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+bool CConnman::GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        recv_set.insert(hListenSocket.socket);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+        {
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            // Sockets past FD_SETSIZE are only created where epoll could have been used
+            if (!IsSelectableSocket(pnode->hSocket)) {
+                LogPrint(BCLog::NET, "disconnecting peer=%d: socket can't be used with select()\n", pnode->GetId());
+                pnode->fDisconnect = true;
+                continue;
+            }
+
+            error_set.insert(pnode->hSocket);
+            if (select_send) {
+                send_set.insert(pnode->hSocket);
+                continue;
+            }
+            if (select_recv) {
+                recv_set.insert(pnode->hSocket);
+            }
+        }
+    }
+
+    return !recv_set.empty() || !send_set.empty() || !error_set.empty();
+}
+
+void CConnman::SocketEventsSelect(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
+        interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_EVENTS_TIMEOUT));
+        return;
+    }
+
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = SOCKET_EVENTS_TIMEOUT * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    for (SOCKET hSocket : recv_select_set) {
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+
+    for (SOCKET hSocket : send_select_set) {
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+
+    for (SOCKET hSocket : error_select_set) {
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+
+    int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        int nErr = WSAGetLastError();
+        LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        for (unsigned int i = 0; i <= hSocketMax; i++)
+            FD_SET(i, &fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_EVENTS_TIMEOUT)))
+            return;
+    }
+
+    for (SOCKET hSocket : recv_select_set) {
+        if (FD_ISSET(hSocket, &fdsetRecv)) {
+            recv_set.insert(hSocket);
+        }
+    }
+
+    for (SOCKET hSocket : send_select_set) {
+        if (FD_ISSET(hSocket, &fdsetSend)) {
+            send_set.insert(hSocket);
+        }
+    }
+
+    for (SOCKET hSocket : error_select_set) {
+        if (FD_ISSET(hSocket, &fdsetError)) {
+            error_set.insert(hSocket);
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+bool CConnman::StartSocketEventsEpoll()
+{
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1) {
+        LogPrintf("epoll_create1 failed: %s\n", NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+    wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupfd == -1) {
+        LogPrintf("eventfd failed: %s\n", NetworkErrorString(WSAGetLastError()));
+        StopSocketEventsEpoll();
+        return false;
+    }
+
+    // The listening sockets and the eventfd are level triggered, so a
+    // connection that isn't accepted right away is reported again
+    std::vector<int> vfd{wakeupfd};
+    for (const ListenSocket& hListenSocket : vhListenSocket)
+        vfd.push_back(hListenSocket.socket);
+    for (int fd : vfd) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            LogPrintf("epoll_ctl failed: %s\n", NetworkErrorString(WSAGetLastError()));
+            StopSocketEventsEpoll();
+            return false;
+        }
+    }
+    fSocketHandlerWake = false;
+    return true;
+}
+
+void CConnman::StopSocketEventsEpoll()
+{
+    if (wakeupfd != -1)
+        close(wakeupfd);
+    if (epollfd != -1)
+        close(epollfd);
+    wakeupfd = -1;
+    epollfd = -1;
+}
+
+void CConnman::SocketEventsEpoll(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    // Only the sockets with events are returned, which for idle peers is none
+    struct epoll_event events[256];
+    int nEvents = epoll_wait(epollfd, events, ARRAYLEN(events), SOCKET_EVENTS_TIMEOUT);
+    if (interruptNet)
+        return;
+    if (nEvents == -1) {
+        int nErr = WSAGetLastError();
+        if (nErr != EINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_EVENTS_TIMEOUT));
+        }
+        nEvents = 0;
+    }
+
+    std::map<SOCKET, uint32_t> mapEvents;
+    for (int i = 0; i < nEvents; i++) {
+        if (events[i].data.fd == wakeupfd) {
+            uint64_t nCount;
+            fSocketHandlerWake = false;
+            while (read(wakeupfd, &nCount, sizeof(nCount)) == sizeof(nCount)) {}
+            continue;
+        }
+        mapEvents[events[i].data.fd] |= events[i].events;
+    }
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (mapEvents.count(hListenSocket.socket))
+            recv_set.insert(hListenSocket.socket);
+    }
+
+    // Sockets of new nodes are added here, closed ones leave the epoll set
+    // by themselves. The choice between sending and receiving is the same as
+    // in GenerateSelectSet, made from the remembered readiness.
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes)
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+
+        uint32_t nNodeEvents = 0;
+        if (!pnode->fSocketRegistered) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.fd = pnode->hSocket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+                LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->GetId(), NetworkErrorString(WSAGetLastError()));
+                pnode->fDisconnect = true;
+                continue;
+            }
+            pnode->fSocketRegistered = true;
+            // Events from before the registration are lost, try both
+            nNodeEvents = EPOLLIN | EPOLLOUT;
+        } else {
+            std::map<SOCKET, uint32_t>::const_iterator it = mapEvents.find(pnode->hSocket);
+            if (it != mapEvents.end())
+                nNodeEvents = it->second;
+        }
+
+        if (nNodeEvents & (EPOLLERR | EPOLLHUP))
+            error_set.insert(pnode->hSocket);
+        if (nNodeEvents & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+            pnode->fSocketRecvReady = true;
+
+        bool select_send;
+        {
+            LOCK(pnode->cs_vSend);
+            if (nNodeEvents & EPOLLOUT)
+                pnode->fSocketSendReady = true;
+            select_send = !pnode->vSendMsg.empty();
+            if (select_send && pnode->fSocketSendReady)
+                send_set.insert(pnode->hSocket);
+        }
+        if (!select_send && !pnode->fPauseRecv && pnode->fSocketRecvReady)
+            recv_set.insert(pnode->hSocket);
+    }
+}
+#endif
+
+void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+#ifdef USE_EPOLL
+    if (m_use_epoll) {
+        SocketEventsEpoll(recv_set, send_set, error_set);
+        return;
+    }
+#endif
+    SocketEventsSelect(recv_set, send_set, error_set);
+}
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1217,94 +1615,17 @@ void CConnman::ThreadSocketHandler()
                 clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet)
-            return;
+        std::set<SOCKET> recv_set, send_set, error_set;
+        SocketEvents(recv_set, send_set, error_set);
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
+        if (interruptNet) return;
 
         //
         // Accept new connections
         //
         for (const ListenSocket& hListenSocket : vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1335,25 +1656,37 @@ void CConnman::ThreadSocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                recvSet = recv_set.count(pnode->hSocket) > 0;
+                sendSet = send_set.count(pnode->hSocket) > 0;
+                errorSet = error_set.count(pnode->hSocket) > 0;
             }
             if (recvSet || errorSet)
             {
                 // typical socket buffer is 8K-64K
                 char pchBuf[0x10000];
+                // Large payloads are received right into the buffer of
+                // their message, only the rest goes through pchBuf
+                size_t nRecvSize = 0;
+                char* pchRecv = pnode->GetRecvBuffer(sizeof(pchBuf), nRecvSize);
+                if (!pchRecv) {
+                    pchRecv = pchBuf;
+                    nRecvSize = sizeof(pchBuf);
+                }
                 int nBytes = 0;
                 {
                     LOCK(pnode->cs_hSocket);
                     if (pnode->hSocket == INVALID_SOCKET)
                         continue;
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                    nBytes = recv(pnode->hSocket, pchRecv, nRecvSize, MSG_DONTWAIT);
                 }
+                // Less than a buffer full means the socket was drained, epoll
+                // reports any data that arrives after this
+                if (nBytes < (int)nRecvSize)
+                    pnode->fSocketRecvReady = false;
                 if (nBytes > 0)
                 {
                     bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+                    if (!pnode->ReceiveMsgBytes(pchRecv, nBytes, notify))
                         pnode->CloseSocketDisconnect();
                     RecordBytesRecv(nBytes);
                     if (notify) {
@@ -1362,7 +1695,7 @@ void CConnman::ThreadSocketHandler()
                         for (; it != pnode->vRecvMsg.end(); ++it) {
                             if (!it->complete())
                                 break;
-                            nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                            nSizeAdded += it->hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
                         }
                         {
                             LOCK(pnode->cs_vProcessMsg);
@@ -1447,13 +1780,39 @@ void CConnman::ThreadSocketHandler()
     }
 }
 
+void CConnman::WakeSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (wakeupfd != -1 && !fSocketHandlerWake.exchange(true)) {
+        uint64_t nCount = 1;
+        if (write(wakeupfd, &nCount, sizeof(nCount)) != sizeof(nCount))
+            LogPrint(BCLog::NET, "failed to wake up the network thread\n");
+    }
+#endif
+}
+
 void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        nMsgProcWake++;
+        nMsgProcWakeValidation++;
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
+}
+
+void CConnman::WakeMessageHandler(bool fValidation)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutexMsgProc);
+        if (fValidation)
+            nMsgProcWakeValidation++;
+        else
+            nMsgProcWake++;
+    }
+    // The other threads wake up to find their wake counter unchanged and go
+    // straight back to waiting, without a pass over the nodes
+    condMsgProc.notify_all();
 }
 
 
@@ -2005,8 +2364,28 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     }
 }
 
-void CConnman::ThreadMessageHandler()
+//! Whether the next thing to do for pnode is processing a message for the validation thread
+static bool NextMessageIsValidation(CNode* pnode)
+{
+    // Outstanding getdata requests are answered before any other message
+    if (!pnode->vRecvGetData.empty())
+        return false;
+    LOCK(pnode->cs_vProcessMsg);
+    return !pnode->vProcessMsg.empty() && IsValidationMessageType(pnode->vProcessMsg.front().hdr.GetCommand());
+}
+
+//! Whether the next thing to do for pnode is for the other kind of message handler thread
+static bool HasWorkForOtherThread(CNode* pnode, bool fValidation)
 {
+    if (!pnode->vRecvGetData.empty())
+        return fValidation;
+    LOCK(pnode->cs_vProcessMsg);
+    return !pnode->vProcessMsg.empty() && IsValidationMessageType(pnode->vProcessMsg.front().hdr.GetCommand()) != fValidation;
+}
+
+void CConnman::ThreadMessageHandler(bool fValidation)
+{
+    uint64_t nWakeSeen = 0;
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
@@ -2019,23 +2398,40 @@ void CConnman::ThreadMessageHandler()
         }
 
         bool fMoreWork = false;
+        bool fWakeOther = false;
 
         for (CNode* pnode : vNodesCopy)
         {
             if (pnode->fDisconnect)
                 continue;
 
+            // Leave the node to the thread that is handling it, which will
+            // notice any further messages
+            if (pnode->fMessageHandlerBusy.exchange(true))
+                continue;
+
             // Receive messages
-            bool fMoreNodeWork = m_msgproc->ProcessMessages(pnode, flagInterruptMsgProc);
-            fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
-            if (flagInterruptMsgProc)
+            if (NextMessageIsValidation(pnode) == fValidation) {
+                const bool fPauseRecv = pnode->fPauseRecv;
+                bool fMoreNodeWork = m_msgproc->ProcessMessages(pnode, flagInterruptMsgProc);
+                // epoll won't report data that was already waiting in the socket
+                if (fPauseRecv && !pnode->fPauseRecv)
+                    WakeSocketHandler();
+                fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
+            }
+            if (flagInterruptMsgProc) {
+                pnode->fMessageHandlerBusy = false;
                 return;
+            }
             // Send messages
-            {
+            if (!fValidation) {
                 LOCK(pnode->cs_sendProcessing);
                 m_msgproc->SendMessages(pnode, flagInterruptMsgProc);
             }
 
+            // The other threads skipped the node while it was busy
+            fWakeOther |= HasWorkForOtherThread(pnode, fValidation);
+            pnode->fMessageHandlerBusy = false;
             if (flagInterruptMsgProc)
                 return;
         }
@@ -2046,11 +2442,15 @@ void CConnman::ThreadMessageHandler()
                 pnode->Release();
         }
 
+        if (fWakeOther)
+            WakeMessageHandler(!fValidation);
+
         std::unique_lock<std::mutex> lock(mutexMsgProc);
+        uint64_t& nWake = fValidation ? nMsgProcWakeValidation : nMsgProcWake;
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [&nWake, nWakeSeen] { return nWake != nWakeSeen; });
         }
-        fMsgProcWake = false;
+        nWakeSeen = nWake;
     }
 }
 
@@ -2343,9 +2743,18 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        nMsgProcWake = 0;
+        nMsgProcWakeValidation = 0;
     }
 
+#ifdef USE_EPOLL
+    if (m_use_epoll && !StartSocketEventsEpoll()) {
+        LogPrintf("Waiting for socket events with select() instead of epoll\n");
+        m_use_epoll = false;
+    }
+#endif
+    LogPrint(BCLog::NET, "Waiting for socket events with %s\n", m_use_epoll ? "epoll" : "select()");
+
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
@@ -2369,7 +2778,14 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msgval", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, true)));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        vThreadMessageHandler.emplace_back([this, i] {
+            const std::string strName = strprintf("msghand.%i", i);
+            TraceThread(strName.c_str(), std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, false)));
+        });
+    }
+    LogPrintf("Using %d message handler threads and a validation thread\n", nMessageHandlerThreads);
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2420,6 +2836,9 @@ void CConnman::Stop()
 {
     if (threadMessageHandler.joinable())
         threadMessageHandler.join();
+    for (std::thread& thread : vThreadMessageHandler)
+        thread.join();
+    vThreadMessageHandler.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2428,6 +2847,9 @@ void CConnman::Stop()
         threadDNSAddressSeed.join();
     if (threadSocketHandler.joinable())
         threadSocketHandler.join();
+#ifdef USE_EPOLL
+    StopSocketEventsEpoll();
+#endif
 
     if (fAddressesInitialized)
     {
@@ -2754,6 +3176,10 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fSocketRegistered = false;
+    fSocketRecvReady = false;
+    fSocketSendReady = false;
+    fMessageHandlerBusy = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes())
@@ -2817,15 +3243,17 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
 
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
+    CQueuedNetMsg queued;
     uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
-    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
-
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    memcpy(queued.header, hdr.pchMessageStart, CMessageHeader::MESSAGE_START_SIZE);
+    memcpy(queued.header + CMessageHeader::MESSAGE_START_SIZE, hdr.pchCommand, CMessageHeader::COMMAND_SIZE);
+    WriteLE32(queued.header + CMessageHeader::MESSAGE_SIZE_OFFSET, hdr.nMessageSize);
+    memcpy(queued.header + CMessageHeader::CHECKSUM_OFFSET, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    queued.data = std::move(msg.data);
 
     size_t nBytesSent = 0;
+    bool fWakeSocketHandler = false;
     {
         LOCK(pnode->cs_vSend);
         bool optimisticSend(pnode->vSendMsg.empty());
@@ -2836,16 +3264,19 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(std::move(queued));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
             nBytesSent = SocketSendData(pnode);
+        else
+            fWakeSocketHandler = pnode->fSocketSendReady;
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
+    // The socket can take more data, the network thread may not know there is some
+    if (fWakeSocketHandler)
+        WakeSocketHandler();
 }
 
 bool CConnman::ForNode(NodeId id, std::function<bool(CNode* pnode)> func)
@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <mutex>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -76,6 +77,19 @@ static const uint64_t MAX_UPLOAD_TIMEFRAME = 60 * 60 * 24;
 /** Default for blocks only*/
 static const bool DEFAULT_BLOCKSONLY = false;
 
+/** -socketevents default, how the network thread waits for sockets to become ready */
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+/** -msghandthreads default, the number of threads processing messages besides the validation thread */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 2;
+/** Maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
+/** Longest time the network thread waits for socket events before it checks on the nodes again (in milliseconds) */
+static const int SOCKET_EVENTS_TIMEOUT = 50;
+
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
@@ -109,6 +123,15 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/** Message in the send queue of a peer, the header is kept inline so it doesn't need an allocation of its own */
+struct CQueuedNetMsg
+{
+    unsigned char header[CMessageHeader::HEADER_SIZE];
+    std::vector<unsigned char> data;
+
+    size_t size() const { return sizeof(header) + data.size(); }
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -141,6 +164,8 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        bool m_use_epoll = false;
+        int nMessageHandlerThreads = 1;
     };
 
     void Init(const Options& connOptions) {
@@ -160,6 +185,8 @@ public:
             nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
         }
         vWhitelistedRange = connOptions.vWhitelistedRange;
+        m_use_epoll = connOptions.m_use_epoll;
+        nMessageHandlerThreads = std::max(connOptions.nMessageHandlerThreads, 1);
         {
             LOCK(cs_vAddedNodes);
             vAddedNodes = connOptions.m_added_nodes;
@@ -310,6 +337,10 @@ public:
     unsigned int GetReceiveFloodSize() const;
 
     void WakeMessageHandler();
+    //! Wake only the validation message handler thread or only the others
+    void WakeMessageHandler(bool fValidation);
+    //! Interrupt the network thread's wait for socket events, epoll only
+    void WakeSocketHandler();
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -325,8 +356,24 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    /**
+     * Process and send the messages of the nodes. Every node is handled by
+     * one thread at a time, which keeps its messages in order. The validation
+     * thread takes the messages that can change the chainstate or mempool,
+     * the other threads everything else, so a block being connected doesn't
+     * hold up the responses to other peers.
+     */
+    void ThreadMessageHandler(bool fValidation);
     void AcceptConnection(const ListenSocket& hListenSocket);
+    bool GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+    void SocketEventsSelect(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#ifdef USE_EPOLL
+    bool StartSocketEventsEpoll();
+    void StopSocketEventsEpoll();
+    void SocketEventsEpoll(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#endif
+    //! Wait for socket events, collecting the sockets that can be read from, written to or have an error
+    void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -414,13 +461,23 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** number of times the message handler threads were woken up */
+    uint64_t nMsgProcWake;
+    /** number of times the validation message handler thread was woken up */
+    uint64_t nMsgProcWakeValidation;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc;
 
+    /** Wait for socket events with epoll instead of select() */
+    bool m_use_epoll;
+    //! The epoll instance, and the eventfd that wakes it up
+    int epollfd = -1;
+    int wakeupfd = -1;
+    //! Set when the eventfd has been written to and not read from yet
+    std::atomic_bool fSocketHandlerWake{false};
+
     CThreadInterrupt interruptNet;
 
     std::thread threadDNSAddressSeed;
@@ -428,6 +485,8 @@ private:
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
     std::thread threadMessageHandler;
+    std::vector<std::thread> vThreadMessageHandler;
+    int nMessageHandlerThreads;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -551,10 +610,60 @@ public:
 
 
 
+/** Memory for the payload of a received message */
+class CNetMessageBuffer
+{
+public:
+    explicit CNetMessageBuffer(size_t nCapacityIn) : pdata(new char[nCapacityIn]), nCapacity(nCapacityIn) {}
+
+    char* data() { return pdata.get(); }
+    const char* data() const { return pdata.get(); }
+    size_t capacity() const { return nCapacity; }
+
+    //! Make room for at least nCapacityIn bytes, keeping the first nKeep
+    void Reserve(size_t nCapacityIn, size_t nKeep);
+
+private:
+    std::unique_ptr<char[]> pdata;
+    size_t nCapacity;
+};
+
+/**
+ * Hands out the payload buffers of received messages and takes them back
+ * when the last reference is gone, so the memory for large messages like
+ * blocks isn't allocated again for every message.
+ */
+class CNetMessageBufferPool
+{
+public:
+    //! Most bytes of buffers kept around for reuse
+    static const size_t MAX_POOLED_BYTES = 8 * 1024 * 1024;
+    //! Most buffers kept around for reuse
+    static const size_t MAX_POOLED_BUFFERS = 64;
+
+    /**
+     * The smallest pooled buffer that can hold nSize bytes. If there is none
+     * a new buffer of min(nSize, nMaxAlloc) bytes is allocated, which the
+     * caller grows as the data comes in.
+     */
+    std::shared_ptr<CNetMessageBuffer> Get(size_t nSize, size_t nMaxAlloc);
+
+private:
+    void Release(CNetMessageBuffer* buffer);
+
+    std::mutex cs;
+    std::vector<std::unique_ptr<CNetMessageBuffer>> vFree;
+    size_t nFreeBytes = 0;
+};
+
 class CNetMessage {
 private:
-    mutable CHash256 hasher;
     mutable uint256 data_hash;
+    //! Received payload, nullptr while the header is incomplete or if the payload is empty
+    std::shared_ptr<CNetMessageBuffer> payload;
+
+    //! Make room for the payload up to nPos, at first no more than 256 KiB ahead of the received data, doubling after
+    void ReservePayload(unsigned int nPos);
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
@@ -562,12 +671,11 @@ public:
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
@@ -584,12 +692,20 @@ public:
 
     const uint256& GetMessageHash() const;
 
-    void SetVersion(int nVersionIn)
+    //! Reader over the payload of the complete message, deserializing right out of the buffer
+    CSpanReader GetReader(int nType, int nVersion) const
     {
-        hdrbuf.SetVersion(nVersionIn);
-        vRecv.SetVersion(nVersionIn);
+        assert(complete());
+        return CSpanReader(nType, nVersion, payload ? payload->data() : nullptr, nDataPos);
     }
 
+    /**
+     * Where the next nSize bytes of the payload go, so the socket handler can
+     * receive them in place. Returns nullptr if there is no payload being
+     * received or less than nMinSize bytes of it.
+     */
+    char* GetDataBuffer(size_t nMinSize, size_t& nSize);
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
 };
@@ -606,7 +722,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CQueuedNetMsg> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -658,6 +774,16 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    /**
+     * Readiness of the socket when epoll is used. Its events are edge
+     * triggered, so they are remembered until a read or write shows the
+     * socket would block.
+     */
+    bool fSocketRegistered; //!< only used by the network thread
+    bool fSocketRecvReady; //!< only used by the network thread
+    bool fSocketSendReady; //!< protected by cs_vSend
+    //! Set while a message handler thread processes or sends this node's messages
+    std::atomic_bool fMessageHandlerBusy;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -668,8 +794,10 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
-    CRollingBloomFilter addrKnown;
+    // Other peers' messages relay addresses to this one, from other threads
+    CCriticalSection cs_vAddrToSend;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(cs_vAddrToSend);
+    CRollingBloomFilter addrKnown GUARDED_BY(cs_vAddrToSend);
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -758,6 +886,8 @@ public:
         return nRefCount;
     }
 
+    //! Buffer in the message being received to recv() into, see CNetMessage::GetDataBuffer
+    char* GetRecvBuffer(size_t nMinSize, size_t& nSize);
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
 
     void SetRecvVersion(int nVersionIn)
@@ -790,6 +920,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -798,6 +929,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
@@ -113,6 +113,7 @@ namespace {
         uint256 hash;
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
+        int64_t nTimeRequested;                                  //!< When the block was requested (in microseconds).
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
@@ -126,6 +127,9 @@ namespace {
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** Moving average of the size of the blocks we requested and received, 0 before the first one. */
+    double dAvgBlockSize = 0;
+
     /** Number of outbound peers with m_chain_sync.m_protect. */
     int g_outbound_peers_with_protect_from_disconnect = 0;
 
@@ -187,6 +191,10 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the rate (in bytes per second) this peer sends us the blocks we request, 0 until it sent one.
+    double dBlockBandwidth;
+    //! When the last block we requested from this peer arrived (in microseconds).
+    int64_t nLastBlockReceived;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -254,6 +262,8 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        dBlockBandwidth = 0;
+        nLastBlockReceived = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -354,7 +364,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, GetTimeMicros(), std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -370,6 +380,36 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     return true;
 }
 
+// Requires cs_main.
+/** Update the download speed of a peer with a block it sent us, if we requested it from that peer */
+void RecordBlockDownload(NodeId nodeid, const uint256& hash, size_t nBytes) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+
+    // With several blocks in flight, a block only starts coming in once the one before it is done
+    const int64_t nNow = GetTimeMicros();
+    const int64_t nStart = std::max(itInFlight->second.second->nTimeRequested, state->nLastBlockReceived);
+    state->nLastBlockReceived = nNow;
+    const double dBandwidth = nBytes * 1000000.0 / std::max<int64_t>(nNow - nStart, 1000);
+    state->dBlockBandwidth = state->dBlockBandwidth == 0 ? dBandwidth : 0.8 * state->dBlockBandwidth + 0.2 * dBandwidth;
+    dAvgBlockSize = dAvgBlockSize == 0 ? nBytes : 0.95 * dAvgBlockSize + 0.05 * nBytes;
+}
+
+// Requires cs_main.
+/** Number of blocks to keep in flight from a peer, see CalculateBlocksInTransitLimit */
+int GetBlocksInTransitLimit(const CNodeState* state, int64_t nPingUsec) {
+    return CalculateBlocksInTransitLimit(state->dBlockBandwidth, dAvgBlockSize, nPingUsec);
+}
+
+// Requires cs_main.
+/** How far beyond the last block we have in common with a peer to download from it */
+int GetBlockDownloadWindow() {
+    return CalculateBlockDownloadWindow(dAvgBlockSize);
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -493,10 +533,10 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
     std::vector<const CBlockIndex*> vToFetch;
     const CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than the download window + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + GetBlockDownloadWindow();
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
@@ -629,6 +669,20 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     return true;
 }
 
+int CalculateBlocksInTransitLimit(double dBandwidth, double dAvgBlockSize, int64_t nPingUsec) {
+    if (dBandwidth == 0 || dAvgBlockSize == 0 || nPingUsec <= 0 || nPingUsec == std::numeric_limits<int64_t>::max())
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    const double dBlockUsec = dAvgBlockSize * 1000000.0 / dBandwidth;
+    const double dBlocks = 2 * nPingUsec / dBlockUsec + 1;
+    return std::max<int>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<double>(dBlocks, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+int CalculateBlockDownloadWindow(double dAvgBlockSize) {
+    if (dAvgBlockSize == 0)
+        return BLOCK_DOWNLOAD_WINDOW;
+    return std::max<int>(BLOCK_DOWNLOAD_WINDOW, std::min<double>(BLOCK_DOWNLOAD_WINDOW_BYTES / dAvgBlockSize, MAX_BLOCK_DOWNLOAD_WINDOW));
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // mapOrphanTransactions
@@ -855,7 +909,7 @@ static uint256 most_recent_block_hash;
 static bool fWitnessesPresentInMostRecentCompactBlock;
 
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
-    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
+    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
 
     LOCK(cs_main);
@@ -876,7 +930,7 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
+    connman->ForEachNode([this, &pblock, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
         // TODO: Avoid the repeated-serialization here
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
@@ -889,7 +943,10 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            if (pnode->nVersion >= DEPOSIT_REFS_VERSION)
+                connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            else
+                connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(*pblock, true)));
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1046,6 +1103,15 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman* connma
     connman->ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+//! A block that was available a moment ago couldn't be read, which is only fine if it has been pruned since
+static void BlockReadFailed(const CBlockIndex* pindex)
+{
+    LOCK(cs_main);
+    if (pindex->nStatus & BLOCK_HAVE_DATA)
+        assert(!"cannot load block from disk");
+    LogPrint(BCLog::NET, "%s: block %s was pruned before it could be sent\n", __func__, pindex->GetBlockHash().ToString());
+}
+
 void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensusParams, const CInv& inv, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     bool send = false;
@@ -1081,110 +1147,139 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
         ActivateBestChain(dummy, Params(), a_recent_block);
     }
 
-    LOCK(cs_main);
-    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-    if (mi != mapBlockIndex.end()) {
-        send = BlockRequestAllowed(mi->second, consensusParams);
-        if (!send) {
-            LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
-        }
-    }
-    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    // disconnect node in case we have reached the outbound limit for serving historical blocks
-    // never disconnect whitelisted nodes
-    if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+    // What to send is decided under cs_main, the block is read from disk and
+    // sent without it so other peers aren't held up by the disk
+    const CBlockIndex* pindex = nullptr;
+    bool fPeerWantsWitness = false;
+    bool fSendCompact = false;
+    uint256 hashTip;
     {
-        LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+        if (mi != mapBlockIndex.end()) {
+            send = BlockRequestAllowed(mi->second, consensusParams);
+            if (!send) {
+                LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+            }
+        }
+        // disconnect node in case we have reached the outbound limit for serving historical blocks
+        // never disconnect whitelisted nodes
+        if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+        {
+            LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
 
-        //disconnect node
-        pfrom->fDisconnect = true;
-        send = false;
-    }
-    // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
-    if (send && !pfrom->fWhitelisted && (
-            (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - mi->second->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
-       )) {
-        LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
+            //disconnect node
+            pfrom->fDisconnect = true;
+            send = false;
+        }
+        // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
+        if (send && !pfrom->fWhitelisted && (
+                (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - mi->second->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
+           )) {
+            LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
 
-        //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
-        pfrom->fDisconnect = true;
-        send = false;
+            //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
+            pfrom->fDisconnect = true;
+            send = false;
+        }
+        // Pruned nodes may have deleted the block, so check whether
+        // it's available before trying to send.
+        if (!send || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+            return;
+
+        pindex = mi->second;
+        if (inv.type == MSG_CMPCT_BLOCK) {
+            fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+            fSendCompact = CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+        }
+        hashTip = chainActive.Tip()->GetBlockHash();
+    } // release cs_main
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    std::shared_ptr<const CBlock> pblock;
+    if (a_recent_block && a_recent_block->GetHash() == pindex->GetBlockHash()) {
+        pblock = a_recent_block;
+    } else if (inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK) {
+        // Send the block's bytes from disk as they are, only dropping the
+        // witnesses if the peer didn't ask for them
+        CSerializedNetMsg msg;
+        msg.command = NetMsgType::BLOCK;
+        if (!ReadRawBlockFromDisk(msg.data, pindex, consensusParams, inv.type == MSG_WITNESS_BLOCK)) {
+            BlockReadFailed(pindex);
+            return;
+        }
+        connman->PushMessage(pfrom, std::move(msg));
+    } else {
+        // Send block from disk
+        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams)) {
+            BlockReadFailed(pindex);
+            return;
+        }
+        pblock = pblockRead;
     }
-    // Pruned nodes may have deleted the block, so check whether
-    // it's available before trying to send.
-    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+    if (!pblock) {
+        // Sent straight from disk above
+    } else if (inv.type == MSG_BLOCK)
+        connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
+    else if (inv.type == MSG_WITNESS_BLOCK)
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
+    else if (inv.type == MSG_FILTERED_BLOCK)
     {
-        std::shared_ptr<const CBlock> pblock;
-        if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
-            pblock = a_recent_block;
-        } else {
-            // Send block from disk
-            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-            if (!ReadBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
-                assert(!"cannot load block from disk");
-            pblock = pblockRead;
-        }
-        if (inv.type == MSG_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
-        else if (inv.type == MSG_WITNESS_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
-        else if (inv.type == MSG_FILTERED_BLOCK)
+        bool sendMerkleBlock = false;
+        CMerkleBlock merkleBlock;
         {
-            bool sendMerkleBlock = false;
-            CMerkleBlock merkleBlock;
-            {
-                LOCK(pfrom->cs_filter);
-                if (pfrom->pfilter) {
-                    sendMerkleBlock = true;
-                    merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
-                }
-            }
-            if (sendMerkleBlock) {
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                // This avoids hurting performance by pointlessly requiring a round-trip
-                // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                // they must either disconnect and retry or request the full block.
-                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                // however we MUST always provide at least what the remote peer needs
-                typedef std::pair<unsigned int, uint256> PairType;
-                for (PairType& pair : merkleBlock.vMatchedTxn)
-                    connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
-            }
-            // else
-                // no response
-        }
-        else if (inv.type == MSG_CMPCT_BLOCK)
-        {
-            // If a peer is asking for old blocks, we're almost guaranteed
-            // they won't have a useful mempool to match against a compact block,
-            // and we don't feel like constructing the object for them, so
-            // instead we respond with the full, non-compact block.
-            bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-            int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-            if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
-                } else {
-                    CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-                }
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter) {
+                sendMerkleBlock = true;
+                merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+            }
+        }
+        if (sendMerkleBlock) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+            // This avoids hurting performance by pointlessly requiring a round-trip
+            // Note that there is currently no way for a node to request any single transactions we didn't send here -
+            // they must either disconnect and retry or request the full block.
+            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+            // however we MUST always provide at least what the remote peer needs
+            typedef std::pair<unsigned int, uint256> PairType;
+            for (PairType& pair : merkleBlock.vMatchedTxn)
+                connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
+        }
+        // else
+            // no response
+    }
+    else if (inv.type == MSG_CMPCT_BLOCK)
+    {
+        // If a peer is asking for old blocks, we're almost guaranteed
+        // they won't have a useful mempool to match against a compact block,
+        // and we don't feel like constructing the object for them, so
+        // instead we respond with the full, non-compact block.
+        int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+        if (fSendCompact) {
+            const bool fPeerWantsDepositRefs = pfrom->nVersion >= DEPOSIT_REFS_VERSION;
+            if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && fPeerWantsDepositRefs && a_recent_compact_block && a_recent_compact_block->header.GetHash() == pindex->GetBlockHash()) {
+                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
             } else {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+                CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness, fPeerWantsDepositRefs);
+                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
             }
+        } else {
+            connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
         }
+    }
 
-        // Trigger the peer node to send a getblocks request for the next batch of inventory
-        if (inv.hash == pfrom->hashContinue)
-        {
-            // Bypass PushInventory, this must send even if redundant,
-            // and we want it right after the last block so they don't
-            // wait for other stuff first.
-            std::vector<CInv> vInv;
-            vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
-            pfrom->hashContinue.SetNull();
-        }
+    // Trigger the peer node to send a getblocks request for the next batch of inventory
+    if (inv.hash == pfrom->hashContinue)
+    {
+        // Bypass PushInventory, this must send even if redundant,
+        // and we want it right after the last block so they don't
+        // wait for other stuff first.
+        std::vector<CInv> vInv;
+        vInv.push_back(CInv(MSG_BLOCK, hashTip));
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
+        pfrom->hashContinue.SetNull();
     }
 }
 
@@ -1417,8 +1512,9 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
         if (fCanDirectFetch && pindexLast->IsValid(BLOCK_VALID_TREE) && chainActive.Tip()->nHeight <= pindexLast->nHeight) {
             std::vector<const CBlockIndex*> vToFetch;
             const CBlockIndex *pindexWalk = pindexLast;
+            const int nBlocksInTransitLimit = GetBlocksInTransitLimit(nodestate, pfrom->nMinPingUsecTime);
             // Calculate all the blocks we'd need to switch to pindexLast, up to a limit.
-            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= (size_t)nBlocksInTransitLimit) {
                 if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
                         !mapBlocksInFlight.count(pindexWalk->GetBlockHash()) &&
                         (!IsWitnessEnabled(pindexWalk->pprev, chainparams.GetConsensus()) || State(pfrom->GetId())->fHaveWitness)) {
@@ -1439,7 +1535,7 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
                 std::vector<CInv> vGetData;
                 // Download as much as possible, from earliest to latest.
                 for (const CBlockIndex *pindex : reverse_iterate(vToFetch)) {
-                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (nodestate->nBlocksInFlight >= nBlocksInTransitLimit) {
                         // Can't download any more from this peer
                         break;
                     }
@@ -1476,7 +1572,7 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     return true;
 }
 
-bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
+bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CSpanReader& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
     if (gArgs.IsArgSet("-dropmessagestest") && GetRand(gArgs.GetArg("-dropmessagestest", 0)) == 0)
@@ -2374,7 +2470,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // We want to be a bit conservative just to be extra careful about DoS
         // possibilities in compact block processing...
         if (pindex->nHeight <= chainActive.Height() + 2) {
-            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < GetBlocksInTransitLimit(nodestate, pfrom->nMinPingUsecTime)) ||
                  (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId())) {
                 std::list<QueuedBlock>::iterator* queuedBlockIt = nullptr;
                 if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), pindex, &queuedBlockIt)) {
@@ -2449,8 +2545,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         } // cs_main
 
-        if (fProcessBLOCKTXN)
-            return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnMsg, nTimeReceived, chainparams, connman, interruptMsgProc);
+        if (fProcessBLOCKTXN) {
+            CSpanReader blockTxnReader(blockTxnMsg.GetType(), blockTxnMsg.GetVersion(), blockTxnMsg.data(), blockTxnMsg.size());
+            return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnReader, nTimeReceived, chainparams, connman, interruptMsgProc);
+        }
 
         if (fRevertToHeaderProcessing) {
             // Headers received from HB compact block peers are permitted to be
@@ -2599,6 +2697,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
+        const size_t nBlockSize = vRecv.size();
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
         vRecv >> *pblock;
 
@@ -2608,6 +2707,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         const uint256 hash(pblock->GetHash());
         {
             LOCK(cs_main);
+            RecordBlockDownload(pfrom->GetId(), hash, nBlockSize);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -2646,7 +2746,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr)
@@ -2701,7 +2804,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     {
         int64_t pingUsecEnd = nTimeReceived;
         uint64_t nonce = 0;
-        size_t nAvail = vRecv.in_avail();
+        size_t nAvail = vRecv.size();
         bool bPingFinished = false;
         std::string sProblem;
 
@@ -2899,13 +3002,12 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
             return false;
         // Just take one message
         msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
-        pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+        pfrom->nProcessQueueSize -= msgs.front().hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
         pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman->GetReceiveFloodSize();
         fMoreWork = !pfrom->vProcessMsg.empty();
     }
     CNetMessage& msg(msgs.front());
 
-    msg.SetVersion(pfrom->GetRecvVersion());
     // Scan for message start
     if (memcmp(msg.hdr.pchMessageStart, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE) != 0) {
         LogPrint(BCLog::NET, "PROCESSMESSAGE: INVALID MESSAGESTART %s peer=%d\n", SanitizeString(msg.hdr.GetCommand()), pfrom->GetId());
@@ -2926,7 +3028,6 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     unsigned int nMessageSize = hdr.nMessageSize;
 
     // Checksum
-    CDataStream& vRecv = msg.vRecv;
     const uint256& hash = msg.GetMessageHash();
     if (memcmp(hash.begin(), hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) != 0)
     {
@@ -2941,6 +3042,7 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     bool fRet = false;
     try
     {
+        CSpanReader vRecv(msg.GetReader(SER_NETWORK, pfrom->GetRecvVersion()));
         fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
         if (interruptMsgProc)
             return false;
@@ -3193,28 +3295,30 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
-            std::vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            for (const CAddress& addr : pto->vAddrToSend)
+            std::vector<std::vector<CAddress>> vvAddr(1);
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                LOCK(pto->cs_vAddrToSend);
+                vvAddr.back().reserve(pto->vAddrToSend.size());
+                for (const CAddress& addr : pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        connman->PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        // receiver rejects addr messages larger than 1000
+                        if (vvAddr.back().size() >= 1000)
+                            vvAddr.emplace_back();
+                        vvAddr.back().push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+                // we only send the big addr message once
+                if (pto->vAddrToSend.capacity() > 40)
+                    pto->vAddrToSend.shrink_to_fit();
+            }
+            for (const std::vector<CAddress>& vAddr : vvAddr) {
+                if (!vAddr.empty())
+                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                connman->PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-            // we only send the big addr message once
-            if (pto->vAddrToSend.capacity() > 40)
-                pto->vAddrToSend.shrink_to_fit();
         }
 
         // Start block sync
@@ -3325,15 +3429,16 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                             vHeaders.front().GetHash().ToString(), pto->GetId());
 
                     int nSendFlags = state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+                    const bool fPeerWantsDepositRefs = pto->nVersion >= DEPOSIT_REFS_VERSION;
 
                     bool fGotBlockFromCache = false;
                     {
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
-                            if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
+                            if ((state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock) && fPeerWantsDepositRefs)
                                 connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
                             else {
-                                CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
+                                CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness, fPeerWantsDepositRefs);
                                 connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                             }
                             fGotBlockFromCache = true;
@@ -3343,7 +3448,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                         CBlock block;
                         bool ret = ReadBlockFromDisk(block, pBestIndex, consensusParams);
                         assert(ret);
-                        CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
+                        CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness, fPeerWantsDepositRefs);
                         connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
                     state.pindexBestHeaderSent = pBestIndex;
@@ -3590,10 +3695,11 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        const int nBlocksInTransitLimit = GetBlocksInTransitLimit(&state, pto->nMinPingUsecTime);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nBlocksInTransitLimit) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), nBlocksInTransitLimit - state.nBlocksInFlight, vToDownload, staller, consensusParams);
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -78,6 +78,25 @@ struct CNodeStateStats {
 
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+
+/**
+ * Number of blocks to keep in flight from a peer with the given block
+ * bandwidth (in bytes per second) and ping time. That is enough blocks to
+ * cover twice the ping time, so a fast peer sending small blocks isn't left
+ * idle waiting for our next getdata, between MIN_BLOCKS_IN_TRANSIT_PER_PEER
+ * and MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER. While the number of blocks in
+ * flight is what limits the bandwidth we measure, the limit grows along with
+ * each new measurement until the peer's link is the limit. Peers that weren't
+ * measured yet get MAX_BLOCKS_IN_TRANSIT_PER_PEER.
+ */
+int CalculateBlocksInTransitLimit(double dBandwidth, double dAvgBlockSize, int64_t nPingUsec);
+
+/**
+ * Size of the block download window for the given average block size: as
+ * many blocks as fit in BLOCK_DOWNLOAD_WINDOW_BYTES, between
+ * BLOCK_DOWNLOAD_WINDOW and MAX_BLOCK_DOWNLOAD_WINDOW.
+ */
+int CalculateBlockDownloadWindow(double dAvgBlockSize);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch, const std::string& message="");
 
@@ -18,6 +18,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <poll.h>
+#endif
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
 
@@ -230,6 +234,28 @@ enum class IntrRecvError {
     Interrupted
 };
 
+/**
+ * Wait until hSocket can be read from, or written to with fWrite, for at most
+ * nTimeout milliseconds. Returns the number of ready sockets or SOCKET_ERROR.
+ * Where epoll is used for the peers, their sockets can be past FD_SETSIZE,
+ * so poll() is used instead of select().
+ */
+static int WaitForSocket(const SOCKET& hSocket, bool fWrite, int64_t nTimeout)
+{
+#ifdef USE_EPOLL
+    struct pollfd pollfd = {};
+    pollfd.fd = hSocket;
+    pollfd.events = fWrite ? POLLOUT : POLLIN;
+    return poll(&pollfd, 1, nTimeout);
+#else
+    struct timeval tval = MillisToTimeval(nTimeout);
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(hSocket, &fdset);
+    return select(hSocket + 1, fWrite ? nullptr : &fdset, fWrite ? &fdset : nullptr, nullptr, &tval);
+#endif
+}
+
 /**
  * Read bytes from socket. This will either read the full number of bytes requested
  * or return False on error or timeout.
@@ -258,14 +284,12 @@ static IntrRecvError InterruptibleRecv(uint8_t* data, size_t len, int timeout, c
         } else { // Other error or blocking
             int nErr = WSAGetLastError();
             if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
+#ifndef USE_EPOLL
                 if (!IsSelectableSocket(hSocket)) {
                     return IntrRecvError::NetworkError;
                 }
-                struct timeval tval = MillisToTimeval(std::min(endTime - curTime, maxWait));
-                fd_set fdset;
-                FD_ZERO(&fdset);
-                FD_SET(hSocket, &fdset);
-                int nRet = select(hSocket + 1, &fdset, nullptr, nullptr, &tval);
+#endif
+                int nRet = WaitForSocket(hSocket, false, std::min(endTime - curTime, maxWait));
                 if (nRet == SOCKET_ERROR) {
                     return IntrRecvError::NetworkError;
                 }
@@ -445,11 +469,13 @@ SOCKET CreateSocket(const CService &addrConnect)
     if (hSocket == INVALID_SOCKET)
         return INVALID_SOCKET;
 
+#ifndef USE_EPOLL
     if (!IsSelectableSocket(hSocket)) {
         CloseSocket(hSocket);
         LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
         return INVALID_SOCKET;
     }
+#endif
 
 #ifdef SO_NOSIGPIPE
     int set = 1;
@@ -486,11 +512,7 @@ bool ConnectSocketDirectly(const CService &addrConnect, const SOCKET& hSocket, i
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
         {
-            struct timeval timeout = MillisToTimeval(nTimeout);
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select(hSocket + 1, nullptr, &fdset, nullptr, &timeout);
+            int nRet = WaitForSocket(hSocket, true, nTimeout);
             if (nRet == 0)
             {
                 LogPrint(BCLog::NET, "connection to %s timeout\n", addrConnect.ToString());
@@ -188,3 +188,12 @@ const std::vector<std::string> &getAllNetMessageTypes()
 {
     return allNetMessageTypesVec;
 }
+
+bool IsValidationMessageType(const std::string& msg_type)
+{
+    return msg_type == NetMsgType::TX ||
+           msg_type == NetMsgType::HEADERS ||
+           msg_type == NetMsgType::BLOCK ||
+           msg_type == NetMsgType::CMPCTBLOCK ||
+           msg_type == NetMsgType::BLOCKTXN;
+}
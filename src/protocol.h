@@ -242,6 +242,13 @@ extern const char *BLOCKTXN;
 /* Get a vector of all valid message types (see above) */
 const std::vector<std::string> &getAllNetMessageTypes();
 
+/**
+ * Whether messages of this type can change the chainstate or the mempool.
+ * They are processed one at a time by the validation thread, all other
+ * messages by the message handler threads.
+ */
+bool IsValidationMessageType(const std::string& msg_type);
+
 /** nServices flags */
 enum ServiceFlags : uint64_t {
     // Nothing
@@ -1569,6 +1569,99 @@ UniValue getchaintxstats(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue getblocktimings(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getblocktimings ( count )\n"
+            "\nReturns where the time went when connecting the most recent blocks to the tip, oldest first.\n"
+            "Timings of the last " + std::to_string(MAX_BLOCK_CONNECT_TIMES) + " blocks are kept, all times are in milliseconds.\n"
+            "\nArguments:\n"
+            "1. count          (numeric, optional) Only return the last count blocks\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"hash\" : \"hash\",        (string) the block hash\n"
+            "    \"height\" : n,           (numeric) the block height\n"
+            "    \"txs\" : n,              (numeric) the number of transactions in the block\n"
+            "    \"time\" : ttt,           (numeric) when the block was connected, in seconds since epoch\n"
+            "    \"total\" : x.xxx,        (numeric) total time to connect the block\n"
+            "    \"read\" : x.xxx,         (numeric) reading the block from disk\n"
+            "    \"check\" : x.xxx,        (numeric) CheckBlock, including mainchain verification\n"
+            "    \"forks\" : x.xxx,        (numeric) BIP30 and fork checks\n"
+            "    \"prefetch\" : x.xxx,     (numeric) fetching the spent coins\n"
+            "    \"connect\" : x.xxx,      (numeric) checking and connecting the transactions\n"
+            "    \"verify\" : x.xxx,       (numeric) waiting for script verification\n"
+            "    \"undo\" : x.xxx,         (numeric) writing undo and transaction index data\n"
+            "    \"journal\" : x.xxx,      (numeric) writing the mainchain verification journal\n"
+            "    \"flush\" : x.xxx,        (numeric) flushing the coins to the tip\n"
+            "    \"chainstate\" : x.xxx,   (numeric) writing the chainstate to disk if needed\n"
+            "    \"postconnect\" : x.xxx,  (numeric) mempool and tip updates\n"
+            "    \"sidechain\" : {\n"
+            "      \"refunds\" : x.xxx,          (numeric) verifying withdrawal refunds\n"
+            "      \"deposits\" : x.xxx,         (numeric) verifying deposit payouts\n"
+            "      \"bundlestatus\" : x.xxx,     (numeric) verifying withdrawal bundle status updates with the mainchain\n"
+            "      \"wait\" : x.xxx,             (numeric) waiting for the sidechain checks after connecting the transactions\n"
+            "      \"bundlebroadcast\" : x.xxx,  (numeric) broadcasting the latest withdrawal bundle to the mainchain\n"
+            "      \"bundlereplicate\" : x.xxx,  (numeric) replicating a new withdrawal bundle\n"
+            "      \"db\" : x.xxx                (numeric) sidechain database updates\n"
+            "    }\n"
+            "  },\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblocktimings", "")
+            + HelpExampleCli("getblocktimings", "10")
+            + HelpExampleRpc("getblocktimings", "10")
+        );
+
+    std::vector<BlockConnectTimes> vTimes = GetBlockConnectTimes();
+
+    size_t nCount = vTimes.size();
+    if (!request.params[0].isNull()) {
+        int count = request.params[0].get_int();
+        if (count <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count: must be positive");
+        nCount = std::min(nCount, (size_t)count);
+    }
+
+    UniValue arr(UniValue::VARR);
+    for (size_t i = vTimes.size() - nCount; i < vTimes.size(); i++) {
+        const BlockConnectTimes& times = vTimes[i];
+
+        UniValue sidechain(UniValue::VOBJ);
+        sidechain.pushKV("refunds", times.nRefunds * 0.001);
+        sidechain.pushKV("deposits", times.nDeposits * 0.001);
+        sidechain.pushKV("bundlestatus", times.nBundleStatus * 0.001);
+        sidechain.pushKV("wait", times.nSidechainWait * 0.001);
+        sidechain.pushKV("bundlebroadcast", times.nBundleBroadcast * 0.001);
+        sidechain.pushKV("bundlereplicate", times.nBundleReplicate * 0.001);
+        sidechain.pushKV("db", times.nSidechainDB * 0.001);
+
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("hash", times.hash.GetHex());
+        obj.pushKV("height", times.nHeight);
+        obj.pushKV("txs", (uint64_t)times.nTx);
+        obj.pushKV("time", times.nTime);
+        obj.pushKV("total", times.nTotal * 0.001);
+        obj.pushKV("read", times.nReadFromDisk * 0.001);
+        obj.pushKV("check", times.nCheck * 0.001);
+        obj.pushKV("forks", times.nForks * 0.001);
+        obj.pushKV("prefetch", times.nPrefetch * 0.001);
+        obj.pushKV("connect", times.nConnect * 0.001);
+        obj.pushKV("verify", times.nVerify * 0.001);
+        obj.pushKV("undo", times.nUndo * 0.001);
+        obj.pushKV("journal", times.nJournal * 0.001);
+        obj.pushKV("flush", times.nFlush * 0.001);
+        obj.pushKV("chainstate", times.nChainState * 0.001);
+        obj.pushKV("postconnect", times.nPostConnect * 0.001);
+        obj.pushKV("sidechain", sidechain);
+        arr.push_back(obj);
+    }
+
+    return arr;
+}
+
 UniValue savemempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0) {
@@ -1598,6 +1691,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblock",               &getblock,               {"blockhash","verbosity|verbose"} },
     { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
+    { "blockchain",         "getblocktimings",        &getblocktimings,        {"count"} },
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
     { "blockchain",         "getchainheaders",        &getchainheaders,        {"count"} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
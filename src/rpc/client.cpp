@@ -79,6 +79,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblock", 1, "verbosity" },
     { "getblock", 1, "verbose" },
     { "getblockheader", 1, "verbose" },
+    { "getblocktimings", 0, "count" },
     { "getchaintxstats", 0, "nblocks" },
     { "getchainheaders", 0, "nheaders" },
     { "gettransaction", 1, "include_watchonly" },
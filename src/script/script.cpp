@@ -354,6 +354,32 @@ bool CScript::IsWithdrawalBundleHashCommit(uint256& hashWithdrawalBundle) const
     return true;
 }
 
+bool CScript::IsBMMCommit(uint256& hashBMM, uint8_t& nSidechain) const
+{
+    // Mainchain coinbase BMM h* commitment (BIP301)
+
+    // Check script size
+    size_t size = this->size();
+    if (size < 38) // sha256 hash + opcodes + sidechain number
+        return false;
+
+    // Check script header
+    if ((*this)[0] != OP_RETURN ||
+            (*this)[1] != 0xD1 ||
+            (*this)[2] != 0x61 ||
+            (*this)[3] != 0x73 ||
+            (*this)[4] != 0x68)
+        return false;
+
+    hashBMM = uint256(std::vector<unsigned char>(this->begin() + 5, this->begin() + 37));
+    nSidechain = (*this)[37];
+
+    if (hashBMM.IsNull())
+        return false;
+
+    return true;
+}
+
 bool CScript::IsBlockVersionCommit(int32_t& nVersion) const
 {
     // Check script size
@@ -652,6 +652,7 @@ public:
     bool IsPrevBlockCommit(uint256& hashPrevMain, uint256& hashPrevSide) const;
     bool IsWithdrawalBundleHashCommit(uint256& hashWithdrawalBundle) const;
     bool IsBlockVersionCommit(int32_t& nVersion) const;
+    bool IsBMMCommit(uint256& hashBMM, uint8_t& nSidechain) const;
     bool IsSidechainObj(std::vector<unsigned char>& vch) const;
 
     /** Called by IsStandardTx and P2SH/BIP62 VerifyScript (which makes it consensus-critical). */
@@ -17,6 +17,7 @@
 #include <util.h>
 
 #include <iostream>
+#include <set>
 #include <sstream>
 #include <stdlib.h>
 #include <string>
@@ -196,6 +197,58 @@ bool SidechainClient::VerifyDeposit(const uint256& hashMainBlock, const uint256&
     return (txid == txidRet);
 }
 
+bool SidechainClient::VerifyDeposits(const std::vector<DepositVerifyRequest>& vRequest)
+{
+    for (size_t nStart = 0; nStart < vRequest.size(); nStart += MAX_DEPOSIT_VERIFY_BATCH) {
+        const size_t nEnd = std::min(vRequest.size(), nStart + MAX_DEPOSIT_VERIFY_BATCH);
+
+        // JSON for a batch of 'verifydeposit' mainchain HTTP-RPC requests,
+        // the request id is the index of the deposit in vRequest.
+        std::string json;
+        json.append("[");
+        for (size_t i = nStart; i < nEnd; i++) {
+            if (i != nStart)
+                json.append(",");
+            json.append("{\"jsonrpc\": \"1.0\", \"id\":");
+            json.append(UniValue(uint64_t(i)).write());
+            json.append(", \"method\": \"verifydeposit\", \"params\": ");
+            json.append("[\"");
+            json.append(vRequest[i].hashMainBlock.ToString());
+            json.append("\",\"");
+            json.append(vRequest[i].txid.ToString());
+            json.append("\",");
+            json.append(UniValue(vRequest[i].nTx).write());
+            json.append("] }");
+        }
+        json.append("]");
+
+        // Ask mainchain node to verify the batch of deposits
+        boost::property_tree::ptree ptree;
+        if (!SendRequestToMainchain(json, ptree)) {
+            return false;
+        }
+
+        // Process results, every deposit in the batch must be verified
+        std::set<size_t> setVerified;
+        BOOST_FOREACH(boost::property_tree::ptree::value_type &value, ptree) {
+            size_t nID = value.second.get("id", vRequest.size());
+            if (nID < nStart || nID >= nEnd)
+                return false;
+
+            uint256 txidRet = uint256S(value.second.get("result", ""));
+            if (txidRet != vRequest[nID].txid) {
+                LogPrintf("%s: Failed to verify deposit: %s\n", __func__, vRequest[nID].txid.ToString());
+                return false;
+            }
+            setVerified.insert(nID);
+        }
+        if (setVerified.size() != nEnd - nStart)
+            return false;
+    }
+
+    return true;
+}
+
 bool SidechainClient::VerifyBMM(const uint256& hashMainBlock, const uint256& hashBMM, uint256& txid, uint32_t& nTime)
 {
     // JSON for requesting BMM proof via mainchain HTTP-RPC
@@ -581,6 +634,13 @@ bool SidechainClient::ListWithdrawalBundleStatus(std::vector<uint256>& vHashWith
     // WithdrawalBundle(s) for nSidechain. The rest of the results could be useful for the
     // GUI though.
 
+    vHashWithdrawalBundle.clear();
+
+    // Bundle status can only change with a new mainchain block, so use the
+    // results cached for the current mainchain tip if we have them
+    if (bmmCache.GetCachedWithdrawalBundleList(vHashWithdrawalBundle))
+        return vHashWithdrawalBundle.size() > 0;
+
     // JSON for 'listwithdrawalstatus' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -612,6 +672,8 @@ bool SidechainClient::ListWithdrawalBundleStatus(std::vector<uint256>& vHashWith
         }
     }
 
+    bmmCache.CacheWithdrawalBundleList(vHashWithdrawalBundle);
+
     return vHashWithdrawalBundle.size() > 0;
 }
 
@@ -640,6 +702,11 @@ bool SidechainClient::GetBlockHash(int nHeight, uint256& hashBlock)
 
 bool SidechainClient::HaveSpentWithdrawalBundle(const uint256& hash)
 {
+    // Check if we already asked about this bundle for the current mainchain tip
+    bool fCached = false;
+    if (bmmCache.GetCachedWithdrawalBundleStatus(hash, false /* fFailed */, fCached))
+        return fCached;
+
     // JSON for 'havespentwithdrawalbundle' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -661,11 +728,18 @@ bool SidechainClient::HaveSpentWithdrawalBundle(const uint256& hash)
 
     bool fSpent = ptree.get("result", false);
 
+    bmmCache.CacheWithdrawalBundleStatus(hash, false /* fFailed */, fSpent);
+
     return fSpent;
 }
 
 bool SidechainClient::HaveFailedWithdrawalBundle(const uint256& hash)
 {
+    // Check if we already asked about this bundle for the current mainchain tip
+    bool fCached = false;
+    if (bmmCache.GetCachedWithdrawalBundleStatus(hash, true /* fFailed */, fCached))
+        return fCached;
+
     // JSON for 'havefailedwithdrawalbundle' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -687,9 +761,84 @@ bool SidechainClient::HaveFailedWithdrawalBundle(const uint256& hash)
 
     bool fFailed = ptree.get("result", false);
 
+    bmmCache.CacheWithdrawalBundleStatus(hash, true /* fFailed */, fFailed);
+
     return fFailed;
 }
 
+bool SidechainClient::GetMainchainBlock(const uint256& hashMainBlock, CMainchainBlock& block)
+{
+    // JSON for 'getblock' mainchain HTTP-RPC, verbosity 0 returns hex
+    std::string json;
+    json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
+    json.append("\"method\": \"getblock\", \"params\": ");
+    json.append("[\"");
+    json.append(hashMainBlock.ToString());
+    json.append("\",0");
+    json.append("] }");
+
+    // Try to request mainchain block
+    boost::property_tree::ptree ptree;
+    if (!SendRequestToMainchain(json, ptree)) {
+        LogPrintf("ERROR Sidechain client failed to request mainchain block!\n");
+        return false;
+    }
+
+    std::string strHex = ptree.get("result", "");
+    if (strHex.empty() || !IsHex(strHex))
+        return false;
+
+    try {
+        CDataStream ss(ParseHex(strHex), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> block;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Failed to deserialize mainchain block: %s\n", __func__, e.what());
+        return false;
+    }
+
+    return true;
+}
+
+bool SidechainClient::GetTxOutProof(const std::vector<uint256>& vTxid, const uint256& hashMainBlock, CMainchainMerkleBlock& merkleBlock)
+{
+    // JSON for 'gettxoutproof' mainchain HTTP-RPC
+    std::string json;
+    json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
+    json.append("\"method\": \"gettxoutproof\", \"params\": ");
+    json.append("[[");
+    for (size_t i = 0; i < vTxid.size(); i++) {
+        if (i)
+            json.append(",");
+        json.append("\"");
+        json.append(vTxid[i].ToString());
+        json.append("\"");
+    }
+    json.append("],\"");
+    json.append(hashMainBlock.ToString());
+    json.append("\"] }");
+
+    // Try to request the merkle proof
+    boost::property_tree::ptree ptree;
+    if (!SendRequestToMainchain(json, ptree)) {
+        LogPrintf("ERROR Sidechain client failed to request txout proof!\n");
+        return false;
+    }
+
+    std::string strHex = ptree.get("result", "");
+    if (strHex.empty() || !IsHex(strHex))
+        return false;
+
+    try {
+        CDataStream ss(ParseHex(strHex), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> merkleBlock;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Failed to deserialize txout proof: %s\n", __func__, e.what());
+        return false;
+    }
+
+    return true;
+}
+
 bool SidechainClient::SendRequestToMainchain(const std::string& json, boost::property_tree::ptree &ptree)
 {
     std::string username = gArgs.GetArg("-mainchainrpcuser", gArgs.GetArg("-rpcuser", ""));
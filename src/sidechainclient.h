@@ -6,6 +6,8 @@
 #define SIDECHAINCLIENT_H
 
 #include <amount.h>
+#include <merkleblock.h>
+#include <primitives/block.h>
 #include <uint256.h>
 #include <validation.h>
 
@@ -16,6 +18,20 @@
 
 class SidechainDeposit;
 
+/** Maximum number of deposits to verify in one batched mainchain request */
+static const unsigned int MAX_DEPOSIT_VERIFY_BATCH = 100;
+
+/** Mainchain location of a deposit that needs to be verified */
+struct DepositVerifyRequest
+{
+    uint256 hashMainBlock;
+    uint256 txid;
+    int nTx;
+    //! The deposit transaction and its CTIP output, see CheckDepositTransactions
+    CTransactionRef tx;
+    uint32_t nBurnIndex;
+};
+
 // TODO refactor: Move BMM validation cache code here, or remove class status.
 class SidechainClient
 {
@@ -37,6 +53,13 @@ public:
      */
     bool VerifyDeposit(const uint256& hashMainBlock, const uint256& txid, const int nTx);
 
+    /*
+     * Verify multiple deposits with the mainchain node using batched requests
+     * of up to MAX_DEPOSIT_VERIFY_BATCH deposits. Stops at the first deposit
+     * that fails to verify.
+     */
+    bool VerifyDeposits(const std::vector<DepositVerifyRequest>& vRequest);
+
     /*
      * Search for BMM in a mainchain block and get mainchain block time
      */
@@ -77,6 +100,16 @@ public:
 
     bool HaveFailedWithdrawalBundle(const uint256& hash);
 
+    /*
+     * Request a full mainchain block
+     */
+    bool GetMainchainBlock(const uint256& hashMainBlock, CMainchainBlock& block);
+
+    /*
+     * Request a merkle proof that the transactions are in a mainchain block
+     */
+    bool GetTxOutProof(const std::vector<uint256>& vTxid, const uint256& hashMainBlock, CMainchainMerkleBlock& merkleBlock);
+
 private:
     /*
      * Send json request to local node
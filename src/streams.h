@@ -138,6 +138,65 @@ private:
     size_t nPos;
 };
 
+/* Minimal stream for reading from a range of bytes owned by someone else, such
+ * as a memory mapped file, without copying them into a buffer first
+ */
+class CSpanReader
+{
+ public:
+
+/*
+ * @param[in]  nTypeIn Serialization Type
+ * @param[in]  nVersionIn Serialization Version (including any flags)
+ * @param[in]  pbeginIn Start of the bytes to read, which must outlive the reader
+ * @param[in]  nSizeIn Number of bytes that can be read
+*/
+    CSpanReader(int nTypeIn, int nVersionIn, const char* pbeginIn, size_t nSizeIn) : nType(nTypeIn), nVersion(nVersionIn), pcur(pbeginIn), pend(pbeginIn + nSizeIn) {}
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        pcur += nSize;
+    }
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+    int GetVersion() const
+    {
+        return nVersion;
+    }
+    int GetType() const
+    {
+        return nType;
+    }
+    //! Number of bytes left to read
+    size_t size() const
+    {
+        return pend - pcur;
+    }
+    bool empty() const
+    {
+        return pcur == pend;
+    }
+private:
+    const int nType;
+    const int nVersion;
+    const char* pcur;
+    const char* pend;
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
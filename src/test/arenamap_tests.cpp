@@ -0,0 +1,124 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arenamap.h>
+#include <memusage.h>
+#include <random.h>
+
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+//! Bad hash to get long probe sequences and slots with equal hashes
+struct CollidingHasher
+{
+    size_t operator()(int x) const { return x % 97; }
+};
+
+typedef arenamap<int, std::string, CollidingHasher> TestMap;
+
+void CheckEqual(const TestMap& m, const std::map<int, std::string>& real)
+{
+    BOOST_CHECK_EQUAL(m.size(), real.size());
+    size_t n = 0;
+    for (TestMap::const_iterator it = m.begin(); it != m.end(); ++it) {
+        auto itReal = real.find(it->first);
+        BOOST_CHECK(itReal != real.end() && itReal->second == it->second);
+        n++;
+    }
+    BOOST_CHECK_EQUAL(n, real.size());
+    for (const auto& entry : real) {
+        TestMap::const_iterator it = m.find(entry.first);
+        BOOST_CHECK(it != m.end() && it->second == entry.second);
+    }
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(arenamap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(arenamap_random)
+{
+    FastRandomContext rng(true);
+    TestMap m;
+    std::map<int, std::string> real;
+
+    for (int i = 0; i < 20000; i++) {
+        int key = rng.randrange(2000);
+        switch (rng.randrange(4)) {
+        case 0:
+        case 1: {
+            std::string value = std::to_string(rng.rand32()) + std::string(rng.randrange(40), 'x');
+            auto ret = m.emplace(key, value);
+            BOOST_CHECK_EQUAL(ret.second, real.emplace(key, value).second);
+            BOOST_CHECK_EQUAL(ret.first->second, real[key]);
+            break;
+        }
+        case 2:
+            BOOST_CHECK_EQUAL(m.erase(key), real.erase(key));
+            break;
+        case 3:
+            m[key] = "set";
+            real[key] = "set";
+            break;
+        }
+        BOOST_CHECK_EQUAL(m.count(key), real.count(key));
+        if (i % 1000 == 0)
+            CheckEqual(m, real);
+    }
+    CheckEqual(m, real);
+
+    // Erase every other entry while iterating
+    bool fErase = false;
+    for (TestMap::iterator it = m.begin(); it != m.end(); ) {
+        if (fErase) {
+            real.erase(it->first);
+            it = m.erase(it);
+        } else {
+            ++it;
+        }
+        fErase = !fErase;
+    }
+    CheckEqual(m, real);
+
+    m.clear();
+    BOOST_CHECK(m.empty());
+    BOOST_CHECK(m.begin() == m.end());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(m), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(arenamap_stable_references)
+{
+    // Entries don't move when the table grows or other entries are erased
+    TestMap m;
+    std::string& first = m[-1];
+    first = "first";
+    for (int i = 0; i < 10000; i++)
+        m.emplace(i, std::to_string(i));
+    for (int i = 0; i < 10000; i += 2)
+        m.erase(i);
+    BOOST_CHECK_EQUAL(&first, &m.find(-1)->second);
+    BOOST_CHECK_EQUAL(first, "first");
+
+    // Erased nodes are reused before the map allocates more memory
+    size_t nUsage = memusage::DynamicUsage(m);
+    for (int i = 0; i < 10000; i += 2)
+        m.emplace(i, std::to_string(i));
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(m), nUsage);
+    BOOST_CHECK_EQUAL(m.size(), 10001U);
+
+    // Swapping hands the entries over without moving them
+    TestMap other;
+    other.swap(m);
+    BOOST_CHECK(m.empty());
+    BOOST_CHECK_EQUAL(other.size(), 10001U);
+    BOOST_CHECK_EQUAL(&first, &other.find(-1)->second);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,9 +3,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <blockencodings.h>
+#include <bmmcache.h>
 #include <consensus/merkle.h>
 #include <chainparams.h>
 #include <random.h>
+#include <sidechain.h>
+#include <validation.h>
 
 #include <test/test_bitcoin.h>
 
@@ -13,12 +16,33 @@
 
 std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
 
+// The mainchain block the test blocks are BMMed in and the one before it
+static const uint256 hashMainPrev = uint256S("0x01");
+static const uint256 hashMain = uint256S("0x02");
+
+// There is no mainchain in the unit tests, FillBlock's CheckBlock only gets
+// past the mainchain checks with the mainchain block cache set up here and
+// the results cached by CacheMainchainChecks
 struct RegtestingSetup : public TestingSetup {
-    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {
+        SetMockMainchainConnected(1);
+        std::deque<uint256> deqHashNew {hashMainPrev, hashMain};
+        bool fReorg = false;
+        std::vector<uint256> vOrphan;
+        bmmCache.UpdateMainBlockCache(deqHashNew, fReorg, vOrphan);
+    }
+    ~RegtestingSetup() {
+        bmmCache.ResetMainBlockCache();
+        SetMockMainchainConnected(-1);
+    }
 };
 
 BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, RegtestingSetup)
 
+static void CacheMainchainChecks(const CBlock& block) {
+    bmmCache.CacheVerifiedBMM(block.GetHash());
+}
+
 static CBlock BuildBlockTestCase() {
     CBlock block;
     CMutableTransaction tx;
@@ -28,10 +52,13 @@ static CBlock BuildBlockTestCase() {
     tx.vout[0].nValue = 42;
 
     block.vtx.resize(3);
-    block.vtx[0] = MakeTransactionRef(tx);
     block.nVersion = 42;
     block.hashPrevBlock = InsecureRand256();
-    block.nBits = 0x207fffff;
+    block.hashMainchainBlock = hashMain;
+
+    CMutableTransaction coinbase(tx);
+    coinbase.vout.push_back(CTxOut(0, GeneratePrevBlockCommit(hashMainPrev, block.hashPrevBlock)));
+    block.vtx[0] = MakeTransactionRef(std::move(coinbase));
 
     tx.vin[0].prevout.hash = InsecureRand256();
     tx.vin[0].prevout.n = 0;
@@ -47,6 +74,7 @@ static CBlock BuildBlockTestCase() {
     bool mutated;
     block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
     assert(!mutated);
+    CacheMainchainChecks(block);
     return block;
 }
 
@@ -283,14 +311,16 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
 
     CBlock block;
     block.vtx.resize(1);
-    block.vtx[0] = MakeTransactionRef(std::move(coinbase));
     block.nVersion = 42;
     block.hashPrevBlock = InsecureRand256();
-    block.nBits = 0x207fffff;
+    block.hashMainchainBlock = hashMain;
+    coinbase.vout.push_back(CTxOut(0, GeneratePrevBlockCommit(hashMainPrev, block.hashPrevBlock)));
+    block.vtx[0] = MakeTransactionRef(std::move(coinbase));
 
     bool mutated;
     block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
     assert(!mutated);
+    CacheMainchainChecks(block);
 
     // Test simple header round-trip with only coinbase
     {
@@ -315,6 +345,79 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(DepositRefsRoundTripTest)
+{
+    CTxMemPool pool;
+
+    SidechainDeposit deposit;
+    deposit.nSidechain = 0;
+    deposit.strDest = "dest";
+    deposit.amtUserPayout = 5 * COIN;
+    deposit.dtx.vin.resize(1);
+    deposit.dtx.vout.resize(1);
+    deposit.dtx.vout[0].nValue = 5 * COIN;
+    deposit.dtx.vout[0].scriptPubKey.resize(100);
+    deposit.nBurnIndex = 0;
+    deposit.nTx = 1;
+    deposit.hashMainchainBlock = InsecureRand256();
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig.resize(10);
+    coinbase.vout.resize(2);
+    coinbase.vout[0].nValue = 42;
+    coinbase.vout[1] = CTxOut(0, deposit.GetScript());
+
+    CBlock block(BuildBlockTestCase());
+    coinbase.vout.push_back(CTxOut(0, GeneratePrevBlockCommit(hashMainPrev, block.hashPrevBlock)));
+    block.vtx[0] = MakeTransactionRef(std::move(coinbase));
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    assert(!mutated);
+    CacheMainchainChecks(block);
+    bmmCache.CacheVerifiedDeposit(deposit.dtx.GetHash());
+
+    CBlockHeaderAndShortTxIDs shortIDs(block, true, true);
+    BOOST_CHECK(GetSerializeSize(shortIDs, SER_NETWORK, PROTOCOL_VERSION) <
+            GetSerializeSize(CBlockHeaderAndShortTxIDs(block, true), SER_NETWORK, PROTOCOL_VERSION));
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+
+    // A deposit we don't know makes us request the coinbase
+    {
+        bmmCache.ClearDepositQueue();
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK(!partialBlock.IsTxAvailable(0));
+
+        CBlock block2;
+        BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[0], block.vtx[1], block.vtx[2]}) == READ_STATUS_OK);
+        BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    }
+
+    // A deposit in our queue is filled in
+    {
+        bmmCache.ResetDepositQueue(uint256(), 0, uint256());
+        BOOST_CHECK(bmmCache.AppendPendingDeposits({deposit}));
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK(partialBlock.IsTxAvailable(0));
+
+        CBlock block2;
+        BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[1], block.vtx[2]}) == READ_STATUS_OK);
+        BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+        BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(block2, &mutated).ToString());
+        BOOST_CHECK(!mutated);
+
+        bmmCache.ClearDepositQueue();
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
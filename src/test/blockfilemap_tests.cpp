@@ -0,0 +1,136 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <primitives/block.h>
+#include <script/script.h>
+#include <streams.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+static void AppendToFile(const fs::path& path, const std::string& str)
+{
+    FILE* file = fsbridge::fopen(path, "ab");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(str.data(), 1, str.size(), file), str.size());
+    fclose(file);
+}
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockfilemap_grow_and_invalidate)
+{
+    const fs::path path = GetBlockPosFilename(CDiskBlockPos(7, 0), "blk");
+    fs::create_directories(path.parent_path());
+    CBlockFileMap map(2);
+
+    // Missing and empty files can't be mapped
+    BOOST_CHECK(!map.Get(7, "blk", 0));
+    AppendToFile(path, "");
+    BOOST_CHECK(!map.Get(7, "blk", 0));
+
+    AppendToFile(path, "first");
+    std::shared_ptr<const CMappedFile> file = map.Get(7, "blk", 5);
+    BOOST_REQUIRE(file);
+    BOOST_CHECK_EQUAL(std::string(file->data(), file->size()), "first");
+    BOOST_CHECK(map.Get(7, "blk", 5) == file);
+    BOOST_CHECK(!map.Get(7, "blk", 6));
+
+    // Appended data is mapped again, the old mapping stays usable
+    AppendToFile(path, "second");
+    std::shared_ptr<const CMappedFile> grown = map.Get(7, "blk", 11);
+    BOOST_REQUIRE(grown);
+    BOOST_CHECK_EQUAL(std::string(grown->data(), grown->size()), "firstsecond");
+    BOOST_CHECK_EQUAL(std::string(file->data(), file->size()), "first");
+
+    // Invalidated files are mapped again on the next read
+    map.Invalidate(7);
+    BOOST_CHECK(map.Get(7, "blk", 11) != grown);
+
+    // Block and undo files are told apart by prefix
+    const fs::path pathUndo = GetBlockPosFilename(CDiskBlockPos(7, 0), "rev");
+    const fs::path pathOther = GetBlockPosFilename(CDiskBlockPos(8, 0), "blk");
+    AppendToFile(pathUndo, "undo");
+    AppendToFile(pathOther, "other");
+    std::shared_ptr<const CMappedFile> undo = map.Get(7, "rev", 0);
+    BOOST_REQUIRE(undo);
+    BOOST_CHECK_EQUAL(std::string(undo->data(), undo->size()), "undo");
+    BOOST_CHECK(map.Get(7, "rev", 0) == undo);
+
+    // Only the most recently used files stay mapped
+    BOOST_REQUIRE(map.Get(8, "blk", 0));
+    BOOST_CHECK(map.Get(7, "rev", 0) == undo);
+    std::shared_ptr<const CMappedFile> remapped = map.Get(7, "blk", 0);
+    BOOST_REQUIRE(remapped);
+    BOOST_CHECK_EQUAL(std::string(remapped->data(), remapped->size()), "firstsecond");
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_strip_witness)
+{
+    CBlock block;
+    block.nVersion = 2;
+    block.nTime = 1234;
+
+    // Version 3 transaction with a witness
+    CMutableTransaction tx;
+    tx.nVersion = 3;
+    tx.replayBytes = 0x3f;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(InsecureRand256(), 1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].scriptWitness.stack = {std::vector<unsigned char>(73, 1), std::vector<unsigned char>(33, 2)};
+    tx.vin[1].prevout = COutPoint(InsecureRand256(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.nLockTime = 99;
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    // Without a witness
+    tx.nVersion = 2;
+    tx.vin[0].scriptWitness.SetNull();
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    // Without inputs and outputs
+    block.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+
+    std::vector<unsigned char> vchWitness, vchExpected, vchStripped;
+    CVectorWriter(SER_DISK, CLIENT_VERSION, vchWitness, 0, block);
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS, vchExpected, 0, block);
+    BOOST_CHECK(vchWitness != vchExpected);
+
+    CSpanReader reader(SER_DISK, CLIENT_VERSION, (const char*)vchWitness.data(), vchWitness.size());
+    StripRawBlockWitness(reader, vchStripped);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK(vchStripped == vchExpected);
+
+    // Truncated blocks are rejected
+    CSpanReader readerShort(SER_DISK, CLIENT_VERSION, (const char*)vchWitness.data(), vchWitness.size() - 1);
+    vchStripped.clear();
+    BOOST_CHECK_THROW(StripRawBlockWitness(readerShort, vchStripped), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_from_disk)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex);
+
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, consensusParams));
+    std::vector<unsigned char> vchExpected, vchRaw;
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, vchExpected, 0, block);
+
+    BOOST_CHECK(ReadRawBlockFromDisk(vchRaw, pindex, consensusParams, true));
+    BOOST_CHECK(vchRaw == vchExpected);
+    BOOST_CHECK(ReadRawBlockFromDisk(vchRaw, pindex, consensusParams, false));
+    BOOST_CHECK(vchRaw == vchExpected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
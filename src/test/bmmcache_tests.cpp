@@ -5,6 +5,8 @@
 #include <bmmcache.h>
 #include <deque>
 #include <random.h>
+#include <sidechain.h>
+#include <streams.h>
 #include <uint256.h>
 #include <validation.h>
 
@@ -21,6 +23,31 @@ std::deque<uint256> GenerateRandomHashChain(int nCount)
     return dHash;
 }
 
+std::vector<SidechainDeposit> GenerateDepositChain(int nCount)
+{
+    // Each deposit spends the CTIP (burn output) of the deposit before it
+    std::vector<SidechainDeposit> vDeposit;
+    COutPoint prevout(GetRandHash(), 0);
+    for (int i = 0; i < nCount; i++) {
+        SidechainDeposit deposit;
+        deposit.nSidechain = THIS_SIDECHAIN;
+        deposit.strDest = "dest";
+        deposit.dtx.vin.resize(1);
+        deposit.dtx.vin[0].prevout = prevout;
+        deposit.dtx.vout.resize(1);
+        deposit.dtx.vout[0].nValue = (i + 1) * CENT;
+        deposit.dtx.nLockTime = i;
+        deposit.amtUserPayout = deposit.dtx.vout[0].nValue;
+        deposit.nBurnIndex = 0;
+        deposit.nTx = 1;
+        deposit.hashMainchainBlock = GetRandHash();
+
+        prevout = COutPoint(deposit.dtx.GetHash(), deposit.nBurnIndex);
+        vDeposit.push_back(deposit);
+    }
+    return vDeposit;
+}
+
 BOOST_FIXTURE_TEST_SUITE(bmmcache_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(bmmcache_1_block)
@@ -872,4 +899,221 @@ BOOST_AUTO_TEST_CASE(bmmcache_replace_tip)
     BOOST_CHECK(vOrphan == vOrphanCheck);
 }
 
+BOOST_AUTO_TEST_CASE(bmmcache_withdrawal_bundle_status)
+{
+    // Instance of BMMCache for test
+    BMMCache cache;
+
+    uint256 hashBundle = GetRandHash();
+    bool fStatus = false;
+
+    // Nothing is cached without a mainchain tip
+    cache.CacheWithdrawalBundleStatus(hashBundle, true /* fFailed */, true);
+    BOOST_CHECK(!cache.GetCachedWithdrawalBundleStatus(hashBundle, true, fStatus));
+
+    std::deque<uint256> dHashNew = GenerateRandomHashChain(10);
+    std::deque<uint256> dHashNewCopy = dHashNew;
+
+    bool fReorg = false;
+    std::vector<uint256> vOrphan;
+    BOOST_CHECK(cache.UpdateMainBlockCache(dHashNewCopy, fReorg, vOrphan));
+
+    // Cache failed & spent status for the current mainchain tip
+    cache.CacheWithdrawalBundleStatus(hashBundle, true /* fFailed */, false);
+    cache.CacheWithdrawalBundleStatus(hashBundle, false /* fFailed */, true);
+    cache.CacheWithdrawalBundleList(std::vector<uint256>{hashBundle});
+
+    BOOST_CHECK(cache.GetCachedWithdrawalBundleStatus(hashBundle, true, fStatus));
+    BOOST_CHECK(!fStatus);
+    BOOST_CHECK(cache.GetCachedWithdrawalBundleStatus(hashBundle, false, fStatus));
+    BOOST_CHECK(fStatus);
+    BOOST_CHECK(!cache.GetCachedWithdrawalBundleStatus(GetRandHash(), false, fStatus));
+
+    std::vector<uint256> vHashBundle;
+    BOOST_CHECK(cache.GetCachedWithdrawalBundleList(vHashBundle));
+    BOOST_CHECK(vHashBundle.size() == 1 && vHashBundle.front() == hashBundle);
+
+    // Connect a new mainchain block, the status cache should be invalidated
+    std::deque<uint256> dHashNext;
+    dHashNext.push_back(dHashNew.back());
+    dHashNext.push_back(GetRandHash());
+    BOOST_CHECK(cache.UpdateMainBlockCache(dHashNext, fReorg, vOrphan));
+
+    BOOST_CHECK(!cache.GetCachedWithdrawalBundleStatus(hashBundle, true, fStatus));
+    BOOST_CHECK(!cache.GetCachedWithdrawalBundleStatus(hashBundle, false, fStatus));
+    vHashBundle.clear();
+    BOOST_CHECK(!cache.GetCachedWithdrawalBundleList(vHashBundle));
+
+    // Reset of the mainchain block cache also invalidates status
+    cache.CacheWithdrawalBundleStatus(hashBundle, false /* fFailed */, true);
+    BOOST_CHECK(cache.GetCachedWithdrawalBundleStatus(hashBundle, false, fStatus));
+    cache.ResetMainBlockCache();
+    BOOST_CHECK(!cache.GetCachedWithdrawalBundleStatus(hashBundle, false, fStatus));
+}
+
+BOOST_AUTO_TEST_CASE(bmmcache_deposit_queue)
+{
+    // Instance of BMMCache for test
+    BMMCache cache;
+
+    std::vector<SidechainDeposit> vDeposit = GenerateDepositChain(10);
+    const SidechainDeposit& anchor = vDeposit.front();
+
+    // Nothing can be taken from the queue before it is started
+    std::vector<SidechainDeposit> vPending;
+    const uint256 hashMainTip = GetRandHash();
+    BOOST_CHECK(!cache.GetPendingDeposits(hashMainTip, anchor.dtx.GetHash(), anchor.nBurnIndex, vPending));
+    BOOST_CHECK(!cache.AppendPendingDeposits(vDeposit));
+    BOOST_CHECK(!cache.HaveDepositQueueBase(anchor.dtx.GetHash(), anchor.nBurnIndex));
+
+    // Start the queue after the first deposit
+    cache.ResetDepositQueue(anchor.dtx.GetHash(), anchor.nBurnIndex, anchor.GetID());
+    BOOST_CHECK(cache.HaveQueuedDeposit(anchor.GetID()));
+
+    // Deposits must continue the CTIP chain from the queue tip
+    std::vector<SidechainDeposit> vSkip(vDeposit.begin() + 2, vDeposit.end());
+    BOOST_CHECK(!cache.AppendPendingDeposits(vSkip));
+
+    std::vector<SidechainDeposit> vFirst(vDeposit.begin() + 1, vDeposit.begin() + 5);
+    BOOST_CHECK(cache.AppendPendingDeposits(vFirst));
+
+    // Duplicates are rejected
+    BOOST_CHECK(!cache.AppendPendingDeposits(vFirst));
+
+    std::vector<SidechainDeposit> vSecond(vDeposit.begin() + 5, vDeposit.end());
+    BOOST_CHECK(cache.AppendPendingDeposits(vSecond));
+
+    uint256 hashTip;
+    uint32_t nTip = 0;
+    BOOST_CHECK(cache.GetDepositQueueTip(hashTip, nTip));
+    BOOST_CHECK(hashTip == vDeposit.back().dtx.GetHash());
+
+    // The queue is not used until it has caught up with a mainchain tip
+    BOOST_CHECK(!cache.GetPendingDeposits(hashMainTip, anchor.dtx.GetHash(), anchor.nBurnIndex, vPending));
+    cache.SetDepositQueueMainTip(hashMainTip);
+
+    // or if the mainchain tip has moved on since
+    BOOST_CHECK(!cache.GetPendingDeposits(GetRandHash(), anchor.dtx.GetHash(), anchor.nBurnIndex, vPending));
+
+    BOOST_CHECK(cache.HaveDepositQueueBase(anchor.dtx.GetHash(), anchor.nBurnIndex));
+    BOOST_CHECK(cache.HaveDepositQueueBase(vDeposit[5].dtx.GetHash(), vDeposit[5].nBurnIndex));
+    BOOST_CHECK(!cache.HaveDepositQueueBase(GetRandHash(), 0));
+
+    BOOST_CHECK(cache.GetPendingDeposits(hashMainTip, anchor.dtx.GetHash(), anchor.nBurnIndex, vPending));
+    BOOST_CHECK(vPending.size() == vDeposit.size() - 1);
+    BOOST_CHECK(vPending.front() == vDeposit[1]);
+
+    // After deposits are connected only the remaining ones are returned
+    const SidechainDeposit& last = vDeposit[3];
+    BOOST_CHECK(cache.GetPendingDeposits(hashMainTip, last.dtx.GetHash(), last.nBurnIndex, vPending));
+    BOOST_CHECK(vPending.size() == vDeposit.size() - 4);
+    BOOST_CHECK(vPending.front() == vDeposit[4]);
+    BOOST_CHECK(!cache.HaveQueuedDeposit(vDeposit[1].GetID()));
+    BOOST_CHECK(cache.HaveQueuedDeposit(last.GetID()));
+
+    // Unknown CTIP means the caller must ask the mainchain
+    BOOST_CHECK(!cache.GetPendingDeposits(hashMainTip, GetRandHash(), 0, vPending));
+
+    // Connected deposits are no longer a base the queue can be used from
+    BOOST_CHECK(!cache.HaveDepositQueueBase(anchor.dtx.GetHash(), anchor.nBurnIndex));
+
+    // Clearing the queue stops it from being used
+    cache.ClearDepositQueue();
+    BOOST_CHECK(!cache.GetDepositQueueTip(hashTip, nTip));
+    BOOST_CHECK(!cache.GetPendingDeposits(hashMainTip, last.dtx.GetHash(), last.nBurnIndex, vPending));
+}
+
+BOOST_AUTO_TEST_CASE(bmmcache_main_block_commits)
+{
+    // Instance of BMMCache for test
+    BMMCache cache;
+
+    uint256 hashMainBlock = GetRandHash();
+    uint256 hashBMM = GetRandHash();
+    uint256 txid = GetRandHash();
+
+    CMainchainBlockHeader header;
+    header.hashMerkleRoot = GetRandHash();
+    header.nBits = 1;
+
+    // Nothing indexed yet
+    bool fBMM = false;
+    BOOST_CHECK(!cache.HaveMainBlockBMM(hashMainBlock, hashBMM, fBMM));
+    BOOST_CHECK(!cache.HaveMainBlockDeposit(hashMainBlock, txid, 1));
+
+    // A proven deposit doesn't mean we have the coinbase commitments
+    cache.CacheMainBlockDeposit(hashMainBlock, header, txid, 1);
+    BOOST_CHECK(cache.HaveMainBlockDeposit(hashMainBlock, txid, 1));
+    BOOST_CHECK(!cache.HaveMainBlockDeposit(hashMainBlock, txid, 2));
+    BOOST_CHECK(!cache.HaveMainBlockBMM(hashMainBlock, hashBMM, fBMM));
+
+    std::set<uint256> setBMM;
+    setBMM.insert(hashBMM);
+    cache.CacheMainBlockBMM(hashMainBlock, header, setBMM);
+
+    BOOST_CHECK(cache.HaveMainBlockBMM(hashMainBlock, hashBMM, fBMM));
+    BOOST_CHECK(fBMM);
+    BOOST_CHECK(cache.HaveMainBlockBMM(hashMainBlock, GetRandHash(), fBMM));
+    BOOST_CHECK(!fBMM);
+
+    // Deposits are kept when the coinbase commitments are added
+    BOOST_CHECK(cache.HaveMainBlockDeposit(hashMainBlock, txid, 1));
+
+    MainBlockCommits commits;
+    BOOST_CHECK(cache.GetMainBlockCommits(hashMainBlock, commits));
+    BOOST_CHECK(commits.header == header);
+    BOOST_CHECK(commits.fHaveCoinbase);
+    BOOST_CHECK(commits.setBMM == setBMM);
+    BOOST_CHECK(commits.mapDeposit.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(bmmcache_block_verify_record)
+{
+    BMMCache cache;
+
+    BlockVerifyRecord record;
+    record.hashBlock = GetRandHash();
+    record.hashMainchainBlock = GetRandHash();
+    record.hashBMM = GetRandHash();
+    record.vDepositTxid.push_back(GetRandHash());
+    record.vBundleStatus.push_back(std::make_pair(GetRandHash(), true));
+    record.vBundleStatus.push_back(std::make_pair(GetRandHash(), false));
+
+    BOOST_CHECK(!cache.HaveBlockVerifyRecord(record.hashBlock));
+
+    // Records are journaled to disk, check serialization round trip
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << record;
+    BlockVerifyRecord recordRead;
+    ss >> recordRead;
+
+    cache.CacheBlockVerifyRecord(recordRead);
+    BOOST_CHECK(cache.HaveBlockVerifyRecord(record.hashBlock));
+    BOOST_CHECK(!cache.HaveBlockVerifyRecord(GetRandHash()));
+
+    BlockVerifyRecord recordCached;
+    BOOST_CHECK(cache.GetBlockVerifyRecord(record.hashBlock, recordCached));
+    BOOST_CHECK(recordCached.hashMainchainBlock == record.hashMainchainBlock);
+    BOOST_CHECK(recordCached.hashBMM == record.hashBMM);
+    BOOST_CHECK(recordCached.vDepositTxid == record.vDepositTxid);
+    BOOST_CHECK(recordCached.vBundleStatus == record.vBundleStatus);
+}
+
+BOOST_AUTO_TEST_CASE(bmmcache_count_missing_main_blocks)
+{
+    BMMCache cache;
+
+    std::deque<uint256> dHashNew = GenerateRandomHashChain(10);
+    std::vector<uint256> vHash(dHashNew.begin(), dHashNew.end());
+    bool fReorg = false;
+    std::vector<uint256> vOrphan;
+    BOOST_CHECK(cache.UpdateMainBlockCache(dHashNew, fReorg, vOrphan));
+
+    BOOST_CHECK_EQUAL(cache.CountMissingMainBlocks(vHash), 0U);
+    vHash.push_back(GetRandHash());
+    vHash.insert(vHash.begin(), GetRandHash());
+    BOOST_CHECK_EQUAL(cache.CountMissingMainBlocks(vHash), 2U);
+    BOOST_CHECK_EQUAL(cache.CountMissingMainBlocks(std::vector<uint256>()), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include <undo.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
+#include <txdb.h>
 #include <validation.h>
 #include <consensus/validation.h>
 
@@ -15,6 +16,7 @@
 #include <map>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out);
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight);
@@ -855,4 +857,110 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+
+BOOST_FIXTURE_TEST_CASE(ccoins_prefetch, TestingSetup)
+{
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 2; i++)
+        threadGroup.create_thread(&ThreadCoinsRead);
+
+    // Every third outpoint is missing from the database
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsMap mapCoins;
+    std::vector<COutPoint> vOutPoint;
+    for (int i = 0; i < 200; i++) {
+        COutPoint outpoint(InsecureRand256(), i);
+        vOutPoint.push_back(outpoint);
+        if (i % 3 == 0)
+            continue;
+        CCoinsCacheEntry& entry = mapCoins[outpoint];
+        entry.coin = Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false);
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+    BOOST_CHECK(db.BatchWrite(mapCoins, InsecureRand256()));
+
+    // Read them on the calling thread and on the read threads
+    for (int nThreads : {0, 2}) {
+        nCoinsReadThreads = nThreads;
+
+        CCoinsViewCacheTest cache(&db);
+        cache.AccessCoin(vOutPoint[1]);
+        cache.PrefetchCoins(vOutPoint);
+        cache.SelfTest();
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 133U);
+        for (size_t i = 0; i < vOutPoint.size(); i++) {
+            BOOST_CHECK_EQUAL(cache.HaveCoinInCache(vOutPoint[i]), i % 3 != 0);
+            if (i % 3 != 0)
+                BOOST_CHECK_EQUAL(cache.AccessCoin(vOutPoint[i]).out.nValue, (CAmount)i + 1);
+        }
+
+        // A bulk read through a cache stack fills every level on the way
+        CCoinsViewCacheTest middle(&db);
+        CCoinsViewCacheTest top(&middle);
+        std::vector<Coin> vCoin;
+        top.GetCoins(vOutPoint, vCoin);
+        top.SelfTest();
+        middle.SelfTest();
+        BOOST_CHECK_EQUAL(vCoin.size(), vOutPoint.size());
+        BOOST_CHECK_EQUAL(top.GetCacheSize(), 133U);
+        BOOST_CHECK_EQUAL(middle.GetCacheSize(), 133U);
+        for (size_t i = 0; i < vOutPoint.size(); i++)
+            BOOST_CHECK(vCoin[i] == cache.AccessCoin(vOutPoint[i]));
+    }
+    nCoinsReadThreads = 0;
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_background_flush, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewFlusher flusher(&db);
+    CCoinsViewCacheTest cache(&flusher);
+
+    std::vector<COutPoint> vOutPoint;
+    for (int i = 0; i < 200; i++) {
+        vOutPoint.push_back(COutPoint(InsecureRand256(), i));
+        cache.AddCoin(vOutPoint.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false), false);
+    }
+    const uint256 hashBlock1 = InsecureRand256();
+    cache.SetBestBlock(hashBlock1);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+    // The coins can be read through the flusher whether or not they are written yet
+    BOOST_CHECK(flusher.GetBestBlock() == hashBlock1);
+    for (size_t i = 0; i < vOutPoint.size(); i++)
+        BOOST_CHECK_EQUAL(cache.AccessCoin(vOutPoint[i]).out.nValue, (CAmount)i + 1);
+
+    BOOST_CHECK(flusher.WaitForFlush());
+    BOOST_CHECK(!flusher.IsFlushing());
+    BOOST_CHECK_EQUAL(flusher.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock1);
+    for (size_t i = 0; i < vOutPoint.size(); i++)
+        BOOST_CHECK(db.HaveCoin(vOutPoint[i]));
+
+    // Spend every other coin, the next flush deletes them
+    for (size_t i = 0; i < vOutPoint.size(); i += 2)
+        BOOST_CHECK(cache.SpendCoin(vOutPoint[i]));
+    const uint256 hashBlock2 = InsecureRand256();
+    cache.SetBestBlock(hashBlock2);
+    BOOST_CHECK(cache.Flush());
+
+    std::vector<Coin> vCoin;
+    flusher.GetCoins(vOutPoint, vCoin);
+    BOOST_CHECK(flusher.GetBestBlock() == hashBlock2);
+    for (size_t i = 0; i < vOutPoint.size(); i++) {
+        BOOST_CHECK_EQUAL(flusher.HaveCoin(vOutPoint[i]), i % 2 == 1);
+        BOOST_CHECK_EQUAL(vCoin[i].IsSpent(), i % 2 == 0);
+    }
+
+    BOOST_CHECK(flusher.WaitForFlush());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    for (size_t i = 0; i < vOutPoint.size(); i++)
+        BOOST_CHECK_EQUAL(db.HaveCoin(vOutPoint[i]), i % 2 == 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -145,6 +145,23 @@ BOOST_AUTO_TEST_CASE(siphash)
         BOOST_CHECK_EQUAL(SipHashUint256(k1, k2, x), sip256.Finalize());
         BOOST_CHECK_EQUAL(SipHashUint256Extra(k1, k2, x, n), sip288.Finalize());
     }
+
+    // Check consistency between SipHashUint256x4 and SipHashUint256.
+    for (int i = 0; i < 16; ++i) {
+        uint64_t k1 = ctx.rand64();
+        uint64_t k2 = ctx.rand64();
+        uint256 x[4];
+        const uint256* px[4];
+        for (int j = 0; j < 4; ++j) {
+            x[j] = InsecureRand256();
+            px[j] = &x[j];
+        }
+        uint64_t out[4];
+        SipHashUint256x4(k1, k2, px, out);
+        for (int j = 0; j < 4; ++j) {
+            BOOST_CHECK_EQUAL(out[j], SipHashUint256(k1, k2, x[j]));
+        }
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -132,4 +132,53 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_tree_test)
+{
+    const size_t vSize[] = {0, 1, 2, 3, 7, 8, 9, 100, MERKLE_PARALLEL_MIN_LEAVES - 1, MERKLE_PARALLEL_MIN_LEAVES,
+        MERKLE_PARALLEL_MIN_LEAVES + 1, 3 * MERKLE_PARALLEL_MIN_LEAVES + 5};
+    for (size_t nLeaves : vSize) {
+        std::vector<uint256> leaves(nLeaves);
+        for (uint256& leaf : leaves) {
+            leaf = InsecureRand256();
+        }
+
+        // Build the tree both serially and split across threads
+        for (unsigned int nThreads : {1, 3}) {
+            CBlockMerkleTree tree(leaves, nThreads);
+            bool mutated = true;
+            BOOST_CHECK(tree.GetRoot(&mutated) == ComputeMerkleRoot(leaves));
+            BOOST_CHECK(!mutated);
+            BOOST_CHECK_EQUAL(tree.GetLeafCount(), nLeaves);
+
+            if (nLeaves == 0) continue;
+
+            // Replacing the first leaf matches a full recomputation
+            std::vector<uint256> updated = leaves;
+            updated[0] = InsecureRand256();
+            tree.UpdateFirstLeaf(updated[0]);
+            BOOST_CHECK(tree.GetRoot(&mutated) == ComputeMerkleRoot(updated));
+            BOOST_CHECK(!mutated);
+
+            if (nLeaves < 2) continue;
+
+            // Duplicates are detected inside and outside of the first leaf's path
+            updated[0] = updated[1];
+            tree.UpdateFirstLeaf(updated[0]);
+            BOOST_CHECK(tree.GetRoot(&mutated) == ComputeMerkleRoot(updated));
+            BOOST_CHECK(mutated);
+
+            if (nLeaves < 4) continue;
+
+            std::vector<uint256> duplicated = leaves;
+            duplicated[nLeaves - 2 - nLeaves % 2] = duplicated[nLeaves - 1 - nLeaves % 2];
+            CBlockMerkleTree treeDuplicated(duplicated, nThreads);
+            BOOST_CHECK(treeDuplicated.GetRoot(&mutated) == ComputeMerkleRoot(duplicated));
+            BOOST_CHECK(mutated);
+            treeDuplicated.UpdateFirstLeaf(InsecureRand256());
+            treeDuplicated.GetRoot(&mutated);
+            BOOST_CHECK(mutated);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,9 +9,11 @@
 #include <serialize.h>
 #include <streams.h>
 #include <net.h>
+#include <net_processing.h>
 #include <netbase.h>
 #include <chainparams.h>
 #include <util.h>
+#include <validation.h>
 
 class CAddrManSerializationMock : public CAddrMan
 {
@@ -185,4 +187,138 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_buffer_pool)
+{
+    CNetMessageBufferPool pool;
+    std::shared_ptr<CNetMessageBuffer> buffer1 = pool.Get(1000, 1000);
+    std::shared_ptr<CNetMessageBuffer> buffer2 = pool.Get(3000, 2000);
+    BOOST_CHECK_EQUAL(buffer1->capacity(), 1000U);
+    BOOST_CHECK_EQUAL(buffer2->capacity(), 2000U);
+    CNetMessageBuffer* pbuffer1 = buffer1.get();
+    CNetMessageBuffer* pbuffer2 = buffer2.get();
+    buffer1.reset();
+    buffer2.reset();
+
+    // The smallest buffer that is large enough is reused
+    buffer1 = pool.Get(500, 100);
+    BOOST_CHECK(buffer1.get() == pbuffer1);
+    buffer2 = pool.Get(500, 100);
+    BOOST_CHECK(buffer2.get() == pbuffer2);
+    std::shared_ptr<CNetMessageBuffer> buffer3 = pool.Get(500, 100);
+    BOOST_CHECK(buffer3.get() != pbuffer1 && buffer3.get() != pbuffer2);
+    BOOST_CHECK_EQUAL(buffer3->capacity(), 100U);
+
+    // Growing keeps the data
+    memcpy(buffer3->data(), "abc", 3);
+    buffer3->Reserve(5000, 3);
+    BOOST_CHECK_EQUAL(buffer3->capacity(), 5000U);
+    BOOST_CHECK(memcmp(buffer3->data(), "abc", 3) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_payload_buffer)
+{
+    // Larger than what is allocated ahead, so the buffer has to grow
+    std::vector<unsigned char> vPayload(300001);
+    for (size_t i = 0; i < vPayload.size(); i++)
+        vPayload[i] = (unsigned char)(i * 7);
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::BLOCK, vPayload.size());
+    uint256 hash = Hash(vPayload.begin(), vPayload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << hdr;
+
+    const char* pchPayload = (const char*)vPayload.data();
+    for (int i = 0; i < 2; i++) {
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+        size_t nSize = 0;
+        BOOST_CHECK(msg.GetDataBuffer(1, nSize) == nullptr);
+        BOOST_CHECK_EQUAL(msg.readHeader(ssHeader.data(), ssHeader.size()), (int)ssHeader.size());
+
+        // Some of the payload copied in, the rest received in place
+        BOOST_CHECK_EQUAL(msg.readData(pchPayload, 1000), 1000);
+        size_t nPos = 1000;
+        while (char* pch = msg.GetDataBuffer(0x10000, nSize)) {
+            BOOST_CHECK(nSize >= 0x10000);
+            nSize = std::min<size_t>(nSize, 0x20000);
+            memcpy(pch, pchPayload + nPos, nSize);
+            BOOST_CHECK_EQUAL(msg.readData(pch, nSize), (int)nSize);
+            nPos += nSize;
+        }
+        BOOST_CHECK(vPayload.size() - nPos < 0x10000);
+        BOOST_CHECK_EQUAL(msg.readData(pchPayload + nPos, vPayload.size() - nPos), (int)(vPayload.size() - nPos));
+        BOOST_CHECK(msg.complete());
+
+        BOOST_CHECK(msg.GetMessageHash() == hash);
+        CSpanReader reader(msg.GetReader(SER_NETWORK, PROTOCOL_VERSION));
+        std::vector<unsigned char> vRead(reader.size());
+        reader.read((char*)vRead.data(), vRead.size());
+        BOOST_CHECK(vRead == vPayload);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_payload_growth)
+{
+    // A large message received a little at a time is only reallocated a few times
+    const size_t nMessageSize = 8 * 1024 * 1024;
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::BLOCK, nMessageSize);
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << hdr;
+
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    BOOST_CHECK_EQUAL(msg.readHeader(ssHeader.data(), ssHeader.size()), (int)ssHeader.size());
+
+    std::vector<char> vChunk(4096);
+    size_t nPos = 0;
+    size_t nCapacity = 0;
+    int nGrow = 0;
+    while (nPos < nMessageSize) {
+        BOOST_CHECK_EQUAL(msg.readData(vChunk.data(), vChunk.size()), (int)vChunk.size());
+        nPos += vChunk.size();
+
+        size_t nSize = 0;
+        if (msg.GetDataBuffer(0, nSize) == nullptr)
+            break;
+        if (nPos + nSize != nCapacity) {
+            BOOST_CHECK(nPos + nSize > nCapacity);
+            nCapacity = nPos + nSize;
+            nGrow++;
+        }
+    }
+    BOOST_CHECK(msg.complete());
+    BOOST_CHECK(nGrow <= 8);
+}
+
+BOOST_AUTO_TEST_CASE(blocks_in_transit_limit)
+{
+    // Not measured yet
+    BOOST_CHECK_EQUAL(CalculateBlocksInTransitLimit(0, 1000, 10000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(CalculateBlocksInTransitLimit(1000000, 0, 10000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(CalculateBlocksInTransitLimit(1000000, 1000, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(CalculateBlocksInTransitLimit(1000000, 1000, std::numeric_limits<int64_t>::max()), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // 1 ms per block at 1 MB/s, enough blocks to cover twice a 10 ms ping
+    BOOST_CHECK_EQUAL(CalculateBlocksInTransitLimit(1000000, 1000, 10000), 21);
+
+    // A slow peer sending large blocks keeps the minimum in flight
+    BOOST_CHECK_EQUAL(CalculateBlocksInTransitLimit(10000, 1000000, 100000), MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // A fast peer sending small blocks far away is capped
+    BOOST_CHECK_EQUAL(CalculateBlocksInTransitLimit(100000000, 1000, 100000), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    // No blocks seen yet
+    BOOST_CHECK_EQUAL(CalculateBlockDownloadWindow(0), (int)BLOCK_DOWNLOAD_WINDOW);
+
+    // Large blocks never shrink the window
+    BOOST_CHECK_EQUAL(CalculateBlockDownloadWindow(1000000), (int)BLOCK_DOWNLOAD_WINDOW);
+
+    // As many blocks as fit in BLOCK_DOWNLOAD_WINDOW_BYTES
+    BOOST_CHECK_EQUAL(CalculateBlockDownloadWindow(32000), (int)(BLOCK_DOWNLOAD_WINDOW_BYTES / 32000));
+
+    // Small blocks are capped at MAX_BLOCK_DOWNLOAD_WINDOW
+    BOOST_CHECK_EQUAL(CalculateBlockDownloadWindow(100), (int)MAX_BLOCK_DOWNLOAD_WINDOW);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -13,6 +13,7 @@
 #include "random.h"
 #include "script/sigcache.h"
 #include "sidechain.h"
+#include "sidechainclient.h"
 #include "uint256.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -285,6 +286,142 @@ BOOST_AUTO_TEST_CASE(sidechain_deposit_sort_deposits)
     BOOST_CHECK(vDepositSorted == vD);
 }
 
+static DepositVerifyRequest GetDepositRequest(const SidechainDeposit& deposit, const uint256& hashMainBlock)
+{
+    DepositVerifyRequest request;
+    request.hashMainBlock = hashMainBlock;
+    request.tx = MakeTransactionRef(deposit.dtx);
+    request.txid = request.tx->GetHash();
+    request.nTx = deposit.nTx;
+    request.nBurnIndex = deposit.nBurnIndex;
+    return request;
+}
+
+BOOST_AUTO_TEST_CASE(deposit_transactions_checked)
+{
+    // Get deposits in valid CTIP spend order
+    std::vector<SidechainDeposit> vD = GetTestDeposits();
+
+    const uint256 hashMainBlock = GetRandHash();
+    std::vector<DepositVerifyRequest> vRequest;
+    for (size_t i = 0; i < 3; i++)
+        vRequest.push_back(GetDepositRequest(vD[i], hashMainBlock));
+
+    BOOST_CHECK(CheckDepositTransactions(vRequest));
+
+    // CTIP output index out of range
+    std::vector<DepositVerifyRequest> vBadIndex = vRequest;
+    vBadIndex[2].nBurnIndex = vBadIndex[2].tx->vout.size();
+    BOOST_CHECK(!CheckDepositTransactions(vBadIndex));
+    vBadIndex = vRequest;
+    vBadIndex[0].nBurnIndex = vBadIndex[0].tx->vout.size();
+    BOOST_CHECK(!CheckDepositTransactions(vBadIndex));
+
+    // A transaction paying to the escrow script without spending the CTIP
+    CMutableTransaction mtx(vD[1].dtx);
+    mtx.vin.clear();
+    mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    std::vector<DepositVerifyRequest> vNotDeposit = vRequest;
+    vNotDeposit[1].tx = MakeTransactionRef(mtx);
+    vNotDeposit[1].txid = vNotDeposit[1].tx->GetHash();
+    BOOST_CHECK(!CheckDepositTransactions(vNotDeposit));
+
+    // Spending the CTIP but paying somewhere else
+    mtx = CMutableTransaction(vD[1].dtx);
+    mtx.vout[vD[1].nBurnIndex].scriptPubKey = CScript() << OP_TRUE;
+    std::vector<DepositVerifyRequest> vBadScript = vRequest;
+    vBadScript[1].tx = MakeTransactionRef(mtx);
+    vBadScript[1].txid = vBadScript[1].tx->GetHash();
+    BOOST_CHECK(!CheckDepositTransactions(vBadScript));
+
+    // Local merkle proofs only show that a transaction is in a mainchain
+    // block, a proven transaction that isn't a deposit must be rejected
+    gArgs.ForceSetArg("-verifybmmlocal", "1");
+    std::deque<uint256> deqHashNew {hashMainBlock};
+    bool fReorg = false;
+    std::vector<uint256> vOrphan;
+    bmmCache.UpdateMainBlockCache(deqHashNew, fReorg, vOrphan);
+
+    // The first deposit was verified by the mainchain
+    bmmCache.CacheVerifiedDeposit(vRequest[0].txid);
+    for (const DepositVerifyRequest& r : vNotDeposit)
+        bmmCache.CacheMainBlockDeposit(hashMainBlock, CMainchainBlockHeader(), r.txid, r.nTx);
+    BOOST_CHECK(!VerifyDeposits(vNotDeposit));
+
+    vBadIndex = vRequest;
+    vBadIndex[2].nBurnIndex = vBadIndex[2].tx->vout.size();
+    for (const DepositVerifyRequest& r : vBadIndex)
+        bmmCache.CacheMainBlockDeposit(hashMainBlock, CMainchainBlockHeader(), r.txid, r.nTx);
+    BOOST_CHECK(!VerifyDeposits(vBadIndex));
+
+    // The deposits spending the verified one's CTIP are proven locally
+    BOOST_CHECK(VerifyDeposits(vRequest));
+
+    bmmCache.ResetMainBlockCache();
+    gArgs.ForceSetArg("-verifybmmlocal", "0");
+}
+
+BOOST_AUTO_TEST_CASE(checkblock_checked_without_mainchain)
+{
+    // Don't depend on a mainchain node that may be running next to the tests
+    SetMockMainchainConnected(0);
+    BOOST_CHECK(!CheckMainchainConnection());
+    BOOST_CHECK(!IsMainchainConnected());
+
+    CBlock block;
+    block.hashPrevBlock = GetRandHash();
+    CValidationState state;
+
+    // Not checked yet, the mainchain is needed
+    BOOST_CHECK(!CheckBlock(block, state, Params().GetConsensus(), true, true));
+    BOOST_CHECK(state.IsValid());
+
+    // Checked before, the mainchain isn't needed again
+    block.fChecked = true;
+    BOOST_CHECK(CheckBlock(block, state, Params().GetConsensus(), true, true));
+
+    SetMockMainchainConnected(-1);
+}
+
+BOOST_AUTO_TEST_CASE(header_not_punished_without_mainchain)
+{
+    // Connected when last checked
+    SetMockMainchainConnected(1);
+    BOOST_CHECK(CheckMainchainConnection());
+
+    // The connection drops before the header's BMM is verified
+    SetMockMainchainConnected(0);
+    BOOST_CHECK(IsMainchainConnected());
+
+    CBlockHeader header;
+    header.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+    header.hashMainchainBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+
+    // BMM can't be verified, but the peer isn't to blame for that
+    CValidationState state;
+    BOOST_CHECK(!ProcessNewBlockHeaders({header}, state, Params()));
+    BOOST_CHECK(state.IsValid());
+    BOOST_CHECK(!IsMainchainConnected());
+
+    SetMockMainchainConnected(-1);
+}
+
+BOOST_AUTO_TEST_CASE(block_connect_times)
+{
+    // The test chain's tip was connected with ConnectTip
+    std::vector<BlockConnectTimes> vTimes = GetBlockConnectTimes();
+    BOOST_REQUIRE(!vTimes.empty());
+    BOOST_CHECK(vTimes.size() <= MAX_BLOCK_CONNECT_TIMES);
+
+    LOCK(cs_main);
+    const BlockConnectTimes& times = vTimes.back();
+    BOOST_CHECK(times.hash == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(times.nHeight, chainActive.Height());
+    BOOST_CHECK(times.nTx >= 1);
+    BOOST_CHECK(times.nTotal >= times.nConnect);
+}
+
 BOOST_AUTO_TEST_CASE(IsWithdrawalBundleFailCommit)
 {
     uint256 hashWithdrawalBundle = GetRandHash();
@@ -13,6 +13,26 @@ using namespace boost::assign; // bring 'operator+=()' into scope
 
 BOOST_FIXTURE_TEST_SUITE(streams_tests, BasicTestingSetup)
 
+BOOST_AUTO_TEST_CASE(streams_span_reader)
+{
+    std::vector<unsigned char> vch;
+    CVectorWriter(SER_NETWORK, INIT_PROTO_VERSION, vch, 0, (uint32_t)0xdeadbeef, std::string("span"), (unsigned char)7);
+
+    CSpanReader reader(SER_NETWORK, INIT_PROTO_VERSION, (const char*)vch.data(), vch.size());
+    uint32_t n;
+    std::string str;
+    reader >> n >> str;
+    BOOST_CHECK_EQUAL(n, 0xdeadbeef);
+    BOOST_CHECK_EQUAL(str, "span");
+    BOOST_CHECK_EQUAL(reader.size(), 1U);
+
+    // Reading past the end throws and leaves the reader where it was
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+    BOOST_CHECK_EQUAL(reader.size(), 1U);
+    reader.ignore(1);
+    BOOST_CHECK(reader.empty());
+}
+
 BOOST_AUTO_TEST_CASE(streams_vector_writer)
 {
     unsigned char a(1);
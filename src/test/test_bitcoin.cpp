@@ -81,7 +81,8 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         pblocktree.reset(new CBlockTreeDB(1 << 20, true));
         pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
         psidechaintree.reset(new CSidechainTreeDB(1 << 20, true));
-        pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+        pcoinsflusher.reset(new CCoinsViewFlusher(pcoinsdbview.get()));
+        pcoinsTip.reset(new CCoinsViewCache(pcoinsflusher.get()));
         if (!LoadGenesisBlock(chainparams)) {
             throw std::runtime_error("LoadGenesisBlock failed.");
         }
@@ -109,6 +110,7 @@ TestingSetup::~TestingSetup()
         peerLogic.reset();
         UnloadBlockIndex();
         pcoinsTip.reset();
+        pcoinsflusher.reset();
         pcoinsdbview.reset();
         pblocktree.reset();
         psidechaintree.reset();
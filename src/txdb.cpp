@@ -6,8 +6,10 @@
 #include <txdb.h>
 
 #include <chainparams.h>
+#include <checkqueue.h>
 #include <consensus/params.h>
 #include <hash.h>
+#include <memusage.h>
 #include <random.h>
 #include <sidechain.h>
 #include <uint256.h>
@@ -58,7 +60,58 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
+//! Number of coins read by one CCoinsReadCheck
+static const size_t COINS_READ_CHECK_SIZE = 8;
+
+int nCoinsReadThreads = 0;
+
+/** Reads a range of (sorted) coins from the database on a coins read thread. */
+class CCoinsReadCheck
+{
+private:
+    const CDBWrapper* db;
+    const COutPoint* pOutPoint;
+    Coin* pCoin;
+    size_t nCount;
+
+public:
+    CCoinsReadCheck() : db(nullptr), pOutPoint(nullptr), pCoin(nullptr), nCount(0) {}
+    CCoinsReadCheck(const CDBWrapper& dbIn, const COutPoint* pOutPointIn, Coin* pCoinIn, size_t nCountIn) :
+        db(&dbIn), pOutPoint(pOutPointIn), pCoin(pCoinIn), nCount(nCountIn) {}
+
+    bool operator()()
+    {
+        try {
+            for (size_t i = 0; i < nCount; i++) {
+                if (!db->Read(CoinEntry(&pOutPoint[i]), pCoin[i]))
+                    pCoin[i].Clear();
+            }
+        } catch (const std::exception&) {
+            // Leave the error to be raised on the calling thread
+            return false;
+        }
+        return true;
+    }
+
+    void swap(CCoinsReadCheck& check)
+    {
+        std::swap(db, check.db);
+        std::swap(pOutPoint, check.pOutPoint);
+        std::swap(pCoin, check.pCoin);
+        std::swap(nCount, check.nCount);
+    }
+};
+
+static_assert(MAX_DB_READ_THREADS < MAX_CHECKQUEUE_WORKERS, "coins read threads need their own queue");
+static CCheckQueue<CCoinsReadCheck> coinsreadqueue(1);
+
+void ThreadCoinsRead()
+{
+    RenameThread("bitcoin-coinsread");
+    coinsreadqueue.Thread();
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, dbOptions)
 {
 }
 
@@ -70,6 +123,29 @@ bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
     return db.Exists(CoinEntry(&outpoint));
 }
 
+void CCoinsViewDB::GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const {
+    vCoin.resize(vOutPoint.size());
+
+    if (nCoinsReadThreads && vOutPoint.size() >= DB_READ_PARALLEL_MIN) {
+        // Hand out consecutive ranges so every thread reads keys close to each other
+        std::vector<CCoinsReadCheck> vChecks;
+        vChecks.reserve((vOutPoint.size() + COINS_READ_CHECK_SIZE - 1) / COINS_READ_CHECK_SIZE);
+        for (size_t i = 0; i < vOutPoint.size(); i += COINS_READ_CHECK_SIZE)
+            vChecks.emplace_back(db, &vOutPoint[i], &vCoin[i], std::min(COINS_READ_CHECK_SIZE, vOutPoint.size() - i));
+
+        CCheckQueueControl<CCoinsReadCheck> control(&coinsreadqueue);
+        control.Add(vChecks);
+        if (control.Wait())
+            return;
+        // One of the reads failed, do them again here so the error is thrown to the caller
+    }
+
+    for (size_t i = 0; i < vOutPoint.size(); i++) {
+        if (!db.Read(CoinEntry(&vOutPoint[i]), vCoin[i]))
+            vCoin[i].Clear();
+    }
+}
+
 uint256 CCoinsViewDB::GetBestBlock() const {
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
@@ -86,6 +162,12 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool ret = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -110,7 +192,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -120,8 +202,6 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -151,7 +231,163 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewFlusher::CCoinsViewFlusher(CCoinsViewDB* dbIn) : CCoinsViewBacked(dbIn), db(dbIn), nFlushUsage(0), nNextFlushUsage(0), fFlushing(false), fFlushFailed(false)
+{
+}
+
+CCoinsViewFlusher::~CCoinsViewFlusher()
+{
+    WaitForFlush();
+}
+
+void CCoinsViewFlusher::ThreadFlush()
+{
+    RenameThread("bitcoin-coinsflush");
+    int64_t nStart = GetTimeMicros();
+
+    // pFlushCoins is only replaced once this thread is done, read it without the lock like the lookups do
+    bool fOk = false;
+    try {
+        fOk = db->WriteCoins(*pFlushCoins, hashFlushBlock);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Error writing to coin database: %s\n", __func__, e.what());
+    }
+    LogPrint(BCLog::COINDB, "Background flush of %u coins to %s done in %.2fms\n", pFlushCoins->size(), hashFlushBlock.ToString(), (GetTimeMicros() - nStart) * 0.001);
+
+    // Free the coins outside of the lock, the database has them now
+    std::unique_ptr<CCoinsMap> pDone;
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        if (fOk) {
+            pDone = std::move(pFlushCoins);
+            nFlushUsage = 0;
+        } else {
+            // Keep serving the coins, they only exist here
+            fFlushFailed = true;
+        }
+        fFlushing = false;
+    }
+}
+
+bool CCoinsViewFlusher::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        if (pFlushCoins) {
+            CCoinsMap::const_iterator it = pFlushCoins->find(outpoint);
+            if (it != pFlushCoins->end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
+    // Not part of the write, so the database has the current version either way
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewFlusher::HaveCoin(const COutPoint &outpoint) const {
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        if (pFlushCoins) {
+            CCoinsMap::const_iterator it = pFlushCoins->find(outpoint);
+            if (it != pFlushCoins->end())
+                return !it->second.coin.IsSpent();
+        }
+    }
+    return base->HaveCoin(outpoint);
+}
+
+void CCoinsViewFlusher::GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const {
+    vCoin.resize(vOutPoint.size());
+
+    // Positions of the outpoints which aren't part of the write
+    std::vector<size_t> vMissing;
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        for (size_t i = 0; i < vOutPoint.size(); i++) {
+            CCoinsMap::const_iterator it;
+            if (!pFlushCoins || (it = pFlushCoins->find(vOutPoint[i])) == pFlushCoins->end()) {
+                vMissing.push_back(i);
+            } else if (it->second.coin.IsSpent()) {
+                vCoin[i].Clear();
+            } else {
+                vCoin[i] = it->second.coin;
+            }
+        }
+    }
+    if (vMissing.empty())
+        return;
+    if (vMissing.size() == vOutPoint.size()) {
+        base->GetCoins(vOutPoint, vCoin);
+        return;
+    }
+
+    std::vector<COutPoint> vMissingOutPoint;
+    vMissingOutPoint.reserve(vMissing.size());
+    for (size_t i : vMissing)
+        vMissingOutPoint.push_back(vOutPoint[i]);
+    std::vector<Coin> vMissingCoin;
+    base->GetCoins(vMissingOutPoint, vMissingCoin);
+    for (size_t i = 0; i < vMissing.size(); i++)
+        vCoin[vMissing[i]] = std::move(vMissingCoin[i]);
+}
+
+uint256 CCoinsViewFlusher::GetBestBlock() const {
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        if (pFlushCoins)
+            return hashFlushBlock;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewFlusher::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!WaitForFlush())
+        return false;
+
+    // The map alone leaves out the memory of the scripts, use the usage the
+    // cache reported before it was flushed when we have it
+    size_t nUsage = std::max(nNextFlushUsage, memusage::DynamicUsage(mapCoins));
+    nNextFlushUsage = 0;
+
+    std::unique_ptr<CCoinsMap> pCoins(new CCoinsMap());
+    pCoins->swap(mapCoins);
+    {
+        std::lock_guard<std::mutex> lock(cs_flush);
+        pFlushCoins = std::move(pCoins);
+        hashFlushBlock = hashBlock;
+        nFlushUsage = nUsage;
+        fFlushing = true;
+    }
+    threadFlush = std::thread(&CCoinsViewFlusher::ThreadFlush, this);
+    return true;
+}
+
+bool CCoinsViewFlusher::WaitForFlush()
+{
+    if (threadFlush.joinable())
+        threadFlush.join();
+    std::lock_guard<std::mutex> lock(cs_flush);
+    return !fFlushFailed;
+}
+
+bool CCoinsViewFlusher::IsFlushing() const
+{
+    std::lock_guard<std::mutex> lock(cs_flush);
+    return fFlushing;
+}
+
+size_t CCoinsViewFlusher::DynamicMemoryUsage() const
+{
+    std::lock_guard<std::mutex> lock(cs_flush);
+    return nFlushUsage;
+}
+
+void CCoinsViewFlusher::SetNextFlushUsage(size_t nUsage)
+{
+    nNextFlushUsage = nUsage;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, dbOptions) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -303,8 +539,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
     return true;
 }
 
-CSidechainTreeDB::CSidechainTreeDB(size_t nCacheSize, bool fMemory, bool fWipe)
-    : CDBWrapper(GetDataDir() / "blocks" / "sidechain", nCacheSize, fMemory, fWipe) { }
+CSidechainTreeDB::CSidechainTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions)
+    : CDBWrapper(GetDataDir() / "blocks" / "sidechain", nCacheSize, fMemory, fWipe, false, dbOptions) { }
 
 bool CSidechainTreeDB::WriteSidechainIndex(const std::vector<std::pair<uint256, const SidechainObj *> > &list)
 {
@@ -11,7 +11,10 @@
 #include <chain.h>
 
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -42,6 +45,47 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -dbreadthreads default
+static const int DEFAULT_DB_READ_THREADS = 4;
+//! max. -dbreadthreads
+static const int MAX_DB_READ_THREADS = 64;
+//! Bulk coin reads smaller than this are done on the calling thread
+static const size_t DB_READ_PARALLEL_MIN = 32;
+
+// LevelDB profiles of the databases. The coins are compressed already and
+// looked up one by one, larger table files keep the number of files of the
+// chainstate down. The sidechain database is mostly scans over large objects
+// which compress well.
+//! -coinsdbcompression default
+static const bool DEFAULT_COINSDB_COMPRESSION = false;
+//! -coinsdbfilesize default (MiB)
+static const int DEFAULT_COINSDB_FILE_SIZE = 32;
+//! -coinsdbmaxopenfiles default
+static const int DEFAULT_COINSDB_MAX_OPEN_FILES = 64;
+//! -coinsdbbloombits default
+static const int DEFAULT_COINSDB_BLOOM_BITS = 10;
+//! -blockindexdbcompression default
+static const bool DEFAULT_BLOCKINDEXDB_COMPRESSION = false;
+//! -blockindexdbfilesize default (MiB)
+static const int DEFAULT_BLOCKINDEXDB_FILE_SIZE = 2;
+//! -blockindexdbmaxopenfiles default
+static const int DEFAULT_BLOCKINDEXDB_MAX_OPEN_FILES = 64;
+//! -blockindexdbbloombits default
+static const int DEFAULT_BLOCKINDEXDB_BLOOM_BITS = 10;
+//! -sidechaindbcompression default
+static const bool DEFAULT_SIDECHAINDB_COMPRESSION = true;
+//! -sidechaindbfilesize default (MiB)
+static const int DEFAULT_SIDECHAINDB_FILE_SIZE = 2;
+//! -sidechaindbmaxopenfiles default
+static const int DEFAULT_SIDECHAINDB_MAX_OPEN_FILES = 64;
+//! -sidechaindbbloombits default
+static const int DEFAULT_SIDECHAINDB_BLOOM_BITS = 10;
+
+/** Number of threads reading coins from the database for bulk reads, 0 to read them on the calling thread */
+extern int nCoinsReadThreads;
+
+/** Run a thread reading coins from the database for CCoinsViewDB::GetCoins */
+void ThreadCoinsRead();
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -74,20 +118,75 @@ class CCoinsViewDB final : public CCoinsView
 protected:
     CDBWrapper db;
 public:
-    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    void GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Write the dirty coins of mapCoins like BatchWrite, without modifying mapCoins.
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
 };
 
+/**
+ * CCoinsView on top of the coin database which writes flushed coins in the
+ * background.
+ *
+ * BatchWrite takes over the coins, starts writing them to the database on a
+ * separate thread and returns right away, so the cache above it can be
+ * emptied and keep serving blocks while the database is being written. Until
+ * the write is done, lookups are answered from the coins being written first.
+ * A crash in the middle of a write is recovered from on startup like any other
+ * interrupted flush, using the head blocks the database keeps (see
+ * ReplayBlocks). Only one write is in progress at a time: BatchWrite waits for
+ * the previous one to finish first.
+ */
+class CCoinsViewFlusher final : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB* db;
+
+    mutable std::mutex cs_flush;
+    //! Coins handed over by the last BatchWrite, until they are in the database
+    std::unique_ptr<CCoinsMap> pFlushCoins;
+    uint256 hashFlushBlock;
+    size_t nFlushUsage;
+    //! Memory usage the next BatchWrite is expected to hand over, see SetNextFlushUsage
+    size_t nNextFlushUsage;
+    bool fFlushing;
+    bool fFlushFailed;
+    std::thread threadFlush;
+
+    void ThreadFlush();
+
+public:
+    explicit CCoinsViewFlusher(CCoinsViewDB* dbIn);
+    ~CCoinsViewFlusher();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    void GetCoins(const std::vector<COutPoint>& vOutPoint, std::vector<Coin>& vCoin) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+
+    //! Wait until the coins of the last BatchWrite are in the database. Returns false if writing them failed.
+    bool WaitForFlush();
+    //! Whether a background write is in progress
+    bool IsFlushing() const;
+    //! Memory held by the coins which are being written
+    size_t DynamicMemoryUsage() const;
+    //! Set the memory usage of the cache that is about to be flushed, including the scripts of its coins
+    void SetNextFlushUsage(size_t nUsage);
+};
+
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
 class CCoinsViewDBCursor: public CCoinsViewCursor
 {
@@ -114,7 +213,7 @@ private:
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
 
     CBlockTreeDB(const CBlockTreeDB&) = delete;
     CBlockTreeDB& operator=(const CBlockTreeDB&) = delete;
@@ -135,7 +234,7 @@ public:
 class CSidechainTreeDB : public CDBWrapper
 {
 public:
-    CSidechainTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CSidechainTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
     bool WriteSidechainIndex(const std::vector<std::pair<uint256, const SidechainObj *> > &list);
     bool WriteWithdrawalUpdate(const std::vector<SidechainWithdrawal>& vWithdrawal);
     bool WriteWithdrawalBundleUpdate(const SidechainWithdrawalBundle& withdrawalBundle);
@@ -7,6 +7,7 @@
 
 #include <arith_uint256.h>
 #include <base58.h>
+#include <blockfilemap.h>
 #include <bmmcache.h>
 #include <chain.h>
 #include <chainparams.h>
@@ -46,7 +47,9 @@
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <deque>
 #include <future>
+#include <mutex>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -168,7 +171,8 @@ public:
     // Block (dis)connection on a given view:
     DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, bool fCheckBMM = true);
+                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, bool fCheckBMM = true,
+                    BlockConnectTimes* pTimes = nullptr);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
@@ -230,6 +234,8 @@ uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
 bool fSidechainIndex = true;
+std::atomic<bool> fTrustVerifyJournal(false);
+int64_t nVerifyJournalSpotCheck = DEFAULT_REINDEX_SPOT_CHECK;
 
 uint256 hashAssumeValid;
 
@@ -248,6 +254,27 @@ const std::string strRefundMessageMagic = "REFUND DhjM9iNapSA 3e243e21\n";
 std::mutex mainBlockCacheMutex;
 std::mutex mainBlockCacheReorgMutex;
 
+/** Set when headers were accepted that the mainchain block cache wasn't brought up to date for yet */
+static std::atomic<bool> fMainchainReconcilePending(false);
+
+/** Result of the last CheckMainchainConnection */
+static std::atomic<bool> fMainchainConnected(false);
+
+/** Mainchain connection status set by SetMockMainchainConnected, -1 if not mocked */
+static std::atomic<int> nMockMainchainConnected(-1);
+
+/**
+ * Mainchain blocks orphaned by reorgs that the mainchain thread found. The
+ * thread can't disconnect sidechain blocks itself, the next block or headers
+ * message handles them with HandlePendingMainchainReorg.
+ */
+static std::mutex cs_mainchainReorgPending;
+static std::vector<uint256> vMainchainOrphanPending;
+static std::atomic<bool> fMainchainReorgPending(false);
+
+/** Verification journal records which haven't been written yet, guarded by cs_main */
+static std::vector<BlockVerifyRecord> vVerifyJournalPending;
+
 // Internal stuff
 namespace {
     CBlockIndex *&pindexBestInvalid = g_chainstate.pindexBestInvalid;
@@ -292,6 +319,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewFlusher> pcoinsflusher;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 std::unique_ptr<CSidechainTreeDB> psidechaintree;
@@ -307,6 +335,11 @@ enum FlushStateMode {
 static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &state, FlushStateMode mode, int nManualPruneHeight=0);
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
+static bool GetTrustedVerifyRecord(const CBlock& block, BlockVerifyRecord& record);
+static bool HaveJournaledBundleStatus(const CBlock& block, const uint256& hashWithdrawalBundle, bool fFailed);
+static void AppendVerifyJournal(const CBlock& block, bool fBundleStatusVerified);
+static void WriteVerifyJournal();
+static bool CheckWithdrawalRefundRequest(const uint256& id, const std::vector<unsigned char>& vchSig, const SidechainWithdrawal& withdrawal);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 
@@ -705,11 +738,20 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
         view.SetBackend(viewMemPool);
 
-        // do all inputs exist?
-        for (const CTxIn txin : tx.vin) {
+        // Remember which inputs weren't cached yet, so that they can be
+        // uncached again if the transaction is rejected, and read them from
+        // the database together.
+        const size_t nUncacheStart = coins_to_uncache.size();
+        for (const CTxIn& txin : tx.vin) {
             if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
                 coins_to_uncache.push_back(txin.prevout);
             }
+        }
+        if (coins_to_uncache.size() - nUncacheStart > 1)
+            pcoinsTip->PrefetchCoins(std::vector<COutPoint>(coins_to_uncache.begin() + nUncacheStart, coins_to_uncache.end()));
+
+        // do all inputs exist?
+        for (const CTxIn txin : tx.vin) {
             if (!view.HaveCoin(txin.prevout)) {
                 // Are inputs missing because we already have the tx?
                 for (size_t out = 0; out < tx.vout.size(); out++) {
@@ -1171,10 +1213,50 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
+static CBlockFileMap blockfilemap(MAX_MAPPED_BLOCK_FILES);
+
+/**
+ * Find the record at pos of a block or undo file in a mapping of the file.
+ * Records are preceded by the network magic and their size, nExtra bytes
+ * following the record are included. Returns false if the file can't be
+ * mapped, in which case it has to be read with OpenDiskFile.
+ */
+static bool MapDiskRecord(const CDiskBlockPos& pos, const char* prefix, size_t nExtra, std::shared_ptr<const CMappedFile>& file, const char*& pbegin, size_t& nSize)
+{
+    if (pos.IsNull() || pos.nPos < 8)
+        return false;
+    file = blockfilemap.Get(pos.nFile, prefix, pos.nPos);
+    if (!file)
+        return false;
+    nSize = ReadLE32((const unsigned char*)file->data() + pos.nPos - 4) + nExtra;
+    if (file->size() - pos.nPos < nSize) {
+        file = blockfilemap.Get(pos.nFile, prefix, (size_t)pos.nPos + nSize);
+        if (!file)
+            return false;
+    }
+    pbegin = file->data() + pos.nPos;
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
+    // Deserialize straight from the mapped file if possible
+    std::shared_ptr<const CMappedFile> file;
+    const char* pbegin;
+    size_t nSize;
+    if (MapDiskRecord(pos, "blk", 0, file, pbegin, nSize)) {
+        try {
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, pbegin, nSize);
+            reader >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1207,6 +1289,125 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+//! Append the next nSize bytes of reader to out
+static void CopyRawBytes(CSpanReader& reader, std::vector<unsigned char>& out, size_t nSize)
+{
+    const size_t nPos = out.size();
+    out.resize(nPos + nSize);
+    reader.read((char*)out.data() + nPos, nSize);
+}
+
+static void CopyRawCompactSize(CSpanReader& reader, std::vector<unsigned char>& out, uint64_t& n)
+{
+    n = ReadCompactSize(reader);
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, out, out.size()) << COMPACTSIZE(n);
+}
+
+//! Append a script, or any other byte vector, of reader to out
+static void CopyRawScript(CSpanReader& reader, std::vector<unsigned char>& out)
+{
+    uint64_t nSize;
+    CopyRawCompactSize(reader, out, nSize);
+    CopyRawBytes(reader, out, nSize);
+}
+
+void StripRawBlockWitness(CSpanReader& reader, std::vector<unsigned char>& out)
+{
+    static const size_t nHeaderSize = ::GetSerializeSize(CBlockHeader(), SER_NETWORK, PROTOCOL_VERSION);
+    CopyRawBytes(reader, out, nHeaderSize);
+
+    uint64_t nTx;
+    CopyRawCompactSize(reader, out, nTx);
+    for (uint64_t i = 0; i < nTx; i++) {
+        // Follows UnserializeTransaction, see there for the extended format
+        int32_t nVersion;
+        reader >> nVersion;
+        CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, out, out.size()) << nVersion;
+        if (nVersion == 3)
+            CopyRawBytes(reader, out, 1);
+
+        uint64_t nIn = ReadCompactSize(reader);
+        unsigned char flags = 0;
+        if (nIn == 0) {
+            // An empty vin followed by flags, or by an empty vout which is the same byte
+            reader >> flags;
+            if (flags != 0)
+                nIn = ReadCompactSize(reader);
+        }
+        CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, out, out.size()) << COMPACTSIZE(nIn);
+        for (uint64_t j = 0; j < nIn; j++) {
+            CopyRawBytes(reader, out, 36); // prevout
+            CopyRawScript(reader, out);
+            CopyRawBytes(reader, out, 4); // nSequence
+        }
+        if (nIn == 0 && flags == 0) {
+            out.push_back(0);
+        } else {
+            uint64_t nOut;
+            CopyRawCompactSize(reader, out, nOut);
+            for (uint64_t j = 0; j < nOut; j++) {
+                CopyRawBytes(reader, out, 8); // nValue
+                CopyRawScript(reader, out);
+            }
+        }
+
+        if (flags & 1) {
+            flags ^= 1;
+            for (uint64_t j = 0; j < nIn; j++) {
+                uint64_t nItems = ReadCompactSize(reader);
+                for (uint64_t k = 0; k < nItems; k++)
+                    reader.ignore(ReadCompactSize(reader));
+            }
+        }
+        if (flags)
+            throw std::ios_base::failure("Unknown transaction optional data");
+        CopyRawBytes(reader, out, 4); // nLockTime
+    }
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fWitness)
+{
+    block.clear();
+
+    CDiskBlockPos blockPos;
+    {
+        LOCK(cs_main);
+        blockPos = pindex->GetBlockPos();
+    }
+
+    std::shared_ptr<const CMappedFile> file;
+    const char* pbegin;
+    size_t nSize;
+    if (!MapDiskRecord(blockPos, "blk", 0, file, pbegin, nSize)) {
+        // Without a mapping there are no bytes to copy, serialize the block again
+        CBlock blockRead;
+        if (!ReadBlockFromDisk(blockRead, pindex, consensusParams))
+            return false;
+        CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | (fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS), block, 0, blockRead);
+        return true;
+    }
+
+    try {
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, pbegin, nSize);
+        CBlockHeader header;
+        reader >> header;
+        if (header.GetHash() != pindex->GetBlockHash())
+            return error("ReadRawBlockFromDisk(CBlockIndex*): GetHash() doesn't match index for %s at %s",
+                    pindex->ToString(), blockPos.ToString());
+
+        if (fWitness) {
+            block.assign(pbegin, pbegin + nSize);
+        } else {
+            CSpanReader readerBlock(SER_DISK, CLIENT_VERSION, pbegin, nSize);
+            StripRawBlockWitness(readerBlock, block);
+        }
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), blockPos.ToString());
+    }
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     return 0;
@@ -1528,6 +1729,27 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
         return error("%s: no undo data available", __func__);
     }
 
+    // Deserialize straight from the mapped file if possible, the record is followed by its checksum
+    std::shared_ptr<const CMappedFile> file;
+    const char* pbegin;
+    size_t nSize;
+    if (MapDiskRecord(pos, "rev", sizeof(uint256), file, pbegin, nSize)) {
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, pbegin, nSize);
+        uint256 hashChecksum;
+        CHashVerifier<CSpanReader> verifier(&reader);
+        try {
+            verifier << pindex->pprev->GetBlockHash();
+            verifier >> blockundo;
+            reader >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s", __func__, e.what());
+        }
+        if (hashChecksum != verifier.GetHash())
+            return error("%s: Checksum mismatch", __func__);
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1763,6 +1985,10 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    // Drop the mappings covering the preallocated space that is truncated away
+    if (fFinalize)
+        blockfilemap.Invalidate(nLastBlockFile);
+
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -1821,6 +2047,7 @@ static bool WriteTxIndexDataForBlock(const CBlock& block, CValidationState& stat
     return true;
 }
 
+static_assert(MAX_SCRIPTCHECK_THREADS < MAX_CHECKQUEUE_WORKERS, "script check threads need their own queue");
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck() {
@@ -1911,6 +2138,7 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -1918,315 +2146,314 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 static int64_t nBlocksTotal = 0;
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
- *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
-bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, bool fCheckBMM)
-{
-    AssertLockHeld(cs_main);
-    assert(pindex);
-    // pindex->phashBlock can be null if called by CreateNewBlock/TestBlockValidity
-    assert((pindex->phashBlock == nullptr) ||
-           (*pindex->phashBlock == block.GetHash()));
-    int64_t nTimeStart = GetTimeMicros();
-
-    // Check it again in case a previous version let a bad block in
-    // NOTE: We don't currently (re-)invoke ContextualCheckBlock() or
-    // ContextualCheckBlockHeader() here. This means that if we add a new
-    // consensus rule that is enforced in one of those two functions, then we
-    // may have let in a block that violates the rule prior to updating the
-    // software, and we would NOT be enforcing the rule here. Fully solving
-    // upgrade from one software version to the next after a consensus rule
-    // change is potentially tricky and issue-specific (see RewindBlockIndex()
-    // for one general approach that was used for BIP 141 deployment).
-    // Also, currently the rule against blocks more than 2 hours in the future
-    // is enforced in ContextualCheckBlockHeader(); we wouldn't want to
-    // re-enforce that rule here (at least until we make it impossible for
-    // GetAdjustedTime() to go backward).
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck /* fCheckMerkleRoot */, fCheckBMM))
-        return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
-
-    // verify that the view's current state corresponds to the previous block
-    uint256 hashPrevBlock = pindex->pprev == nullptr ? uint256() : pindex->pprev->GetBlockHash();
-    assert(hashPrevBlock == view.GetBestBlock());
-
-    // Special case for the genesis block, skipping connection of its transactions
-    // (its coinbase is unspendable)
-    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
-            view.SetBestBlock(pindex->GetBlockHash());
-        return true;
-    }
-
-    nBlocksTotal++;
-
-    bool fScriptChecks = true;
-
-    int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
-    LogPrint(BCLog::BENCH, "    - Sanity checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime1 - nTimeStart), nTimeCheck * MICRO, nTimeCheck * MILLI / nBlocksTotal);
-
-    // Do not allow blocks that contain transactions which 'overwrite' older transactions,
-    // unless those are already completely spent.
-    // If such overwrites are allowed, coinbases and transactions depending upon those
-    // can be duplicated to remove the ability to spend the first instance -- even after
-    // being sent to another address.
-    // See BIP30 and http://r6.ca/blog/20120206T005236Z.html for more information.
-    // This logic is not necessary for memory pool transactions, as AcceptToMemoryPool
-    // already refuses previously-known transaction ids entirely.
-    // This rule was originally applied to all blocks with a timestamp after March 15, 2012, 0:00 UTC.
-    // Now that the whole chain is irreversibly beyond that time it is applied to all blocks except the
-    // two in the chain that violate it. This prevents exploiting the issue against nodes during their
-    // initial block download.
-    bool fEnforceBIP30 = (!pindex->phashBlock) || // Enforce on CreateNewBlock invocations which don't have a hash.
-                          !((pindex->nHeight==91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) ||
-                           (pindex->nHeight==91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
-
-    // Once BIP34 activated it was not possible to create new duplicate coinbases and thus other than starting
-    // with the 2 existing duplicate coinbase pairs, not possible to create overwriting txs.  But by the
-    // time BIP34 activated, in each of the existing pairs the duplicate coinbase had overwritten the first
-    // before the first had been spent.  Since those coinbases are sufficiently buried its no longer possible to create further
-    // duplicate transactions descending from the known pairs either.
-    // If we're on the known chain at height greater than where BIP34 activated, we can save the db accesses needed for the BIP30 check.
-    assert(pindex->pprev);
-    CBlockIndex *pindexBIP34height = pindex->pprev->GetAncestor(chainparams.GetConsensus().BIP34Height);
-    //Only continue to enforce if we're below BIP34 activation height or the block hash at that height doesn't correspond.
-    fEnforceBIP30 = fEnforceBIP30 && (!pindexBIP34height || !(pindexBIP34height->GetBlockHash() == chainparams.GetConsensus().BIP34Hash));
-
-    if (fEnforceBIP30) {
-        for (const auto& tx : block.vtx) {
-            for (size_t o = 0; o < tx->vout.size(); o++) {
-                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
-                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                     REJECT_INVALID, "bad-txns-BIP30");
-                }
-            }
-        }
-    }
+/** Connect timings of the last blocks connected to the tip */
+static std::mutex mutexBlockConnectTimes;
+static std::deque<BlockConnectTimes> dequeBlockConnectTimes;
 
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
-    int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
+std::vector<BlockConnectTimes> GetBlockConnectTimes()
+{
+    std::lock_guard<std::mutex> lock(mutexBlockConnectTimes);
+    return std::vector<BlockConnectTimes>(dequeBlockConnectTimes.begin(), dequeBlockConnectTimes.end());
+}
 
-    // Get the script flags for this block
-    unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
+static void RecordBlockConnectTimes(const BlockConnectTimes& times)
+{
+    std::lock_guard<std::mutex> lock(mutexBlockConnectTimes);
+    dequeBlockConnectTimes.push_back(times);
+    if (dequeBlockConnectTimes.size() > MAX_BLOCK_CONNECT_TIMES)
+        dequeBlockConnectTimes.pop_front();
+}
 
-    int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
-    LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
+/**
+ * Sidechain db and journal data that CheckSidechainConnect needs, read under
+ * cs_main by the thread connecting the block so that the checks don't touch
+ * the sidechain db or the BMM cache while running on their own.
+ */
+struct SidechainConnectSnapshot
+{
+    // The current deposit CTIP, for checking the first new deposit
+    bool fHaveLastDeposit = false;
+    SidechainDeposit lastDeposit;
 
-    CBlockUndo blockundo;
+    // The withdrawals that refund requests in the block refund, by ID
+    std::map<uint256, SidechainWithdrawal> mapRefundWithdrawal;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    // Withdrawal bundle status updates (hash, failed) that the verification
+    // journal already verified
+    std::set<std::pair<uint256, bool> > setJournaledBundleStatus;
+};
 
-    std::vector<int> prevheights;
-    CAmount nFees = 0;
-    int nInputs = 0;
-    int64_t nSigOpsCost = 0;
-    blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<PrecomputedTransactionData> txdata;
-    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+/** Results of the sidechain checks that ConnectBlock runs next to the transaction loop. */
+struct SidechainConnectChecks
+{
+    CValidationState state;
     CAmount nDepositPayout = 0;
     CAmount nRefundPayout = 0;
-    std::multimap<std::pair<CScript, CAmount>, uint256> mapRefundOutputs;
     std::vector<SidechainWithdrawal> vRefundedWithdrawal;
-    std::set<uint256> setRefundWithdrawalID;
-    for (unsigned int i = 0; i < block.vtx.size(); i++)
-    {
-        const CTransaction &tx = *(block.vtx[i]);
 
-        nInputs += tx.vin.size();
+    // Index of the transaction a failure in state would be found at when
+    // connecting the block one transaction at a time, block.vtx.size() if it
+    // would be found after the transaction loop. ConnectBlock uses it to
+    // report the same failure as before the checks were moved out of the
+    // loop when a block has several problems.
+    size_t nFailTx = 0;
+
+    // The first withdrawal bundle status update the mainchain didn't
+    // confirm. ConnectBlock reports it where it writes the bundle status.
+    bool fBundleStatusInvalid = false;
+    uint256 hashBundleStatusInvalid;
+    bool fBundleStatusInvalidFail = false;
+
+    // How long each part of the checks took, in microseconds
+    int64_t nTimeRefunds = 0;
+    int64_t nTimeDeposits = 0;
+    int64_t nTimeBundleStatus = 0;
+};
 
-        // Find & verify refund request txns - verify coinbase payouts later
-        for (const CTxOut& o : tx.vout) {
-            const CScript& scriptPubKey = o.scriptPubKey;
+static void SnapshotSidechainConnect(const CBlock& block, bool fCheckBMM, bool fCheckBundleStatus, SidechainConnectSnapshot& snapshot)
+{
+    AssertLockHeld(cs_main);
+
+    for (const CTransactionRef& tx : block.vtx) {
+        for (const CTxOut& o : tx->vout) {
             uint256 id;
             std::vector<unsigned char> vchSig;
-            if (!scriptPubKey.IsWithdrawalRefundRequest(id, vchSig))
+            if (!o.scriptPubKey.IsWithdrawalRefundRequest(id, vchSig) || id.IsNull())
                 continue;
 
-            if (id.IsNull()) {
-                return state.DoS(100, error("%s: Invalid Withdrawal refund!", __func__),
-                            REJECT_INVALID, "verify-withdrawal-refund-no-script");
-            }
-
             SidechainWithdrawal withdrawal;
-            if (!VerifyWithdrawalRefundRequest(id, vchSig, withdrawal)) {
-                return state.DoS(100, error("%s: Invalid Withdrawal refund!", __func__),
-                            REJECT_INVALID, "verify-withdrawal-refund-invalid");
-            }
+            if (psidechaintree->GetWithdrawal(id, withdrawal))
+                snapshot.mapRefundWithdrawal[id] = withdrawal;
+        }
+    }
 
-            if (setRefundWithdrawalID.count(id)) {
-                return state.DoS(100, error("%s: Invalid Withdrawal refund!", __func__),
-                            REJECT_INVALID, "verify-withdrawal-refund-duplicate");
+    if (fCheckBMM) {
+        for (const CTxOut& out : block.vtx[0]->vout) {
+            std::vector<unsigned char> vch;
+            if (out.scriptPubKey.IsSidechainObj(vch)) {
+                snapshot.fHaveLastDeposit = psidechaintree->GetLastDeposit(snapshot.lastDeposit);
+                break;
             }
-            setRefundWithdrawalID.insert(id);
+        }
+    }
 
-            // Keep track of refund request outputs so that we can verify they
-            // each have a matching coinbase payout output later.
-            CScript scriptDest = GetScriptForDestination(DecodeDestination(withdrawal.strRefundDestination));
-            mapRefundOutputs.insert(std::pair<std::pair<CScript, CAmount>, uint256>( std::make_pair(scriptDest, withdrawal.amount), id));
+    if (fCheckBundleStatus) {
+        for (const CTxOut& txout : block.vtx[0]->vout) {
+            uint256 hashWithdrawalBundle;
+            bool fFailCommit = txout.scriptPubKey.IsWithdrawalBundleFailCommit(hashWithdrawalBundle);
 
-            // Update withdrawal object status and keep track of it so that we can apply
-            // the update later if all verification checks work out.
-            withdrawal.status = WITHDRAWAL_SPENT;
-            vRefundedWithdrawal.push_back(withdrawal);
+            if (!fFailCommit && !txout.scriptPubKey.IsWithdrawalBundleSpentCommit(hashWithdrawalBundle))
+                continue;
 
-            // Keep track of the total refunded Withdrawal amount for the block
-            nRefundPayout += withdrawal.amount;
+            if (HaveJournaledBundleStatus(block, hashWithdrawalBundle, fFailCommit))
+                snapshot.setJournaledBundleStatus.insert(std::make_pair(hashWithdrawalBundle, fFailCommit));
         }
+    }
+}
 
-        // Perform non coinbase txn checks
-        if (!tx.IsCoinBase())
-        {
-            CAmount txfee = 0;
-            if (!Consensus::CheckTxInputs(tx, state, view, pindex->nHeight, txfee)) {
-                return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
-            }
-            nFees += txfee;
-            if (!MoneyRange(nFees)) {
-                return state.DoS(100, error("%s: accumulated fee in the block out of range.", __func__),
-                                 REJECT_INVALID, "bad-txns-accumulated-fee-outofrange");
-            }
+/** Find & verify the refund requests of one of the block's transactions */
+static bool CheckRefundRequests(const CTransaction& tx, const SidechainConnectSnapshot& snapshot, SidechainConnectChecks& checks,
+        std::multimap<std::pair<CScript, CAmount>, uint256>& mapRefundOutputs, std::set<uint256>& setRefundWithdrawalID)
+{
+    CValidationState& state = checks.state;
 
-            // Check that transaction is BIP68 final
-            // BIP68 lock checks (as opposed to nLockTime checks) must
-            // be in ConnectBlock because they require the UTXO set
-            prevheights.resize(tx.vin.size());
-            for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
-            }
+    for (const CTxOut& o : tx.vout) {
+        const CScript& scriptPubKey = o.scriptPubKey;
+        uint256 id;
+        std::vector<unsigned char> vchSig;
+        if (!scriptPubKey.IsWithdrawalRefundRequest(id, vchSig))
+            continue;
 
-            if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
-                return state.DoS(100, error("%s: contains a non-BIP68-final transaction", __func__),
-                                 REJECT_INVALID, "bad-txns-nonfinal");
-            }
+        if (id.IsNull()) {
+            return state.DoS(100, error("%s: Invalid Withdrawal refund!", __func__),
+                        REJECT_INVALID, "verify-withdrawal-refund-no-script");
         }
 
-        // Count deposit output amounts and collect deposits
-        std::vector<SidechainDeposit> vDeposit;
-        if (tx.IsCoinBase()) {
-            for (const CTxOut& out : tx.vout) {
-                const CScript& scriptPubKey = out.scriptPubKey;
+        std::map<uint256, SidechainWithdrawal>::const_iterator it = snapshot.mapRefundWithdrawal.find(id);
+        if (it == snapshot.mapRefundWithdrawal.end() || !CheckWithdrawalRefundRequest(id, vchSig, it->second)) {
+            return state.DoS(100, error("%s: Invalid Withdrawal refund!", __func__),
+                        REJECT_INVALID, "verify-withdrawal-refund-invalid");
+        }
+        SidechainWithdrawal withdrawal = it->second;
 
-                std::vector<unsigned char> vch;
-                if (!scriptPubKey.IsSidechainObj(vch))
-                    continue;
+        if (setRefundWithdrawalID.count(id)) {
+            return state.DoS(100, error("%s: Invalid Withdrawal refund!", __func__),
+                        REJECT_INVALID, "verify-withdrawal-refund-duplicate");
+        }
+        setRefundWithdrawalID.insert(id);
 
-                SidechainObj *obj = ParseSidechainObj(vch);
-                if (!obj) {
-                    return state.DoS(90, error("%s: invalid sidechain obj script", __func__), REJECT_INVALID, "invalid-sidechain-obj-script");
-                }
+        // Keep track of refund request outputs so that we can verify they
+        // each have a matching coinbase payout output later.
+        CScript scriptDest = GetScriptForDestination(DecodeDestination(withdrawal.strRefundDestination));
+        mapRefundOutputs.insert(std::pair<std::pair<CScript, CAmount>, uint256>( std::make_pair(scriptDest, withdrawal.amount), id));
 
-                if (obj->sidechainop != DB_SIDECHAIN_DEPOSIT_OP)
-                    continue;
+        // Update withdrawal object status and keep track of it so that we can apply
+        // the update later if all verification checks work out.
+        withdrawal.status = WITHDRAWAL_SPENT;
+        checks.vRefundedWithdrawal.push_back(withdrawal);
 
-                const SidechainDeposit *deposit = (const SidechainDeposit *) obj;
+        // Keep track of the total refunded Withdrawal amount for the block
+        checks.nRefundPayout += withdrawal.amount;
+    }
 
-                nDepositPayout += deposit->amtUserPayout;
+    return true;
+}
 
-                vDeposit.push_back(SidechainDeposit(deposit));
+/** Count & verify the deposit payouts of the block's coinbase */
+static bool CheckDepositPayouts(const CBlock& block, bool fCheckBMM, const SidechainConnectSnapshot& snapshot, SidechainConnectChecks& checks)
+{
+    CValidationState& state = checks.state;
 
-                delete obj;
+    // Count deposit output amounts and collect deposits
+    std::vector<SidechainDeposit> vDeposit;
+    for (const CTxOut& out : block.vtx[0]->vout) {
+        const CScript& scriptPubKey = out.scriptPubKey;
+
+        std::vector<unsigned char> vch;
+        if (!scriptPubKey.IsSidechainObj(vch))
+            continue;
+
+        SidechainObj *obj = ParseSidechainObj(vch);
+        if (!obj) {
+            return state.DoS(90, error("%s: invalid sidechain obj script", __func__), REJECT_INVALID, "invalid-sidechain-obj-script");
+        }
+
+        if (obj->sidechainop != DB_SIDECHAIN_DEPOSIT_OP) {
+            delete obj;
+            continue;
+        }
+
+        const SidechainDeposit *deposit = (const SidechainDeposit *) obj;
+
+        checks.nDepositPayout += deposit->amtUserPayout;
+
+        vDeposit.push_back(SidechainDeposit(deposit));
+
+        delete obj;
+    }
+
+    // Verify new deposit payouts
+    //
+    // - Find the previous deposit CTIP (input for first new deposit)
+    //
+    // - Re-calculate the deposit payouts ourselves
+    //
+    // - Loop through all of the rest of the deposits, recalculating
+    // and verifying their deposit payout amounts
+    //
+    // - Check for a coinbase payout output matching each deposit
+    //
+    if (fCheckBMM && vDeposit.size()) {
+        const SidechainDeposit& prev = snapshot.lastDeposit;
+
+        CAmount amountPrev = CAmount(0);
+        if (snapshot.fHaveLastDeposit) {
+            // First deposit should be spending current CTIP, find the
+            // current CTIP in the deposit's inputs
+            bool fFound = false;
+            for (const CTxIn& in : vDeposit.front().dtx.vin) {
+                if (in.prevout.hash == prev.dtx.GetHash() &&
+                        prev.dtx.vout.size() > in.prevout.n &&
+                        prev.nBurnIndex == in.prevout.n) {
+                    fFound = true;
+                    break;
+                }
+            }
+            if (!fFound) {
+                return state.DoS(90, error("%s: invalid sidechain deposit input:\n%s", __func__, vDeposit.front().ToString()), REJECT_INVALID, "invalid-deposit-input");
             }
+            // Copy the burn amount from CTIP
+            amountPrev = prev.dtx.vout[prev.nBurnIndex].nValue;
         }
 
-        // Verify new deposit payouts
-        //
-        // - Find the previous deposit CTIP (input for first new deposit)
-        //
-        // - Re-calculate the deposit payouts ourselves
-        //
-        // - Loop through all of the rest of the deposits, recalculating
-        // and verifying their deposit payout amounts
-        //
-        // - Check for a coinbase payout output matching each deposit
-        //
-        if (fCheckBMM && vDeposit.size()) {
-            SidechainDeposit prev;
-            bool fHaveDeposits = psidechaintree->GetLastDeposit(prev);
-
-            CAmount amountPrev = CAmount(0);
-            if (fHaveDeposits) {
-                // First deposit should be spending current CTIP, find the
-                // current CTIP in the deposit's inputs
+        // Check deposit payout amounts & find coinbase output
+        for (size_t i = 0; i < vDeposit.size(); i++) {
+            const SidechainDeposit& d = vDeposit[i];
+
+            if (d.nBurnIndex >= d.dtx.vout.size()) {
+                return state.DoS(100, error("%s: invalid sidechain deposit output:\n%s", __func__, d.ToString()), REJECT_INVALID, "invalid-deposit-output");
+            }
+
+            // Every deposit after the first should be spending the CTIP
+            // created by the deposit before it
+            if (i > 0) {
+                const COutPoint ctip(vDeposit[i - 1].dtx.GetHash(), vDeposit[i - 1].nBurnIndex);
                 bool fFound = false;
-                for (const CTxIn& in : vDeposit.front().dtx.vin) {
-                    if (in.prevout.hash == prev.dtx.GetHash() &&
-                            prev.dtx.vout.size() > in.prevout.n &&
-                            prev.nBurnIndex == in.prevout.n) {
+                for (const CTxIn& in : d.dtx.vin) {
+                    if (in.prevout == ctip) {
                         fFound = true;
                         break;
                     }
                 }
                 if (!fFound) {
-                    return state.DoS(90, error("%s: invalid sidechain deposit input:\n%s", __func__, vDeposit.front().ToString()), REJECT_INVALID, "invalid-deposit-input");
+                    return state.DoS(90, error("%s: invalid sidechain deposit input:\n%s", __func__, d.ToString()), REJECT_INVALID, "invalid-deposit-input");
                 }
-                // Copy the burn amount from CTIP
-                amountPrev = prev.dtx.vout[prev.nBurnIndex].nValue;
             }
 
-            // Check deposit payout amounts & find coinbase output
-            for (const SidechainDeposit& d : vDeposit) {
-
-                CAmount burn = d.dtx.vout[d.nBurnIndex].nValue;
-                CAmount payout = burn - amountPrev;
+            CAmount burn = d.dtx.vout[d.nBurnIndex].nValue;
+            CAmount payout = burn - amountPrev;
 
-                amountPrev = burn;
+            amountPrev = burn;
 
-                if (d.amtUserPayout == 0 && d.strDest == SIDECHAIN_WITHDRAWAL_BUNDLE_RETURN_DEST)
-                    continue;
+            if (d.amtUserPayout == 0 && d.strDest == SIDECHAIN_WITHDRAWAL_BUNDLE_RETURN_DEST)
+                continue;
 
-                if (d.amtUserPayout != payout) {
-                    return state.DoS(90, error("%s: invalid sidechain deposit amount:\n%s", __func__, d.ToString()), REJECT_INVALID, "invalid-deposit-amount");
-                }
+            if (d.amtUserPayout != payout) {
+                return state.DoS(90, error("%s: invalid sidechain deposit amount:\n%s", __func__, d.ToString()), REJECT_INVALID, "invalid-deposit-amount");
+            }
 
-                // Now check coinbase outputs
-                bool fFound = false;
-                for (const CTxOut& o : block.vtx[0]->vout) {
-                    if (o.nValue == d.amtUserPayout - SIDECHAIN_DEPOSIT_FEE &&
-                            o.scriptPubKey == GetScriptForDestination(
-                                DecodeDestination(d.strDest)))
-                    {
-                        fFound = true;
-                        break;
-                    }
-                }
-                if (!fFound) {
-                    return state.DoS(90, error("%s: sidechain deposit missing output:\n%s", __func__, d.ToString()), REJECT_INVALID, "invalid-deposit-missing-output");
+            // Now check coinbase outputs
+            bool fFound = false;
+            for (const CTxOut& o : block.vtx[0]->vout) {
+                if (o.nValue == d.amtUserPayout - SIDECHAIN_DEPOSIT_FEE &&
+                        o.scriptPubKey == GetScriptForDestination(
+                            DecodeDestination(d.strDest)))
+                {
+                    fFound = true;
+                    break;
                 }
             }
+            if (!fFound) {
+                return state.DoS(90, error("%s: sidechain deposit missing output:\n%s", __func__, d.ToString()), REJECT_INVALID, "invalid-deposit-missing-output");
+            }
         }
+    }
 
-        // GetTransactionSigOpCost counts 3 types of sigops:
-        // * legacy (always)
-        // * p2sh (when P2SH enabled in flags and excludes coinbase)
-        // * witness (when witness enabled in flags and excludes coinbase)
-        nSigOpsCost += GetTransactionSigOpCost(tx, view, flags);
-        if (nSigOpsCost > MAX_BLOCK_SIGOPS_COST)
-            return state.DoS(100, error("ConnectBlock(): too many sigops"),
-                             REJECT_INVALID, "bad-blk-sigops");
+    return true;
+}
 
-        txdata.emplace_back(tx);
-        if (!tx.IsCoinBase())
-        {
-            std::vector<CScriptCheck> vChecks;
-            bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
-                return error("ConnectBlock(): CheckInputs on %s failed with %s",
-                    tx.GetHash().ToString(), FormatStateMessage(state));
-            control.Add(vChecks);
-        }
+/**
+ * Verify the sidechain specific contents of a block being connected: the
+ * withdrawal refund requests and their coinbase payouts, the deposit payouts
+ * and, if fCheckBundleStatus, the withdrawal bundle status updates against
+ * the mainchain. The checks run in the order ConnectBlock used to run them
+ * in. They only use the snapshot and don't read the coins view, so
+ * ConnectBlock can run them concurrently with input checks and script
+ * verification.
+ */
+static bool CheckSidechainConnect(const CBlock& block, bool fCheckBMM, bool fCheckBundleStatus, const SidechainConnectSnapshot& snapshot, SidechainConnectChecks& checks)
+{
+    CValidationState& state = checks.state;
 
-        CTxUndo undoDummy;
-        if (i > 0) {
-            blockundo.vtxundo.push_back(CTxUndo());
+    int64_t nTimeStart = GetTimeMicros();
+
+    // Find & verify refund request txns, and the deposits after the refund
+    // requests of the coinbase
+    std::multimap<std::pair<CScript, CAmount>, uint256> mapRefundOutputs;
+    std::set<uint256> setRefundWithdrawalID;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        checks.nFailTx = i;
+        if (!CheckRefundRequests(*block.vtx[i], snapshot, checks, mapRefundOutputs, setRefundWithdrawalID))
+            return false;
+
+        if (i == 0) {
+            int64_t nTimeDepositStart = GetTimeMicros();
+            if (!CheckDepositPayouts(block, fCheckBMM, snapshot, checks))
+                return false;
+            checks.nTimeDeposits = GetTimeMicros() - nTimeDepositStart;
         }
-        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
     }
-    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
-    LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
+    checks.nFailTx = block.vtx.size();
 
     // Verify Withdrawal refunds
     // - Check that for every Withdrawal refund request tx in the block a refund payout
@@ -2269,14 +2496,308 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         it = range.second;
     }
 
+    int64_t nTimeRefunds = GetTimeMicros();
+    checks.nTimeRefunds = nTimeRefunds - nTimeStart - checks.nTimeDeposits;
+
+    // Verify Withdrawal Bundle status updates with the mainchain, unless the
+    // journal says we already did. ConnectBlock writes the new status, and
+    // reports an update that isn't confirmed when it gets to it.
+    if (fCheckBundleStatus) {
+        SidechainClient client;
+        for (const CTxOut& txout : block.vtx[0]->vout) {
+            const CScript& scriptPubKey = txout.scriptPubKey;
+
+            uint256 hashWithdrawalBundle;
+            bool fFailCommit = scriptPubKey.IsWithdrawalBundleFailCommit(hashWithdrawalBundle);
+
+            if (!fFailCommit && !scriptPubKey.IsWithdrawalBundleSpentCommit(hashWithdrawalBundle))
+                continue;
+
+            if (snapshot.setJournaledBundleStatus.count(std::make_pair(hashWithdrawalBundle, fFailCommit)))
+                continue;
+
+            bool fVerified = fFailCommit ?
+                client.HaveFailedWithdrawalBundle(hashWithdrawalBundle) :
+                client.HaveSpentWithdrawalBundle(hashWithdrawalBundle);
+
+            if (!fVerified) {
+                checks.fBundleStatusInvalid = true;
+                checks.hashBundleStatusInvalid = hashWithdrawalBundle;
+                checks.fBundleStatusInvalidFail = fFailCommit;
+                break;
+            }
+        }
+    }
+
+    checks.nTimeBundleStatus = GetTimeMicros() - nTimeRefunds;
+
+    return true;
+}
+
+/**
+ * Pull the coins spent by a block into the view before any of its
+ * transactions are checked, with one bulk read that is spread over the
+ * database read threads, instead of one read at a time in between input
+ * checks. Inputs spending outputs created by the block itself are skipped
+ * as they can't be found yet.
+ */
+static void PrefetchBlockInputs(const CBlock& block, const CCoinsViewCache& view)
+{
+    std::set<uint256> setBlockTxid;
+    for (const CTransactionRef& tx : block.vtx)
+        setBlockTxid.insert(tx->GetHash());
+
+    std::vector<COutPoint> vOutPoint;
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        for (const CTxIn& txin : block.vtx[i]->vin) {
+            if (!setBlockTxid.count(txin.prevout.hash))
+                vOutPoint.push_back(txin.prevout);
+        }
+    }
+
+    view.PrefetchCoins(vOutPoint);
+}
+
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
+ *  can fail if those validity checks fail (among other reasons). */
+bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, bool fCheckBMM,
+                  BlockConnectTimes* pTimes)
+{
+    AssertLockHeld(cs_main);
+    assert(pindex);
+    // pindex->phashBlock can be null if called by CreateNewBlock/TestBlockValidity
+    assert((pindex->phashBlock == nullptr) ||
+           (*pindex->phashBlock == block.GetHash()));
+    int64_t nTimeStart = GetTimeMicros();
+
+    // Check it again in case a previous version let a bad block in
+    // NOTE: We don't currently (re-)invoke ContextualCheckBlock() or
+    // ContextualCheckBlockHeader() here. This means that if we add a new
+    // consensus rule that is enforced in one of those two functions, then we
+    // may have let in a block that violates the rule prior to updating the
+    // software, and we would NOT be enforcing the rule here. Fully solving
+    // upgrade from one software version to the next after a consensus rule
+    // change is potentially tricky and issue-specific (see RewindBlockIndex()
+    // for one general approach that was used for BIP 141 deployment).
+    // Also, currently the rule against blocks more than 2 hours in the future
+    // is enforced in ContextualCheckBlockHeader(); we wouldn't want to
+    // re-enforce that rule here (at least until we make it impossible for
+    // GetAdjustedTime() to go backward).
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck /* fCheckMerkleRoot */, fCheckBMM))
+        return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
+
+    // verify that the view's current state corresponds to the previous block
+    uint256 hashPrevBlock = pindex->pprev == nullptr ? uint256() : pindex->pprev->GetBlockHash();
+    assert(hashPrevBlock == view.GetBestBlock());
+
+    // Special case for the genesis block, skipping connection of its transactions
+    // (its coinbase is unspendable)
+    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
+        if (!fJustCheck)
+            view.SetBestBlock(pindex->GetBlockHash());
+        return true;
+    }
+
+    nBlocksTotal++;
+
+    bool fScriptChecks = true;
+
+    BlockConnectTimes times;
+
+    int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
+    times.nCheck = nTime1 - nTimeStart;
+    LogPrint(BCLog::BENCH, "    - Sanity checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime1 - nTimeStart), nTimeCheck * MICRO, nTimeCheck * MILLI / nBlocksTotal);
+
+    // Do not allow blocks that contain transactions which 'overwrite' older transactions,
+    // unless those are already completely spent.
+    // If such overwrites are allowed, coinbases and transactions depending upon those
+    // can be duplicated to remove the ability to spend the first instance -- even after
+    // being sent to another address.
+    // See BIP30 and http://r6.ca/blog/20120206T005236Z.html for more information.
+    // This logic is not necessary for memory pool transactions, as AcceptToMemoryPool
+    // already refuses previously-known transaction ids entirely.
+    // This rule was originally applied to all blocks with a timestamp after March 15, 2012, 0:00 UTC.
+    // Now that the whole chain is irreversibly beyond that time it is applied to all blocks except the
+    // two in the chain that violate it. This prevents exploiting the issue against nodes during their
+    // initial block download.
+    bool fEnforceBIP30 = (!pindex->phashBlock) || // Enforce on CreateNewBlock invocations which don't have a hash.
+                          !((pindex->nHeight==91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) ||
+                           (pindex->nHeight==91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
+
+    // Once BIP34 activated it was not possible to create new duplicate coinbases and thus other than starting
+    // with the 2 existing duplicate coinbase pairs, not possible to create overwriting txs.  But by the
+    // time BIP34 activated, in each of the existing pairs the duplicate coinbase had overwritten the first
+    // before the first had been spent.  Since those coinbases are sufficiently buried its no longer possible to create further
+    // duplicate transactions descending from the known pairs either.
+    // If we're on the known chain at height greater than where BIP34 activated, we can save the db accesses needed for the BIP30 check.
+    assert(pindex->pprev);
+    CBlockIndex *pindexBIP34height = pindex->pprev->GetAncestor(chainparams.GetConsensus().BIP34Height);
+    //Only continue to enforce if we're below BIP34 activation height or the block hash at that height doesn't correspond.
+    fEnforceBIP30 = fEnforceBIP30 && (!pindexBIP34height || !(pindexBIP34height->GetBlockHash() == chainparams.GetConsensus().BIP34Hash));
+
+    if (fEnforceBIP30) {
+        for (const auto& tx : block.vtx) {
+            for (size_t o = 0; o < tx->vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
+        }
+    }
+
+    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    int nLockTimeFlags = 0;
+    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
+    }
+
+    // Get the script flags for this block
+    unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
+
+    int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
+    times.nForks = nTime2 - nTime1;
+    LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
+
+    // Start the sidechain checks, which don't depend on the coins view, on
+    // their own thread when we have script check threads as well, so that
+    // their database reads and mainchain requests overlap with connecting the
+    // transactions below.
+    const bool fCheckBundleStatus = !fJustCheck && fSidechainIndex && fCheckBMM;
+    SidechainConnectSnapshot sidechainSnapshot;
+    SnapshotSidechainConnect(block, fCheckBMM, fCheckBundleStatus, sidechainSnapshot);
+    SidechainConnectChecks sidechainChecks;
+    std::future<bool> sidechainChecksResult;
+    if (nScriptCheckThreads)
+        sidechainChecksResult = std::async(std::launch::async, CheckSidechainConnect, std::cref(block), fCheckBMM, fCheckBundleStatus, std::cref(sidechainSnapshot), std::ref(sidechainChecks));
+
+    // Fetch all of the coins spent by the block up front
+    PrefetchBlockInputs(block, view);
+
+    int64_t nTime2a = GetTimeMicros(); nTimePrefetch += nTime2a - nTime2;
+    times.nPrefetch = nTime2a - nTime2;
+    LogPrint(BCLog::BENCH, "      - Prefetch inputs: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2a - nTime2), nTimePrefetch * MICRO, nTimePrefetch * MILLI / nBlocksTotal);
+
+    CBlockUndo blockundo;
+
+    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+
+    std::vector<int> prevheights;
+    CAmount nFees = 0;
+    int nInputs = 0;
+    int64_t nSigOpsCost = 0;
+    blockundo.vtxundo.reserve(block.vtx.size() - 1);
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    // The first transaction that failed, the sidechain checks may have found
+    // a failure which has to be reported instead
+    bool fTxsValid = true;
+    unsigned int nTxFail = block.vtx.size();
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction &tx = *(block.vtx[i]);
+
+        nInputs += tx.vin.size();
+
+        // Perform non coinbase txn checks
+        if (!tx.IsCoinBase())
+        {
+            CAmount txfee = 0;
+            if (!Consensus::CheckTxInputs(tx, state, view, pindex->nHeight, txfee)) {
+                fTxsValid = error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
+                nTxFail = i;
+                break;
+            }
+            nFees += txfee;
+            if (!MoneyRange(nFees)) {
+                fTxsValid = state.DoS(100, error("%s: accumulated fee in the block out of range.", __func__),
+                                 REJECT_INVALID, "bad-txns-accumulated-fee-outofrange");
+                nTxFail = i;
+                break;
+            }
+
+            // Check that transaction is BIP68 final
+            // BIP68 lock checks (as opposed to nLockTime checks) must
+            // be in ConnectBlock because they require the UTXO set
+            prevheights.resize(tx.vin.size());
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
+            }
+
+            if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
+                fTxsValid = state.DoS(100, error("%s: contains a non-BIP68-final transaction", __func__),
+                                 REJECT_INVALID, "bad-txns-nonfinal");
+                nTxFail = i;
+                break;
+            }
+        }
+
+        // GetTransactionSigOpCost counts 3 types of sigops:
+        // * legacy (always)
+        // * p2sh (when P2SH enabled in flags and excludes coinbase)
+        // * witness (when witness enabled in flags and excludes coinbase)
+        nSigOpsCost += GetTransactionSigOpCost(tx, view, flags);
+        if (nSigOpsCost > MAX_BLOCK_SIGOPS_COST) {
+            fTxsValid = state.DoS(100, error("ConnectBlock(): too many sigops"),
+                             REJECT_INVALID, "bad-blk-sigops");
+            nTxFail = i;
+            break;
+        }
+
+        txdata.emplace_back(tx);
+        if (!tx.IsCoinBase())
+        {
+            std::vector<CScriptCheck> vChecks;
+            bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr)) {
+                fTxsValid = error("ConnectBlock(): CheckInputs on %s failed with %s",
+                    tx.GetHash().ToString(), FormatStateMessage(state));
+                nTxFail = i;
+                break;
+            }
+            control.Add(vChecks);
+        }
+
+        CTxUndo undoDummy;
+        if (i > 0) {
+            blockundo.vtxundo.push_back(CTxUndo());
+        }
+        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+    }
+    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
+    times.nConnect = nTime3 - nTime2a;
+    LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
+
+    // Report the failure that connecting one transaction at a time, with the
+    // sidechain checks of each transaction before its inputs, would find first
+    bool fSidechainChecksOk = sidechainChecksResult.valid() ? sidechainChecksResult.get() :
+        CheckSidechainConnect(block, fCheckBMM, fCheckBundleStatus, sidechainSnapshot, sidechainChecks);
+    if (!fSidechainChecksOk && sidechainChecks.nFailTx <= nTxFail) {
+        state = sidechainChecks.state;
+        return error("%s: CheckSidechainConnect: %s", __func__, FormatStateMessage(state));
+    }
+    if (!fTxsValid)
+        return false;
+    int64_t nTime3a = GetTimeMicros();
+    times.nRefunds = sidechainChecks.nTimeRefunds;
+    times.nDeposits = sidechainChecks.nTimeDeposits;
+    times.nBundleStatus = sidechainChecks.nTimeBundleStatus;
+    times.nSidechainWait = nTime3a - nTime3;
+    LogPrint(BCLog::BENCH, "      - Sidechain checks: refunds %.2fms, deposits %.2fms, bundle status %.2fms, waited %.2fms\n", MILLI * times.nRefunds, MILLI * times.nDeposits, MILLI * times.nBundleStatus, MILLI * times.nSidechainWait);
+
     // Update status of refunded Withdrawal(s)
+    const std::vector<SidechainWithdrawal>& vRefundedWithdrawal = sidechainChecks.vRefundedWithdrawal;
     if (!fJustCheck && vRefundedWithdrawal.size()) {
         // Write the updated status of withdrawals(s) in the bundle (WITHDRAW_SPENT)
         if (!psidechaintree->WriteWithdrawalUpdate(vRefundedWithdrawal))
             return state.Error(strprintf("%s: Failed to write refunded withdrawal status update!\n", __func__));
     }
+    int64_t nTime3b = GetTimeMicros();
+    times.nSidechainDB = nTime3b - nTime3a;
 
-    CAmount blockReward = nFees + nDepositPayout + nRefundPayout;
+    CAmount blockReward = nFees + sidechainChecks.nDepositPayout + sidechainChecks.nRefundPayout;
     if (block.vtx[0]->GetValueOut() > blockReward)
         return state.DoS(100,
                          error("ConnectBlock(): coinbase pays too much (actual=%d vs limit=%d)",
@@ -2286,6 +2807,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!control.Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
+    times.nVerify = nTime4 - nTime3b;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
 
     if (fJustCheck)
@@ -2302,6 +2824,9 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteTxIndexDataForBlock(block, state, pindex))
         return false;
 
+    int64_t nTime4a = GetTimeMicros();
+    times.nUndo = nTime4a - nTime4;
+
     if (fSidechainIndex) {
         SidechainClient client;
 
@@ -2320,6 +2845,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         } else {
             LogPrintf("%s: Failed to get latest withdrawal bundle from ldb: %s!\n", __func__, hashLatestWithdrawalBundle.ToString());
         }
+        times.nBundleBroadcast = GetTimeMicros() - nTime4a;
 
         // Check version commit in coinbase
         bool fVersionCommitFound = false;
@@ -2371,16 +2897,14 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             bool fFailCommit = scriptPubKey.IsWithdrawalBundleFailCommit(hashWithdrawalBundle);
 
             if (fFailCommit || scriptPubKey.IsWithdrawalBundleSpentCommit(hashWithdrawalBundle)) {
-                // Verify with the mainchain when we are also checking BMM
-                if (fCheckBMM) {
-                    bool fVerified = fFailCommit ?
-                        client.HaveFailedWithdrawalBundle(hashWithdrawalBundle) :
-                        client.HaveSpentWithdrawalBundle(hashWithdrawalBundle);
-
-                    if (!fVerified)
-                        return state.Error(strprintf("%s: Invalid Withdrawal Bundle update : %s - %s!\n",
-                                    __func__, fFailCommit ? "Failed" : "Paid out",
-                                    hashWithdrawalBundle.ToString()));
+                // The update itself was verified with the mainchain by
+                // CheckSidechainConnect when we are also checking BMM.
+                if (sidechainChecks.fBundleStatusInvalid
+                        && hashWithdrawalBundle == sidechainChecks.hashBundleStatusInvalid
+                        && fFailCommit == sidechainChecks.fBundleStatusInvalidFail) {
+                    return state.Error(strprintf("%s: Invalid Withdrawal Bundle update : %s - %s!\n",
+                                __func__, fFailCommit ? "Failed" : "Paid out",
+                                hashWithdrawalBundle.ToString()));
                 }
 
                 // Load the Withdrawal Bundle object from LDB if we need to and then write an
@@ -2505,8 +3029,10 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             uint256 hashWithdrawalBundleID;
 
             // This will also return a list of withdrawal(s) from the Withdrawal Bundle
+            int64_t nTimeReplicate = GetTimeMicros();
             if (!VerifyWithdrawalBundles(strFail, pindex->nHeight, block.vtx, vWithdrawal, hashWithdrawalBundle, hashWithdrawalBundleID, fCheckBMM /* fReplicate */))
                 return state.Error(strprintf("%s: Invalid Withdrawal Bundle! Error: %s", __func__, strFail));
+            times.nBundleReplicate = GetTimeMicros() - nTimeReplicate;
 
             if (hashWithdrawalBundle.IsNull())
                 return state.Error(strprintf("%s: hashWithdrawalBundle shouldn't be null if VerifyWithdrawalBundles passed!\n", __func__));
@@ -2528,19 +3054,146 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         }
     }
 
+    int64_t nTime4b = GetTimeMicros();
+    if (fSidechainIndex) {
+        times.nSidechainDB += nTime4b - nTime4a - times.nBundleBroadcast - times.nBundleReplicate;
+        LogPrint(BCLog::BENCH, "    - Sidechain index: bundle broadcast %.2fms, bundle replication %.2fms, db %.2fms\n", MILLI * times.nBundleBroadcast, MILLI * times.nBundleReplicate, MILLI * times.nSidechainDB);
+    }
+
+    // Journal the mainchain verification results for this block so that a
+    // reindex doesn't have to ask the mainchain about it again
+    if (!fJustCheck && fCheckBMM && pindex->pprev && !bmmCache.HaveBlockVerifyRecord(block.GetHash()))
+        AppendVerifyJournal(block, fSidechainIndex);
+
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
+    times.nJournal = nTime5 - nTime4b;
     LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime5 - nTime4), nTimeIndex * MICRO, nTimeIndex * MILLI / nBlocksTotal);
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint(BCLog::BENCH, "    - Callbacks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime6 - nTime5), nTimeCallbacks * MICRO, nTimeCallbacks * MILLI / nBlocksTotal);
 
+    if (pTimes)
+        *pTimes = times;
+
+    return true;
+}
+
+static bool GetTrustedVerifyRecord(const CBlock& block, BlockVerifyRecord& record)
+{
+    if (!fTrustVerifyJournal)
+        return false;
+
+    const uint256 hashBlock = block.GetHash();
+    if (!bmmCache.GetBlockVerifyRecord(hashBlock, record))
+        return false;
+
+    if (record.hashBMM != block.hashMerkleRoot || record.hashMainchainBlock != block.hashMainchainBlock)
+        return false;
+
+    // The mainchain block may have been orphaned since the record was written
+    if (!bmmCache.HaveMainBlock(record.hashMainchainBlock))
+        return false;
+
+    // Spot check a deterministic sample of journaled blocks with the mainchain
+    if (nVerifyJournalSpotCheck > 0 && hashBlock.GetCheapHash() % nVerifyJournalSpotCheck == 0)
+        return false;
+
+    bmmCache.CacheVerifiedBMM(hashBlock);
+    for (const uint256& txid : record.vDepositTxid)
+        bmmCache.CacheVerifiedDeposit(txid);
+
     return true;
 }
 
+static bool HaveJournaledBundleStatus(const CBlock& block, const uint256& hashWithdrawalBundle, bool fFailed)
+{
+    BlockVerifyRecord record;
+    if (!GetTrustedVerifyRecord(block, record))
+        return false;
+
+    return std::find(record.vBundleStatus.begin(), record.vBundleStatus.end(),
+            std::make_pair(hashWithdrawalBundle, fFailed)) != record.vBundleStatus.end();
+}
+
+static void AppendVerifyJournal(const CBlock& block, bool fBundleStatusVerified)
+{
+    BlockVerifyRecord record;
+    record.hashBlock = block.GetHash();
+    record.hashMainchainBlock = block.hashMainchainBlock;
+    record.hashBMM = block.hashMerkleRoot;
+
+    for (const CTxOut& out : block.vtx[0]->vout) {
+        const CScript& scriptPubKey = out.scriptPubKey;
+
+        uint256 hashWithdrawalBundle;
+        if (fBundleStatusVerified && scriptPubKey.IsWithdrawalBundleFailCommit(hashWithdrawalBundle)) {
+            record.vBundleStatus.push_back(std::make_pair(hashWithdrawalBundle, true));
+            continue;
+        }
+        if (fBundleStatusVerified && scriptPubKey.IsWithdrawalBundleSpentCommit(hashWithdrawalBundle)) {
+            record.vBundleStatus.push_back(std::make_pair(hashWithdrawalBundle, false));
+            continue;
+        }
+
+        std::vector<unsigned char> vch;
+        if (!scriptPubKey.IsSidechainObj(vch))
+            continue;
+
+        SidechainObj *obj = ParseSidechainObj(vch);
+        if (!obj)
+            continue;
+
+        if (obj->sidechainop == DB_SIDECHAIN_DEPOSIT_OP) {
+            const SidechainDeposit *deposit = (const SidechainDeposit *) obj;
+            record.vDepositTxid.push_back(deposit->dtx.GetHash());
+        }
+
+        delete obj;
+    }
+
+    vVerifyJournalPending.push_back(record);
+    bmmCache.CacheBlockVerifyRecord(record);
+}
+
+/**
+ * Append the records journaled since the last call to the verification
+ * journal. Called with the block index writes in FlushStateToDisk. The
+ * journal is best-effort: records that are lost with a crash just mean the
+ * mainchain has to be asked about those blocks again.
+ */
+static void WriteVerifyJournal()
+{
+    AssertLockHeld(cs_main);
+
+    if (vVerifyJournalPending.empty())
+        return;
+
+    std::vector<BlockVerifyRecord> vRecord;
+    vRecord.swap(vVerifyJournalPending);
+
+    fs::path path = GetDataDir() / "verifyjournal.dat";
+    CAutoFile fileout(fsbridge::fopen(path, "ab"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        LogPrintf("%s: Failed to open verification journal!\n", __func__);
+        return;
+    }
+
+    try {
+        for (const BlockVerifyRecord& record : vRecord)
+            fileout << record;
+    }
+    catch (const std::exception& e) {
+        LogPrintf("%s: Error writing verification journal: %s", __func__, e.what());
+        return;
+    }
+
+    FileCommit(fileout.Get());
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -2589,6 +3242,14 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
         int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+        // The coins of a background flush still count against the cache size, wait for them to be written
+        // before the two together go over the limit.
+        if (pcoinsflusher->IsFlushing() && cacheSize + (int64_t)pcoinsflusher->DynamicMemoryUsage() > nTotalSpace) {
+            int64_t nWaitStart = GetTimeMicros();
+            if (!pcoinsflusher->WaitForFlush())
+                return AbortNode(state, "Failed to write to coin database");
+            LogPrint(BCLog::COINDB, "Waited %.2fms for the background flush\n", MILLI * (GetTimeMicros() - nWaitStart));
+        }
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
         // The cache is over the limit, we have to write now.
@@ -2627,6 +3288,7 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // Finally remove any pruned files
             if (fFlushForPrune)
                 UnlinkPrunedFiles(setFilesToPrune);
+            WriteVerifyJournal();
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2638,9 +3300,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
-            // Flush the chainstate (which may refer to block index entries).
+            // Flush the chainstate (which may refer to block index entries). The coins are written
+            // in the background, unless the caller needs them on disk or block files are being pruned.
+            pcoinsflusher->SetNextFlushUsage(pcoinsTip->DynamicMemoryUsage());
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsflusher->WaitForFlush())
+                return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
     }
@@ -2878,13 +3544,14 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         pthisBlock = pblock;
     }
     const CBlock& blockConnecting = *pthisBlock;
+    BlockConnectTimes times;
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
     {
         CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, true, &times);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2914,6 +3581,17 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
 
+    times.hash = pindexNew->GetBlockHash();
+    times.nHeight = pindexNew->nHeight;
+    times.nTx = blockConnecting.vtx.size();
+    times.nTime = GetTime();
+    times.nReadFromDisk = nTime2 - nTime1;
+    times.nFlush = nTime4 - nTime3;
+    times.nChainState = nTime5 - nTime4;
+    times.nPostConnect = nTime6 - nTime5;
+    times.nTotal = nTime6 - nTime1;
+    RecordBlockConnectTimes(times);
+
     connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
     return true;
 }
@@ -3472,21 +4150,45 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
+/**
+ * A mainchain check of a block failed. The mainchain connection status is
+ * cached, so make sure the mainchain didn't just go away, the block isn't
+ * at fault then.
+ */
+static bool MainchainConnectionLost()
+{
+    if (CheckMainchainConnection())
+        return false;
+
+    SetNetworkActive(false, "Failed to connect to mainchain when checking block!");
+    return true;
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckMerkleRoot, bool fCheckBMM)
 {
     // These are checks that are independent of context.
 
+    // fChecked is only set after the mainchain checks passed as well, so a
+    // block that was checked doesn't need the mainchain again
+    if (block.fChecked)
+        return true;
+
     bool fGenesis = (block.GetHash() == Params().GetConsensus().hashGenesisBlock);
 
+    // During a reindex, mainchain verification results from the journal are
+    // loaded into the BMM cache so that we don't need to ask the mainchain.
+    bool fJournaled = false;
+    if (!fGenesis && fCheckBMM) {
+        BlockVerifyRecord record;
+        fJournaled = GetTrustedVerifyRecord(block, record);
+    }
+
     // Check for mainchain connection
-    if (!fGenesis && fCheckBMM && !CheckMainchainConnection()) {
+    if (!fGenesis && fCheckBMM && !fJournaled && !IsMainchainConnected()) {
         SetNetworkActive(false, "Failed to connect to mainchain when checking block!");
         return false;
     }
 
-    if (block.fChecked)
-        return true;
-
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
@@ -3518,8 +4220,11 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
     // Verify BMM with mainchain
-    if (fCheckBMM && !VerifyBMM(block))
+    if (fCheckBMM && !VerifyBMM(block)) {
+        if (MainchainConnectionLost())
+            return false;
         return state.DoS(1, false, REJECT_INVALID, "bad-bmm", true, "invalid bmm / failed to verify BMM for block");
+    }
 
     if (!fGenesis && fCheckBMM) {
         // Check required PrevBlockCommit
@@ -3548,6 +4253,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Find deposits and verify that they exist with mainchain
     if (fCheckBMM) {
+        std::vector<DepositVerifyRequest> vRequest;
         for (const CTxOut& out : block.vtx[0]->vout) {
             const CScript& scriptPubKey = out.scriptPubKey;
 
@@ -3560,18 +4266,32 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
                 return state.DoS(90, error("%s: invalid sidechain deposit obj script", __func__), REJECT_INVALID, "invalid-sidechain-obj-script");
             }
 
-            if (obj->sidechainop != DB_SIDECHAIN_DEPOSIT_OP)
+            if (obj->sidechainop != DB_SIDECHAIN_DEPOSIT_OP) {
+                delete obj;
                 continue;
+            }
 
             const SidechainDeposit* deposit = (const SidechainDeposit *) obj;
 
-            if (!VerifyDeposit(deposit->hashMainchainBlock, deposit->dtx.GetHash(), deposit->nTx)) {
-                delete obj;
-                return state.DoS(1, error("%s: invalid sidechain deposit", __func__), REJECT_INVALID, "invalid-sidechain-deposit");
-            }
+            DepositVerifyRequest request;
+            request.hashMainBlock = deposit->hashMainchainBlock;
+            request.tx = MakeTransactionRef(deposit->dtx);
+            request.txid = request.tx->GetHash();
+            request.nTx = deposit->nTx;
+            request.nBurnIndex = deposit->nBurnIndex;
+            vRequest.push_back(request);
 
             delete obj;
         }
+
+        if (!CheckDepositTransactions(vRequest))
+            return state.DoS(100, error("%s: invalid sidechain deposit transactions", __func__), REJECT_INVALID, "bad-deposit-tx");
+
+        if (!VerifyDeposits(vRequest)) {
+            if (MainchainConnectionLost())
+                return false;
+            return state.DoS(1, error("%s: invalid sidechain deposit", __func__), REJECT_INVALID, "invalid-sidechain-deposit");
+        }
     }
 
     // Check transactions
@@ -3585,66 +4305,246 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     {
         nSigOps += GetLegacySigOpCount(*tx);
     }
-    if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
-        return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
+    if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
+        return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
+
+    if (fCheckBMM && fCheckMerkleRoot)
+        block.fChecked = true;
+
+    return true;
+}
+
+bool VerifyBMM(const CBlock& block)
+{
+    // Skip genesis block
+    if (block.GetHash() == Params().GetConsensus().hashGenesisBlock)
+        return true;
+
+    // Have we already verified BMM for this block?
+    if (bmmCache.HaveVerifiedBMM(block.GetHash()))
+        return true;
+
+    // h*
+    const uint256 hashMerkleRoot = block.hashMerkleRoot;
+
+    // TODO
+    // Return results from client to help decide on DoS score
+
+    // Verify BMM with our local index of mainchain commitments if we can,
+    // otherwise ask the local mainchain node.
+    bool fBMM = false;
+    if (gArgs.GetBoolArg("-verifybmmlocal", DEFAULT_VERIFY_BMM_LOCAL)
+            && VerifyBMMLocal(block.hashMainchainBlock, hashMerkleRoot, fBMM)) {
+        if (!fBMM) {
+            LogPrintf("%s: Did not find BMM h*: %s in local index of mainchain block: %s!\n", __func__, hashMerkleRoot.ToString(), block.hashMainchainBlock.ToString());
+            return false;
+        }
+    } else {
+        uint256 txid;
+        uint32_t nTime;
+        SidechainClient client;
+        if (!client.VerifyBMM(block.hashMainchainBlock, hashMerkleRoot, txid, nTime)) {
+            LogPrintf("%s: Did not find BMM h*: %s in mainchain block: %s!\n", __func__, hashMerkleRoot.ToString(), block.hashMainchainBlock.ToString());
+            return false;
+        }
+    }
+
+    // Cache that we have verified BMM for this block
+    bmmCache.CacheVerifiedBMM(block.GetHash());
+
+    return true;
+}
+
+bool VerifyDeposit(const uint256& hashMainBlock, const uint256& txid, const int nTx)
+{
+    if (hashMainBlock.IsNull()) {
+        return false;
+    }
+    if (txid.IsNull()) {
+        return false;
+    }
+
+    // Have we already verified the deposit?
+    if (bmmCache.HaveVerifiedDeposit(txid))
+        return true;
+
+    SidechainClient client;
+    if (!client.VerifyDeposit(hashMainBlock, txid, nTx)) {
+        return false;
+    }
 
-    if (fCheckBMM && fCheckMerkleRoot)
-        block.fChecked = true;
+    // Cache that we have verified the deposit
+    bmmCache.CacheVerifiedDeposit(txid);
 
     return true;
 }
 
-bool VerifyBMM(const CBlock& block)
+bool VerifyBMMLocal(const uint256& hashMainBlock, const uint256& hashBMM, bool& fBMM)
 {
-    // Skip genesis block
-    if (block.GetHash() == Params().GetConsensus().hashGenesisBlock)
-        return true;
+    // Only trust blocks that are part of the mainchain as far as we know
+    if (!bmmCache.HaveMainBlock(hashMainBlock))
+        return false;
 
-    // Have we already verified BMM for this block?
-    if (bmmCache.HaveVerifiedBMM(block.GetHash()))
+    if (bmmCache.HaveMainBlockBMM(hashMainBlock, hashBMM, fBMM))
         return true;
 
-    // h*
-    const uint256 hashMerkleRoot = block.hashMerkleRoot;
+    // Fetch the mainchain block once and index its BMM commitments
+    SidechainClient client;
+    CMainchainBlock block;
+    if (!client.GetMainchainBlock(hashMainBlock, block))
+        return false;
 
-    // TODO
-    // Return results from client to help decide on DoS score
+    if (block.GetHash() != hashMainBlock || block.vtx.empty())
+        return false;
 
-    // Verify BMM with local mainchain node
-    uint256 txid;
-    uint32_t nTime;
-    SidechainClient client;
-    if (!client.VerifyBMM(block.hashMainchainBlock, hashMerkleRoot, txid, nTime)) {
-        LogPrintf("%s: Did not find BMM h*: %s in mainchain block: %s!\n", __func__, hashMerkleRoot.ToString(), block.hashMainchainBlock.ToString());
+    bool fMutated = false;
+    if (MainchainBlockMerkleRoot(block, &fMutated) != block.hashMerkleRoot || fMutated)
         return false;
+
+    std::set<uint256> setBMM;
+    for (const CTxOut& out : block.vtx[0]->vout) {
+        uint256 hash;
+        uint8_t nSidechain;
+        if (out.scriptPubKey.IsBMMCommit(hash, nSidechain) && nSidechain == THIS_SIDECHAIN)
+            setBMM.insert(hash);
     }
 
-    // Cache that we have verified BMM for this block
-    bmmCache.CacheVerifiedBMM(block.GetHash());
+    bmmCache.CacheMainBlockBMM(hashMainBlock, block.GetBlockHeader(), setBMM);
+
+    fBMM = setBMM.count(hashBMM);
 
     return true;
 }
 
-bool VerifyDeposit(const uint256& hashMainBlock, const uint256& txid, const int nTx)
+bool CheckDepositTransactions(const std::vector<DepositVerifyRequest>& vRequest)
 {
-    if (hashMainBlock.IsNull()) {
-        return false;
+    for (size_t i = 0; i < vRequest.size(); i++) {
+        const DepositVerifyRequest& r = vRequest[i];
+        if (!r.tx || r.tx->GetHash() != r.txid || r.nBurnIndex >= r.tx->vout.size()) {
+            LogPrintf("%s: Invalid deposit output index: %s\n", __func__, r.txid.ToString());
+            return false;
+        }
+        if (i == 0)
+            continue;
+
+        const DepositVerifyRequest& prev = vRequest[i - 1];
+        if (r.tx->vout[r.nBurnIndex].scriptPubKey != prev.tx->vout[prev.nBurnIndex].scriptPubKey) {
+            LogPrintf("%s: Deposit: %s does not pay to the sidechain escrow\n", __func__, r.txid.ToString());
+            return false;
+        }
+        const COutPoint prevout(prev.txid, prev.nBurnIndex);
+        bool fFound = false;
+        for (const CTxIn& in : r.tx->vin) {
+            if (in.prevout == prevout) {
+                fFound = true;
+                break;
+            }
+        }
+        if (!fFound) {
+            LogPrintf("%s: Deposit: %s does not spend the CTIP of deposit: %s\n", __func__, r.txid.ToString(), prev.txid.ToString());
+            return false;
+        }
     }
-    if (txid.IsNull()) {
+    return true;
+}
+
+bool VerifyDepositsLocal(const std::vector<DepositVerifyRequest>& vRequest, std::vector<DepositVerifyRequest>& vRemaining)
+{
+    // Group deposits which are not in the local index by mainchain block
+    std::map<uint256, std::vector<DepositVerifyRequest>> mapRequest;
+    for (const DepositVerifyRequest& r : vRequest) {
+        if (!r.tx || r.nBurnIndex >= r.tx->vout.size())
+            return false;
+        if (!bmmCache.HaveMainBlock(r.hashMainBlock)) {
+            vRemaining.push_back(r);
+            continue;
+        }
+        if (!bmmCache.HaveMainBlockDeposit(r.hashMainBlock, r.txid, r.nTx))
+            mapRequest[r.hashMainBlock].push_back(r);
+    }
+
+    // Get one merkle proof per mainchain block covering all of its deposits
+    SidechainClient client;
+    for (const auto& it : mapRequest) {
+        const uint256& hashMainBlock = it.first;
+        const std::vector<DepositVerifyRequest>& vBlockRequest = it.second;
+
+        std::vector<uint256> vTxid;
+        for (const DepositVerifyRequest& r : vBlockRequest)
+            vTxid.push_back(r.txid);
+
+        CMainchainMerkleBlock merkleBlock;
+        std::vector<uint256> vMatch;
+        std::vector<unsigned int> vIndex;
+        if (!client.GetTxOutProof(vTxid, hashMainBlock, merkleBlock)
+                || merkleBlock.header.GetHash() != hashMainBlock
+                || merkleBlock.txn.ExtractMatches(vMatch, vIndex) != merkleBlock.header.hashMerkleRoot) {
+            vRemaining.insert(vRemaining.end(), vBlockRequest.begin(), vBlockRequest.end());
+            continue;
+        }
+
+        std::map<uint256, unsigned int> mapMatch;
+        for (size_t i = 0; i < vMatch.size() && i < vIndex.size(); i++)
+            mapMatch[vMatch[i]] = vIndex[i];
+
+        for (const DepositVerifyRequest& r : vBlockRequest) {
+            std::map<uint256, unsigned int>::const_iterator itMatch = mapMatch.find(r.txid);
+            if (itMatch == mapMatch.end() || itMatch->second != (unsigned int)r.nTx) {
+                LogPrintf("%s: Deposit: %s not proven in mainchain block: %s\n", __func__, r.txid.ToString(), hashMainBlock.ToString());
+                return false;
+            }
+            bmmCache.CacheMainBlockDeposit(hashMainBlock, merkleBlock.header, r.txid, r.nTx);
+        }
+    }
+
+    return true;
+}
+
+bool VerifyDeposits(const std::vector<DepositVerifyRequest>& vRequest)
+{
+    if (!CheckDepositTransactions(vRequest))
         return false;
+
+    // Collect the deposits we haven't already verified
+    std::vector<DepositVerifyRequest> vUncached;
+    for (const DepositVerifyRequest& r : vRequest) {
+        if (r.hashMainBlock.IsNull() || r.txid.IsNull())
+            return false;
+
+        if (!bmmCache.HaveVerifiedDeposit(r.txid))
+            vUncached.push_back(r);
+    }
+
+    // Try to verify deposits with local merkle proofs first, anything that
+    // can't be answered locally is left for the mainchain node. A merkle
+    // proof doesn't show that a transaction is a deposit to this sidechain,
+    // only the mainchain can tell for the first deposit. The ones after it
+    // spend its CTIP and pay to the same escrow, see CheckDepositTransactions.
+    if (!vUncached.empty() && gArgs.GetBoolArg("-verifybmmlocal", DEFAULT_VERIFY_BMM_LOCAL)) {
+        std::vector<DepositVerifyRequest> vLocal;
+        std::vector<DepositVerifyRequest> vRemaining;
+        for (const DepositVerifyRequest& r : vUncached) {
+            if (r.txid == vRequest.front().txid)
+                vRemaining.push_back(r);
+            else
+                vLocal.push_back(r);
+        }
+        if (!VerifyDepositsLocal(vLocal, vRemaining))
+            return false;
+        vUncached = vRemaining;
     }
 
-    // Have we already verified the deposit?
-    if (bmmCache.HaveVerifiedDeposit(txid))
+    if (vUncached.empty())
         return true;
 
+    // Verify all of them with as few mainchain requests as possible
     SidechainClient client;
-    if (!client.VerifyDeposit(hashMainBlock, txid, nTx)) {
+    if (!client.VerifyDeposits(vUncached))
         return false;
-    }
 
-    // Cache that we have verified the deposit
-    bmmCache.CacheVerifiedDeposit(txid);
+    // Cache that we have verified the deposits
+    for (const DepositVerifyRequest& r : vUncached)
+        bmmCache.CacheVerifiedDeposit(r.txid);
 
     return true;
 }
@@ -3851,6 +4751,23 @@ CScript GenerateBlockVersionCommit(const int32_t nVersion)
 }
 
 bool VerifyWithdrawalRefundRequest(const uint256& id, const std::vector<unsigned char>& vchSig, SidechainWithdrawal& withdrawal)
+{
+    if (id.IsNull()) {
+        LogPrintf("%s: Null Withdrawal ID!\n", __func__);
+        return false;
+    }
+
+    // Lookup the Withdrawal
+    if (!psidechaintree->GetWithdrawal(id, withdrawal)) {
+        LogPrintf("%s: Withdrawal not found!\n", __func__);
+        return false;
+    }
+
+    return CheckWithdrawalRefundRequest(id, vchSig, withdrawal);
+}
+
+/** Check a refund request against a withdrawal loaded from the sidechain db */
+static bool CheckWithdrawalRefundRequest(const uint256& id, const std::vector<unsigned char>& vchSig, const SidechainWithdrawal& withdrawal)
 {
     if (id.IsNull()) {
         LogPrintf("%s: Null Withdrawal ID!\n", __func__);
@@ -3874,11 +4791,6 @@ bool VerifyWithdrawalRefundRequest(const uint256& id, const std::vector<unsigned
         return false;
     }
 
-    // Lookup & verify status of Withdrawal
-    if (!psidechaintree->GetWithdrawal(id, withdrawal)) {
-        LogPrintf("%s: Withdrawal not found!\n", __func__);
-        return false;
-    }
     // Check status of Withdrawal
     if (withdrawal.status != WITHDRAWAL_UNSPENT) {
         LogPrintf("%s: Withdrawal status != Withdrawal_UNSPENT\n", __func__);
@@ -4033,7 +4945,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     bool fGenesis = (hash == Params().GetConsensus().hashGenesisBlock);
 
     // Check for mainchain connection
-    if (!fGenesis && !CheckMainchainConnection()) {
+    if (!fGenesis && !IsMainchainConnected()) {
         SetNetworkActive(false, "Failed to connect to mainchain when checking block header!");
         return false;
     }
@@ -4052,8 +4964,11 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!VerifyBMM(block))
+        if (!VerifyBMM(block)) {
+            if (MainchainConnectionLost())
+                return false;
             return state.DoS(1, false, REJECT_INVALID, "bad-bmm", true, "Invalid BMM in block header!");
+        }
 
         // Get prev block index
         CBlockIndex* pindexPrev = nullptr;
@@ -4095,19 +5010,35 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
-    bool fReorg = false;
-    std::vector<uint256> vOrphan;
-    if (!UpdateMainBlockHashCache(fReorg, vOrphan)) {
-        LogPrintf("%s: Failed to update main block hash cache!\n", __func__);
-        return false;
-    }
-    if (fReorg)
-        HandleMainchainReorg(vOrphan);
+    HandlePendingMainchainReorg();
 
     if (first_invalid != nullptr) first_invalid->SetNull();
+
+    // Verify BMM for the new headers before taking cs_main, so that asking
+    // the mainchain about headers missing from the local BMM index doesn't
+    // hold up validation. VerifyBMM caches the result for AcceptBlockHeader.
+    std::vector<const CBlockHeader*> vNew;
+    {
+        LOCK(cs_main);
+        for (const CBlockHeader& header : headers) {
+            if (!mapBlockIndex.count(header.GetHash()))
+                vNew.push_back(&header);
+        }
+    }
+    const CBlockHeader* pheaderBadBMM = nullptr;
+    for (const CBlockHeader* pheader : vNew) {
+        if (!VerifyBMM(CBlock(*pheader))) {
+            pheaderBadBMM = pheader;
+            break;
+        }
+    }
+
     {
         LOCK(cs_main);
         for (const CBlockHeader& header : headers) {
+            // Accept the headers before the first one with invalid BMM
+            if (&header == pheaderBadBMM)
+                break;
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
             if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
                 if (first_invalid) *first_invalid = header;
@@ -4118,6 +5049,28 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
             }
         }
     }
+    if (pheaderBadBMM) {
+        if (first_invalid) *first_invalid = *pheaderBadBMM;
+        if (MainchainConnectionLost())
+            return false;
+        return state.DoS(1, false, REJECT_INVALID, "bad-bmm", true, "Invalid BMM in block header!");
+    }
+    if (!headers.empty()) {
+        // Have the mainchain thread bring the mainchain block cache up to
+        // date if the headers commit to blocks it doesn't have yet
+        std::vector<uint256> vHashMainBlock;
+        vHashMainBlock.reserve(headers.size());
+        for (const CBlockHeader& header : headers) {
+            if (!header.hashMainchainBlock.IsNull())
+                vHashMainBlock.push_back(header.hashMainchainBlock);
+        }
+        // Only catch up with the mainchain if the cache is behind
+        size_t nMissing = bmmCache.CountMissingMainBlocks(vHashMainBlock);
+        if (nMissing) {
+            LogPrint(BCLog::NET, "%s: %u of %u headers commit to mainchain blocks that aren't cached yet\n", __func__, nMissing, headers.size());
+            fMainchainReconcilePending = true;
+        }
+    }
     NotifyHeaderTip();
     return true;
 }
@@ -4245,6 +5198,7 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
     }
     if (fReorg)
         HandleMainchainReorg(vOrphan);
+    HandlePendingMainchainReorg();
 
     AssertLockNotHeld(cs_main);
 
@@ -4360,6 +5314,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockfilemap.Invalidate(*it);
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -5692,6 +6647,88 @@ void DumpMainBlockCache()
     LogPrintf("%s: Wrote %u\n", __func__, count);
 }
 
+void LoadVerifyJournal()
+{
+    fs::path path = GetDataDir() / "verifyjournal.dat";
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return;
+    }
+
+    // Read records until the end of the file. If we were shut down while
+    // appending, the last record may be incomplete and is ignored.
+    int nRecords = 0;
+    try {
+        while (!feof(filein.Get())) {
+            BlockVerifyRecord record;
+            filein >> record;
+            bmmCache.CacheBlockVerifyRecord(record);
+            nRecords++;
+        }
+    }
+    catch (const std::exception& e) {
+    }
+
+    LogPrintf("%s: Loaded %u records\n", __func__, nRecords);
+}
+
+void LoadMainBlockCommitIndex()
+{
+    fs::path path = GetDataDir() / "mainblockcommits.dat";
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return;
+    }
+
+    std::map<uint256, MainBlockCommits> mapCommits;
+    try {
+        int nVersionRequired, nVersionThatWrote;
+        filein >> nVersionRequired;
+        filein >> nVersionThatWrote;
+        if (nVersionRequired > CLIENT_VERSION) {
+            return;
+        }
+
+        filein >> mapCommits;
+    }
+    catch (const std::exception& e) {
+        LogPrintf("%s: Error reading main block commit index: %s", __func__, e.what());
+        return;
+    }
+
+    for (const auto& it : mapCommits)
+        bmmCache.CacheMainBlockCommits(it.first, it.second);
+}
+
+void DumpMainBlockCommitIndex()
+{
+    std::map<uint256, MainBlockCommits> mapCommits = bmmCache.GetMainBlockCommitIndex();
+    if (mapCommits.empty())
+        return;
+
+    fs::path path = GetDataDir() / "mainblockcommits.dat.new";
+    CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        return;
+    }
+
+    try {
+        fileout << 160000; // version required to read: 0.16.00 or later
+        fileout << CLIENT_VERSION; // version that wrote the file
+        fileout << mapCommits;
+    }
+    catch (const std::exception& e) {
+        LogPrintf("%s: Error writing main block commit index: %s", __func__, e.what());
+        return;
+    }
+
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    RenameOver(GetDataDir() / "mainblockcommits.dat.new", GetDataDir() / "mainblockcommits.dat");
+
+    LogPrintf("%s: Wrote %u\n", __func__, mapCommits.size());
+}
+
 void DumpWithdrawalIDCache()
 {
     std::set<uint256> setWithdrawalID = bmmCache.GetCachedWithdrawalID();
@@ -6175,17 +7212,36 @@ bool SortDeposits(const std::vector<SidechainDeposit>& vDeposit, std::vector<Sid
 
 bool CheckMainchainConnection()
 {
+    if (nMockMainchainConnected >= 0) {
+        fMainchainConnected = nMockMainchainConnected > 0;
+        return fMainchainConnected;
+    }
+
     SidechainClient client;
 
     int nMainchainBlocks = 0;
     if (!client.GetBlockCount(nMainchainBlocks)) {
         LogPrintf("%s: Mainchain connection not detected!\n", __func__);
+        fMainchainConnected = false;
         return false;
     }
 
+    fMainchainConnected = true;
     return true;
 }
 
+bool IsMainchainConnected()
+{
+    return fMainchainConnected || CheckMainchainConnection();
+}
+
+void SetMockMainchainConnected(int nConnected)
+{
+    nMockMainchainConnected = nConnected;
+    if (nConnected < 0)
+        fMainchainConnected = false;
+}
+
 void SetNetworkActive(bool fActive, const std::string& strReason)
 {
     if (!g_connman)
@@ -6304,6 +7360,22 @@ bool VerifyMainBlockCache(std::string& strError)
     return true;
 }
 
+void ReconcileMainchain()
+{
+    if (!fMainchainReconcilePending.exchange(false))
+        return;
+
+    // Headers that come in later arm this again, no need to retry on failure
+    bool fReorg = false;
+    std::vector<uint256> vOrphan;
+    if (!UpdateMainBlockHashCache(fReorg, vOrphan)) {
+        LogPrintf("%s: Failed to update main block hash cache!\n", __func__);
+        return;
+    }
+    if (fReorg)
+        QueueMainchainReorg(vOrphan);
+}
+
 void HandleMainchainReorg(const std::vector<uint256>& vOrphan)
 {
     std::lock_guard<std::mutex> lock(mainBlockCacheReorgMutex);
@@ -6386,6 +7458,129 @@ void HandleMainchainReorg(const std::vector<uint256>& vOrphan)
     }
 }
 
+void QueueMainchainReorg(const std::vector<uint256>& vOrphan)
+{
+    std::lock_guard<std::mutex> lock(cs_mainchainReorgPending);
+    vMainchainOrphanPending.insert(vMainchainOrphanPending.end(), vOrphan.begin(), vOrphan.end());
+    fMainchainReorgPending = true;
+}
+
+void HandlePendingMainchainReorg()
+{
+    if (!fMainchainReorgPending)
+        return;
+
+    std::vector<uint256> vOrphan;
+    {
+        std::lock_guard<std::mutex> lock(cs_mainchainReorgPending);
+        vOrphan.swap(vMainchainOrphanPending);
+        fMainchainReorgPending = false;
+    }
+    if (vOrphan.empty())
+        return;
+
+    LogPrintf("%s: Handling mainchain reorg. Orphans: %u\n", __func__, vOrphan.size());
+    HandleMainchainReorg(vOrphan);
+}
+
+bool UpdateDepositCache()
+{
+    // Follow the mainchain tip. A mainchain reorg will clear the pending
+    // deposit queue as it may contain deposits from disconnected blocks.
+    bool fReorg = false;
+    std::vector<uint256> vOrphan;
+    if (!UpdateMainBlockHashCache(fReorg, vOrphan))
+        return false;
+    if (fReorg)
+        QueueMainchainReorg(vOrphan);
+
+    // The queue has to start from the last deposit the sidechain knows about.
+    // If the sidechain reorganized to a different last deposit, start over.
+    SidechainDeposit lastDeposit;
+    bool fHaveDeposits = false;
+    {
+        LOCK(cs_main);
+        fHaveDeposits = psidechaintree->GetLastDeposit(lastDeposit);
+    }
+    uint256 hashLastDeposit;
+    uint32_t nBurnIndex = 0;
+    if (fHaveDeposits) {
+        hashLastDeposit = lastDeposit.dtx.GetHash();
+        nBurnIndex = lastDeposit.nBurnIndex;
+    }
+    if (!bmmCache.HaveDepositQueueBase(hashLastDeposit, nBurnIndex)) {
+        if (fHaveDeposits)
+            bmmCache.ResetDepositQueue(hashLastDeposit, nBurnIndex, lastDeposit.GetID());
+        else
+            bmmCache.ResetDepositQueue(uint256(), 0, uint256());
+    }
+
+    // Only ask the mainchain for deposits once per mainchain block
+    const uint256 hashMainTip = bmmCache.GetLastMainBlockHash();
+    if (hashMainTip.IsNull() || hashMainTip == bmmCache.GetDepositQueueMainTip())
+        return true;
+
+    uint256 hashTip;
+    uint32_t nTip = 0;
+    if (!bmmCache.GetDepositQueueTip(hashTip, nTip))
+        return false;
+
+    // Request only the deposits after the newest one we have queued
+    SidechainClient client;
+    std::vector<SidechainDeposit> vDeposit = client.UpdateDeposits(hashTip, nTip);
+
+    // Drop deposits we already know about
+    std::vector<SidechainDeposit> vDepositNew;
+    for (const SidechainDeposit& d : vDeposit) {
+        if (d.nBurnIndex >= d.dtx.vout.size())
+            continue;
+        if (!bmmCache.HaveQueuedDeposit(d.GetID()))
+            vDepositNew.push_back(d);
+    }
+
+    if (!vDepositNew.empty()) {
+        std::vector<SidechainDeposit> vDepositSorted;
+        if (!SortDeposits(vDepositNew, vDepositSorted)
+                || !bmmCache.AppendPendingDeposits(vDepositSorted)) {
+            // Start over from the sidechain db next time
+            LogPrintf("%s: New deposits do not continue the queued CTIP chain, resetting deposit queue.\n", __func__);
+            bmmCache.ClearDepositQueue();
+            return false;
+        }
+        LogPrintf("%s: Queued %u new deposits.\n", __func__, vDepositSorted.size());
+    }
+
+    bmmCache.SetDepositQueueMainTip(hashMainTip);
+
+    return true;
+}
+
+void ThreadMainchainSync(bool fDepositPrefetch)
+{
+    int64_t nLastDepositUpdate = 0;
+    int64_t nLastReconcile = 0;
+    int64_t nLastHealthCheck = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        const int64_t nNow = GetTimeMillis();
+        if (nNow - nLastHealthCheck >= MAINCHAIN_HEALTH_INTERVAL) {
+            CheckMainchainConnection();
+            nLastHealthCheck = nNow;
+        }
+        if (nNow - nLastReconcile >= MAINCHAIN_RECONCILE_INTERVAL) {
+            ReconcileMainchain();
+            nLastReconcile = nNow;
+        }
+        if (fDepositPrefetch && nNow - nLastDepositUpdate >= DEPOSIT_PREFETCH_INTERVAL) {
+            UpdateDepositCache();
+            nLastDepositUpdate = nNow;
+        }
+
+        MilliSleep(1000);
+    }
+}
+
 CScript EncodeWithdrawalFees(const CAmount& amount)
 {
     CDataStream s(SER_NETWORK, PROTOCOL_VERSION);
@@ -38,13 +38,16 @@ class CBlockTreeDB;
 class CSidechainTreeDB;
 class CChainParams;
 class CCoinsViewDB;
+class CCoinsViewFlusher;
 class CInv;
 class CConnman;
 class CScriptCheck;
+class CSpanReader;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
 struct ChainTxData;
+struct DepositVerifyRequest;
 
 struct PrecomputedTransactionData;
 struct LockPoints;
@@ -79,13 +82,18 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** The number of block and undo files kept memory mapped for reading blocks (none where address space is scarce) */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = sizeof(void*) > 4 ? 16 : 0;
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 128;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of blocks that can be requested at any given time from a single peer, until its download speed is measured. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the number of blocks in flight from a peer once it is sized by the peer's bandwidth and latency. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 4;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 128;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -101,6 +109,10 @@ static const int MAX_BLOCKTXN_DEPTH = 10;
  *  degree of disordering of blocks on disk (which make reindexing and pruning harder). We'll probably
  *  want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** The download window spans more than BLOCK_DOWNLOAD_WINDOW blocks, up to MAX_BLOCK_DOWNLOAD_WINDOW, as long
+ *  as the blocks in it add up to less than this many bytes. Sidechain blocks are usually far below the size limit. */
+static const unsigned int BLOCK_DOWNLOAD_WINDOW_BYTES = 64 * 1000 * 1000;
+static const unsigned int MAX_BLOCK_DOWNLOAD_WINDOW = 8192;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -187,6 +199,10 @@ extern CAmount maxTxFee;
 /** If the tip is older than this (in seconds), the node is considered to be in initial block download. */
 extern int64_t nMaxTipAge;
 extern bool fEnableReplacement;
+/** If the verification journal may be trusted instead of the mainchain (reindex) */
+extern std::atomic<bool> fTrustVerifyJournal;
+/** Re-verify one in this many journaled blocks with the mainchain, 0 = none */
+extern int64_t nVerifyJournalSpotCheck;
 
 /** Block hash whose ancestors we will assume to have valid scripts without checking them. */
 extern uint256 hashAssumeValid;
@@ -228,6 +244,25 @@ static const char* const SIDECHAIN_TEST_SCRIPT_HEX = "76a914497f7d6b59281591c50b
 
 static const bool DEFAULT_VERIFY_WITHDRAWAL_BUNDLE_ACCEPT_BLOCK = true;
 
+/** Default for -verifybmmlocal, verify BMM & deposits with local merkle proofs */
+static const bool DEFAULT_VERIFY_BMM_LOCAL = false;
+
+/** Default for -reindextrustjournal, trust the verification journal on reindex */
+static const bool DEFAULT_REINDEX_TRUST_JOURNAL = true;
+/** Default for -reindexspotcheck */
+static const int64_t DEFAULT_REINDEX_SPOT_CHECK = 0;
+
+/** Default for -depositprefetch, ingest deposits from the mainchain in the background */
+static const bool DEFAULT_DEPOSIT_PREFETCH = true;
+/** How often (in milliseconds) to check the mainchain for new deposits */
+static const int64_t DEPOSIT_PREFETCH_INTERVAL = 10 * 1000;
+/** How often (in milliseconds) the mainchain block cache is brought up to date after headers with unknown mainchain blocks came in */
+static const int64_t MAINCHAIN_RECONCILE_INTERVAL = 5 * 1000;
+/** How often (in milliseconds) the mainchain connection is checked in the background */
+static const int64_t MAINCHAIN_HEALTH_INTERVAL = 5 * 1000;
+/** Number of recently connected blocks to keep connect timings for */
+static const size_t MAX_BLOCK_CONNECT_TIMES = 100;
+
 extern BMMCache bmmCache;
 
 extern std::mutex mainBlockCacheMutex;
@@ -410,6 +445,14 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read the serialized block of pindex as it is sent to peers, copying the
+ * bytes from the block file instead of deserializing and serializing the
+ * block. Without fWitness the witnesses are left out, as for MSG_BLOCK.
+ */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fWitness);
+/** Append the serialized block read from reader to out without the witnesses of its transactions */
+void StripRawBlockWitness(CSpanReader& reader, std::vector<unsigned char>& out);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -419,6 +462,36 @@ bool VerifyBMM(const CBlock& block);
 /** Verify deposit with the mainchain */
 bool VerifyDeposit(const uint256& hashMainBlock, const uint256& txid, const int nTx);
 
+/**
+ * Check for BMM h* in the local index of mainchain commitments, fetching the
+ * mainchain block once if needed. Returns false if it could not be answered
+ * locally, otherwise fBMM is set to whether hashBMM was committed to.
+ */
+bool VerifyBMMLocal(const uint256& hashMainBlock, const uint256& hashBMM, bool& fBMM);
+
+/**
+ * Check the deposit transactions of a block, in CTIP spend order: the CTIP
+ * output of each must exist, and every deposit after the first must spend
+ * the CTIP of the one before it and pay to the same escrow script.
+ */
+bool CheckDepositTransactions(const std::vector<DepositVerifyRequest>& vRequest);
+
+/**
+ * Verify deposits with merkle proofs from the mainchain, one per mainchain
+ * block. Deposits that can't be proven locally are returned in vRemaining.
+ * Returns false if a deposit is proven to be invalid. A merkle proof only
+ * shows that a transaction is in a mainchain block, the deposits must be
+ * tied to a deposit the mainchain verified by CheckDepositTransactions.
+ */
+bool VerifyDepositsLocal(const std::vector<DepositVerifyRequest>& vRequest, std::vector<DepositVerifyRequest>& vRemaining);
+
+/**
+ * Verify the deposits of a block with the mainchain, skipping those already
+ * verified. The first deposit is always left to the mainchain, the ones
+ * after it may be verified with local merkle proofs.
+ */
+bool VerifyDeposits(const std::vector<DepositVerifyRequest>& vRequest);
+
 /** Context-independent validity checks */
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckMerkleRoot = true, bool fCheckBMM = true);
 
@@ -485,6 +558,9 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Global variable that points to the view writing flushed coins to pcoinsdbview in the background (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewFlusher> pcoinsflusher;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
@@ -537,6 +613,15 @@ void DumpMainBlockCache();
 /** Load the cache of mainchain block hashes from disk */
 void LoadMainBlockCache();
 
+/** Load the journal of mainchain verification results for sidechain blocks */
+void LoadVerifyJournal();
+
+/** Dump the local index of mainchain block commitments to disk */
+void DumpMainBlockCommitIndex();
+
+/** Load the local index of mainchain block commitments from disk */
+void LoadMainBlockCommitIndex();
+
 /** Dump the cache of users withdrawal IDs */
 void DumpWithdrawalIDCache();
 
@@ -554,12 +639,64 @@ bool CreateWithdrawalBundleTx(int nHeight, CTransactionRef& withdrawalBundleTx,
  */
 bool VerifyWithdrawalBundles(std::string& strFail, int nHeight, const std::vector<CTransactionRef>& vtx, std::vector<SidechainWithdrawal>& vWithdrawal, uint256& hashWithdrawalBundle, uint256& hashWithdrawalBundleID, bool fReplicate = false);
 
+/** Where the time went when connecting a block to the tip, in microseconds */
+struct BlockConnectTimes
+{
+    uint256 hash;
+    int nHeight = 0;
+    size_t nTx = 0;
+    //! When the block was connected
+    int64_t nTime = 0;
+
+    int64_t nReadFromDisk = 0;
+    int64_t nCheck = 0;
+    int64_t nForks = 0;
+    int64_t nPrefetch = 0;
+    int64_t nConnect = 0;
+    int64_t nVerify = 0;
+    int64_t nUndo = 0;
+    int64_t nJournal = 0;
+    int64_t nFlush = 0;
+    int64_t nChainState = 0;
+    int64_t nPostConnect = 0;
+    int64_t nTotal = 0;
+
+    // Sidechain checks, these run next to connecting the transactions
+    int64_t nRefunds = 0;
+    int64_t nDeposits = 0;
+    int64_t nBundleStatus = 0;
+    //! Time spent waiting for the sidechain checks after the transactions
+    int64_t nSidechainWait = 0;
+
+    // Sidechain index updates
+    int64_t nBundleBroadcast = 0;
+    int64_t nBundleReplicate = 0;
+    int64_t nSidechainDB = 0;
+};
+
+/** Connect timings of the last MAX_BLOCK_CONNECT_TIMES blocks, oldest first */
+std::vector<BlockConnectTimes> GetBlockConnectTimes();
+
 /** Sort deposits by CTIP spend order */
 bool SortDeposits(const std::vector<SidechainDeposit>& vDeposit, std::vector<SidechainDeposit>& vDepositSorted);
 
-/** Check for RPC connection to mainchain node */
+/** Check for RPC connection to mainchain node, caching the result */
 bool CheckMainchainConnection();
 
+/**
+ * Mainchain connection status from the last check. Only asks the mainchain
+ * again while it seemed to be down, the background health check notices
+ * when it goes away.
+ */
+bool IsMainchainConnected();
+
+/**
+ * Answer CheckMainchainConnection in place of the mainchain in the unit
+ * tests: 0 down, 1 up, -1 to ask the mainchain again. The status from the
+ * last check is kept until the next one, as when the connection drops.
+ */
+void SetMockMainchainConnected(int nConnected);
+
 /** Enable or disable networking and print log message */
 void SetNetworkActive(bool fActive, const std::string& strReason = "");
 
@@ -578,6 +715,40 @@ bool VerifyMainBlockCache(std::string& strError);
 /** Disconnect blocks with a BMM commit from an orphan mainchain block */
 void HandleMainchainReorg(const std::vector<uint256>& vOrphan);
 
+/**
+ * Update the mainchain block cache and queue a mainchain reorg, if headers
+ * committing to unknown mainchain blocks were accepted since the last time.
+ * Header sync only works with the cached view of the mainchain, this is
+ * called periodically from the mainchain thread to catch up with the
+ * mainchain once per interval instead of once per headers message.
+ */
+void ReconcileMainchain();
+
+/**
+ * Remember mainchain blocks orphaned by a reorg found on a thread which can't
+ * disconnect sidechain blocks. They are handled by the next call to
+ * HandlePendingMainchainReorg.
+ */
+void QueueMainchainReorg(const std::vector<uint256>& vOrphan);
+
+/** Handle the mainchain reorgs queued by QueueMainchainReorg, if any */
+void HandlePendingMainchainReorg();
+
+/**
+ * Follow the mainchain tip and add any new deposits to the pending deposit
+ * queue of the BMM cache. Mainchain reorgs that are found are queued for the
+ * block and header path.
+ */
+bool UpdateDepositCache();
+
+/**
+ * Follow the mainchain in the background: check the connection, reconcile
+ * the mainchain block cache and, with fDepositPrefetch, queue new deposits.
+ * Runs on its own thread because the requests to the mainchain block, and
+ * must not hold up the scheduler.
+ */
+void ThreadMainchainSync(bool fDepositPrefetch);
+
 CScript EncodeWithdrawalFees(const CAmount& amount);
 
 bool DecodeWithdrawalFees(const CScript& script, CAmount& amount);